@@ -0,0 +1,361 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+// Microbenchmarks for the scheduler, futures and pollers.
+//
+// Each benchmark times `samples` batches of `batch` operations and reports
+// percentiles of the time per operation (in nanoseconds), so that runs can
+// be compared with each other.  Results are written to standard output as
+// JSON:
+//
+//   green-bench [--quick] [name...]
+//
+// Names select benchmarks by prefix (e.g. `poller` runs all poller sizes).
+
+#include <green.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int quick = 0;
+static int first = 1;
+
+typedef struct bench {
+    const char * name;
+    size_t batch;
+    size_t samples;
+    double * values;
+    size_t count;
+} bench_t;
+
+static void bench_init(bench_t * bench, const char * name,
+                       size_t batch, size_t samples)
+{
+    if (quick) {
+        samples = (samples + 9) / 10;
+    }
+    bench->name = name;
+    bench->batch = batch;
+    bench->samples = samples;
+    bench->values = malloc(samples * sizeof(double));
+    bench->count = 0;
+}
+
+// Record the time per operation for one batch.
+static void bench_sample(bench_t * bench, int64_t start, int64_t stop)
+{
+    if (bench->count < bench->samples) {
+        bench->values[bench->count++] =
+            (double)(stop - start) / (double)bench->batch;
+    }
+}
+
+static int compare(const void * lhs, const void * rhs)
+{
+    const double a = *(const double*)lhs;
+    const double b = *(const double*)rhs;
+    return (a > b) - (a < b);
+}
+
+// Nearest-rank percentile over sorted values.
+static double percentile(const bench_t * bench, double p)
+{
+    size_t rank = (size_t)(p / 100.0 * (double)bench->count + 0.5);
+    if (rank > 0) {
+        --rank;
+    }
+    if (rank >= bench->count) {
+        rank = bench->count - 1;
+    }
+    return bench->values[rank];
+}
+
+static void bench_report(bench_t * bench)
+{
+    if (bench->count == 0) {
+        free(bench->values);
+        return;
+    }
+    qsort(bench->values, bench->count, sizeof(double), compare);
+    double sum = 0.0;
+    for (size_t i = 0; i < bench->count; ++i) {
+        sum += bench->values[i];
+    }
+    printf("%s\n    {\"name\": \"%s\", \"unit\": \"ns\", "
+           "\"batch\": %zu, \"samples\": %zu, "
+           "\"min\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+           "\"max\": %.1f, \"mean\": %.1f}",
+           first? "" : ",", bench->name, bench->batch, bench->count,
+           bench->values[0], percentile(bench, 50.0),
+           percentile(bench, 90.0), percentile(bench, 99.0),
+           bench->values[bench->count-1], sum / (double)bench->count);
+    first = 0;
+    fflush(stdout);
+    free(bench->values);
+}
+
+// Round trip through the scheduler: the coroutine goes back to the loop
+// and the loop resumes it.
+static int yield_coroutine(green_loop_t loop, void * object)
+{
+    bench_t * bench = object;
+    for (size_t n = 0; n < bench->samples; ++n) {
+        int64_t start = green_now();
+        for (size_t i = 0; i < bench->batch; ++i) {
+            green_yield(loop, NULL);
+        }
+        bench_sample(bench, start, green_now());
+    }
+    return 0;
+}
+
+static void bench_yield(green_loop_t loop)
+{
+    bench_t bench;
+    bench_init(&bench, "yield", 1000, 1000);
+    green_coroutine_t coro = green_coroutine_init(
+        loop, yield_coroutine, &bench, 0);
+    green_loop_run(loop);
+    green_coroutine_release(coro);
+    bench_report(&bench);
+}
+
+static int empty_coroutine(green_loop_t loop, void * object)
+{
+    return 0;
+}
+
+// Spawn a batch of coroutines, run them to completion and release them.
+static void bench_spawn(green_loop_t loop)
+{
+    bench_t bench;
+    bench_init(&bench, "spawn", 100, 1000);
+    green_coroutine_t * coros = malloc(bench.batch * sizeof(*coros));
+    for (size_t n = 0; n < bench.samples; ++n) {
+        int64_t start = green_now();
+        for (size_t i = 0; i < bench.batch; ++i) {
+            coros[i] = green_coroutine_init(loop, empty_coroutine, NULL, 0);
+        }
+        green_loop_run(loop);
+        for (size_t i = 0; i < bench.batch; ++i) {
+            green_coroutine_release(coros[i]);
+        }
+        bench_sample(&bench, start, green_now());
+    }
+    free(coros);
+    bench_report(&bench);
+}
+
+// Create, complete and release futures, `batch` at a time.
+static void bench_futures(green_loop_t loop, const char * name, size_t batch)
+{
+    bench_t bench;
+    bench_init(&bench, name, batch, 1000000 / batch);
+    green_future_t * futures = malloc(batch * sizeof(green_future_t));
+    for (size_t n = 0; n < bench.samples; ++n) {
+        int64_t start = green_now();
+        for (size_t i = 0; i < batch; ++i) {
+            futures[i] = green_future_init(loop);
+        }
+        for (size_t i = 0; i < batch; ++i) {
+            green_future_set_result(futures[i], NULL, (int)i);
+        }
+        for (size_t i = 0; i < batch; ++i) {
+            green_future_release(futures[i]);
+        }
+        bench_sample(&bench, start, green_now());
+    }
+    free(futures);
+    bench_report(&bench);
+}
+
+// Add a completed future to a poller holding `size - 1` pending futures,
+// then pop it.
+static void bench_poller(green_loop_t loop, const char * name, size_t size)
+{
+    bench_t bench;
+    bench_init(&bench, name, 1000, 1000);
+    green_poller_t poller = green_poller_init(loop, size);
+    green_future_t * pending = malloc(size * sizeof(green_future_t));
+    for (size_t i = 0; i < size - 1; ++i) {
+        pending[i] = green_future_init(loop);
+        green_poller_add(poller, pending[i]);
+    }
+    green_future_t future = green_future_init(loop);
+    green_future_set_result(future, NULL, 0);
+    for (size_t n = 0; n < bench.samples; ++n) {
+        int64_t start = green_now();
+        for (size_t i = 0; i < bench.batch; ++i) {
+            green_poller_add(poller, future);
+            green_poller_pop(poller);
+        }
+        bench_sample(&bench, start, green_now());
+    }
+    green_future_release(future);
+    for (size_t i = 0; i < size - 1; ++i) {
+        green_future_cancel(pending[i]);
+        green_future_release(pending[i]);
+    }
+    green_poller_release(poller);
+    free(pending);
+    bench_report(&bench);
+}
+
+static int idle_coroutine(green_loop_t loop, void * object)
+{
+    green_poller_t poller = green_poller_init(loop, 1);
+    green_poller_add(poller, object);
+    green_select(poller);
+    green_poller_release(poller);
+    return 0;
+}
+
+// Resident set size, in bytes.
+static size_t resident()
+{
+    size_t pages = 0;
+    size_t rss = 0;
+    FILE * file = fopen("/proc/self/statm", "r");
+    if (file == NULL) {
+        return 0;
+    }
+    if (fscanf(file, "%zu %zu", &pages, &rss) != 2) {
+        rss = 0;
+    }
+    fclose(file);
+    return rss * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// Memory held for each coroutine waiting on a future.  Stacks are reported
+// at their mapped size, so the growth of the resident set size shows how much
+// is actually committed.
+static void bench_memory(green_loop_t loop, const char * name,
+                         size_t stack_size)
+{
+    const size_t count = quick? 1000 : 10000;
+    green_coroutine_t * coros = malloc(count * sizeof(*coros));
+    green_future_t * futures = malloc(count * sizeof(*futures));
+    green_memory_stats_t before;
+    green_memory_stats_t after;
+
+    green_loop_memory_stats(loop, &before);
+    size_t rss = resident();
+    for (size_t i = 0; i < count; ++i) {
+        futures[i] = green_future_init(loop);
+        coros[i] = green_coroutine_init(loop, idle_coroutine, futures[i],
+                                        stack_size);
+    }
+    green_loop_run_once(loop);
+    green_loop_memory_stats(loop, &after);
+    rss = resident() - rss;
+
+#define PER_COROUTINE(category) \
+    ((after.category.bytes - before.category.bytes) / count)
+    printf("%s\n    {\"name\": \"%s\", \"unit\": \"bytes\", "
+           "\"coroutines\": %zu, \"stack\": %zu, \"coroutine\": %zu, "
+           "\"future\": %zu, \"poller\": %zu, \"total\": %zu, "
+           "\"resident\": %zu}",
+           first? "" : ",", name, count,
+           PER_COROUTINE(categories[GREEN_MEMORY_STACKS]),
+           PER_COROUTINE(categories[GREEN_MEMORY_COROUTINES]),
+           PER_COROUTINE(categories[GREEN_MEMORY_FUTURES]),
+           PER_COROUTINE(categories[GREEN_MEMORY_POLLERS]),
+           PER_COROUTINE(total), rss / count);
+#undef PER_COROUTINE
+    first = 0;
+    fflush(stdout);
+
+    for (size_t i = 0; i < count; ++i) {
+        green_future_set_result(futures[i], NULL, 0);
+        green_future_release(futures[i]);
+    }
+    green_loop_run(loop);
+    for (size_t i = 0; i < count; ++i) {
+        green_coroutine_release(coros[i]);
+    }
+    free(futures);
+    free(coros);
+}
+
+static int selected(int argc, char ** argv, const char * name)
+{
+    int any = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (argv[i][0] == '-') {
+            continue;
+        }
+        any = 1;
+        if (strncmp(name, argv[i], strlen(argv[i])) == 0) {
+            return 1;
+        }
+    }
+    return !any;
+}
+
+int main(int argc, char ** argv)
+{
+    static const struct {
+        const char * name;
+        size_t size;
+    } futures[] = {
+        {"futures/1", 1},
+        {"futures/64", 64},
+        {"futures/4096", 4096},
+    }, pollers[] = {
+        {"poller/2", 2},
+        {"poller/16", 16},
+        {"poller/256", 256},
+        {"poller/4096", 4096},
+        {"poller/65536", 65536},
+        {"poller/1048576", 1048576},
+    };
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = 1;
+        }
+        else if (argv[i][0] == '-') {
+            fprintf(stderr, "usage: %s [--quick] [name...]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (green_init() != GREEN_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    green_loop_t loop = green_loop_init();
+
+    printf("{\"version\": \"%s\", \"benchmarks\": [", green_version_string());
+    if (selected(argc, argv, "yield")) {
+        bench_yield(loop);
+    }
+    if (selected(argc, argv, "spawn")) {
+        bench_spawn(loop);
+    }
+    for (size_t i = 0; i < sizeof(futures)/sizeof(futures[0]); ++i) {
+        if (selected(argc, argv, futures[i].name)) {
+            bench_futures(loop, futures[i].name, futures[i].size);
+        }
+    }
+    for (size_t i = 0; i < sizeof(pollers)/sizeof(pollers[0]); ++i) {
+        if (quick && (pollers[i].size > 65536)) {
+            continue;
+        }
+        if (selected(argc, argv, pollers[i].name)) {
+            bench_poller(loop, pollers[i].name, pollers[i].size);
+        }
+    }
+    if (selected(argc, argv, "memory/private")) {
+        bench_memory(loop, "memory/private", 0);
+    }
+    if (selected(argc, argv, "memory/shared")) {
+        bench_memory(loop, "memory/shared", GREEN_STACK_SHARED);
+    }
+    printf("\n]}\n");
+
+    green_loop_release(loop);
+    green_term();
+    return EXIT_SUCCESS;
+}
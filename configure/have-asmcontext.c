@@ -0,0 +1,105 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "../src/context.h"
+
+#if !GREEN_CONTEXT_SUPPORTED
+#   error No assembly context switch for this platform.
+#endif
+
+void * hub;
+void * coro;
+int coro_status = 0;
+void * P = NULL;
+int stack_size = 64 * 1024;
+
+void coroutine(void * p)
+{
+    int i = 0;
+    double d = 1.5;
+
+    fprintf(stderr, "coro: enter.\n");
+    if (p != P) {
+        fprintf(stderr, "coro: p != P\n");
+        coro_status = 1;
+    }
+
+    fprintf(stderr, "coro: yield.\n");
+    i++;
+    d *= 2.0;
+    green_context_swap(&coro, hub);
+
+    fprintf(stderr, "coro: check.\n");
+    if ((i != 1) || (d != 3.0)) {
+        fprintf(stderr, "coro: stack corruption detected.\n");
+        coro_status = 1;
+    }
+
+    // NOTE: the entry point must never return, so yield back for good.
+    fprintf(stderr, "coro: leave.\n");
+    green_context_swap(&coro, hub);
+    abort();
+}
+
+int main()
+{
+    int i = 0;
+    double d = 0.5;
+
+    fprintf(stderr, "main: enter.\n");
+
+    // Store the pointer we pass as an argument to the coroutine to make sure
+    // the coroutine can check that it is passed safely.
+    P = &hub;
+
+    // Spawn the coroutine (delayed start).
+    fprintf(stderr, "main: spawn.\n");
+    void * stack = malloc(stack_size);
+    if (stack == NULL) {
+        fprintf(stderr, "main: malloc()\n");
+        return EXIT_FAILURE;
+    }
+    coro = green_context_make(stack, stack_size, coroutine, &hub);
+
+    // Yield to the coroutine until it yields back.
+    i++;
+    d *= 3.0;
+    fprintf(stderr, "main: yield (1).\n");
+    green_context_swap(&hub, coro);
+    if (coro_status != 0) {
+        fprintf(stderr, "main: coroutine error\n");
+        return EXIT_FAILURE;
+    }
+
+    // Check for stack corruption.
+    fprintf(stderr, "main: check.\n");
+    if ((i != 1) || (d != 1.5)) {
+        fprintf(stderr, "main: stack corruption detected.\n");
+        return EXIT_FAILURE;
+    }
+
+    // Yield back to the coroutine to let it finish.
+    i++;
+    fprintf(stderr, "main: yield (2).\n");
+    green_context_swap(&hub, coro);
+    if (coro_status != 0) {
+        fprintf(stderr, "main: coroutine error\n");
+        return EXIT_FAILURE;
+    }
+
+    // Check for stack corruption.
+    fprintf(stderr, "main: check.\n");
+    if (i != 2) {
+        fprintf(stderr, "main: stack corruption detected.\n");
+        return EXIT_FAILURE;
+    }
+
+    fprintf(stderr, "main: cleanup.\n");
+    free(stack);
+
+    fprintf(stderr, "main: leave.\n");
+    return EXIT_SUCCESS;
+}
@@ -6,6 +6,10 @@
 #define _GREEN_H__
 
 #include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <sys/socket.h>
 
 // Library version.
 #define GREEN_MAJOR 0
@@ -38,6 +42,8 @@
 #define GREEN_ENOENT 6
 #define GREEN_ENFILE 7
 #define GREEN_EBADFD 8
+#define GREEN_EAGAIN 9
+#define GREEN_EPIPE 10
 
 // Lib version.
 int green_version();
@@ -55,6 +61,118 @@ green_loop_t green_loop_init();
 int green_loop_acquire(green_loop_t loop);
 int green_loop_release(green_loop_t loop);
 
+// Memory accounting.
+#define GREEN_MEMORY_OTHER 0
+#define GREEN_MEMORY_STACKS 1
+#define GREEN_MEMORY_COROUTINES 2
+#define GREEN_MEMORY_FUTURES 3
+#define GREEN_MEMORY_POLLERS 4
+#define GREEN_MEMORY_TIMERS 5
+#define GREEN_MEMORY_CATEGORIES 6
+
+typedef struct green_memory_usage {
+    size_t bytes;
+    size_t peak;
+    size_t objects;
+    size_t allocs;
+} green_memory_usage_t;
+
+typedef struct green_memory_stats {
+    green_memory_usage_t total;
+    green_memory_usage_t categories[GREEN_MEMORY_CATEGORIES];
+} green_memory_stats_t;
+
+int green_memory_stats(green_memory_stats_t * stats);
+int green_loop_memory_stats(green_loop_t loop, green_memory_stats_t * stats);
+
+// Loop statistics.
+#define GREEN_STATS_BUCKETS 32
+
+typedef struct green_loop_stats {
+    uint64_t switches;
+    uint64_t spawned;
+    uint64_t live;
+    uint64_t finished;
+    uint64_t migrated_in;
+    uint64_t migrated_out;
+    uint64_t futures_created;
+    uint64_t futures_completed;
+    uint64_t futures_canceled;
+    uint64_t poller_adds;
+    uint64_t poller_pops;
+    int64_t busy;
+    int64_t idle;
+    uint64_t blocked[GREEN_STATS_BUCKETS];
+} green_loop_stats_t;
+
+int green_loop_stats(green_loop_t loop, green_loop_stats_t * stats);
+
+// Tracing.
+#define GREEN_TRACE_SCHEDULER 1
+#define GREEN_TRACE_FUTURES 2
+#define GREEN_TRACE_POLLERS 4
+#define GREEN_TRACE_ALL 7
+
+#define GREEN_TRACE_SPAWN 1
+#define GREEN_TRACE_RESUME 2
+#define GREEN_TRACE_SUSPEND 3
+#define GREEN_TRACE_STOP 4
+#define GREEN_TRACE_COMPLETE 5
+#define GREEN_TRACE_CANCEL 6
+#define GREEN_TRACE_POLLER_ADD 7
+#define GREEN_TRACE_POLLER_REM 8
+#define GREEN_TRACE_POLLER_POP 9
+
+typedef struct green_trace_event {
+    int64_t time;
+    uint64_t source;
+    uint64_t arg;
+    uint32_t coro;
+    uint32_t type;
+} green_trace_event_t;
+
+// Trace dump header, followed by the events and the source strings.
+#define GREEN_TRACE_MAGIC "GRNTRACE"
+#define GREEN_TRACE_FORMAT 1
+
+typedef struct green_trace_header {
+    char magic[8];
+    uint32_t format;
+    uint32_t events;
+    uint32_t strings;
+    uint32_t reserved;
+} green_trace_header_t;
+
+int green_loop_trace(green_loop_t loop, int categories, size_t size);
+size_t green_loop_trace_read(green_loop_t loop,
+                             green_trace_event_t * events, size_t size);
+int green_loop_trace_dump(green_loop_t loop, int fd);
+
+// Coroutine cache.
+int green_loop_set_cache_limits(green_loop_t loop, size_t low, size_t high);
+int green_loop_trim(green_loop_t loop);
+size_t green_loop_cache_size(green_loop_t loop);
+
+// Stack profiling.
+#define GREEN_STACK_MEASURE 1
+#define GREEN_STACK_ADAPT 2
+
+typedef struct green_stack_site {
+    const char * source;
+    size_t count;
+    size_t max;
+    size_t size;
+} green_stack_site_t;
+
+int green_loop_stack_profile(green_loop_t loop, int flags);
+size_t green_loop_stack_sites(green_loop_t loop,
+                              green_stack_site_t * sites, size_t size);
+
+// Shared stack.
+#define GREEN_STACK_SHARED ((size_t)-1)
+
+int green_loop_set_shared_stack(green_loop_t loop, size_t size);
+
 // Coroutine methods.
 typedef struct green_coroutine * green_coroutine_t;
 
@@ -75,18 +193,90 @@ int green_coroutine_result(green_coroutine_t coro);
 int green_coroutine_acquire(green_coroutine_t coro);
 int green_coroutine_release(green_coroutine_t coro);
 
+// Coroutine-local storage.
+#define GREEN_CLS_KEYS 256
+typedef int green_cls_key_t;
+int green_cls_key_create(green_cls_key_t * key, void(*destructor)(void*));
+void * green_cls_get(green_loop_t loop, green_cls_key_t key);
+int green_cls_set(green_loop_t loop, green_cls_key_t key, void * value);
+
 // Future.
 typedef struct green_future * green_future_t;
 green_future_t green_future_init(green_loop_t loop);
 int green_future_done(green_future_t future);
 int green_future_canceled(green_future_t future);
 int green_future_set_result(green_future_t future, void * p, int i);
+int green_future_set_error(green_future_t future, int error);
 int green_future_result(green_future_t future, void ** p, int * i);
 int green_future_cancel(green_future_t future);
+int green_future_share(green_future_t future);
+int green_future_set_result_threadsafe(green_future_t future, void * p, int i);
 
 int green_future_acquire(green_future_t future);
 int green_future_release(green_future_t future);
 
+// Scheduler.
+int green_loop_run(green_loop_t loop);
+int green_loop_run_once(green_loop_t loop);
+int green_loop_run_until(green_loop_t loop, green_future_t future);
+
+// Loop group.
+typedef struct green_loop_group * green_loop_group_t;
+green_loop_group_t green_loop_group_init(size_t size);
+int green_loop_group_acquire(green_loop_group_t group);
+int green_loop_group_release(green_loop_group_t group);
+size_t green_loop_group_size(green_loop_group_t group);
+int _green_loop_group_spawn(
+    green_loop_group_t group, int(*method)(green_loop_t,void*),
+    void * object, size_t stack_size, const char * source
+);
+#define green_loop_group_spawn(group, method, object, stack_size) \
+    _green_loop_group_spawn(group, method, object, stack_size, \
+                            __FILE__ ":" GREEN_STRING(__LINE__))
+int green_loop_group_run(green_loop_group_t group);
+green_loop_t _green_yield_any(green_loop_t loop, const char * source);
+#define green_yield_any(loop) \
+    _green_yield_any(loop, __FILE__ ":" GREEN_STRING(__LINE__))
+
+// I/O readiness.
+#define GREEN_FD_READABLE 1
+#define GREEN_FD_WRITABLE 2
+#define GREEN_FD_ERROR 4
+
+green_future_t green_fd_readable(green_loop_t loop, int fd);
+green_future_t green_fd_writable(green_loop_t loop, int fd);
+int green_fd_detach(green_loop_t loop, int fd);
+
+// I/O operations.
+green_future_t green_read(green_loop_t loop, int fd,
+                          void * data, size_t size, off_t offset);
+green_future_t green_write(green_loop_t loop, int fd,
+                           const void * data, size_t size, off_t offset);
+green_future_t green_recv(green_loop_t loop, int fd,
+                          void * data, size_t size, int flags);
+green_future_t green_send(green_loop_t loop, int fd,
+                          const void * data, size_t size, int flags);
+green_future_t green_accept(green_loop_t loop, int fd,
+                            struct sockaddr * addr, socklen_t * size);
+green_future_t green_connect(green_loop_t loop, int fd,
+                             const struct sockaddr * addr, socklen_t size);
+
+// Offload pool.
+int green_offload_configure(size_t threads, size_t depth);
+green_future_t green_offload(green_loop_t loop,
+                             int(*method)(void*), void * object);
+
+// Watchdog.
+int green_loop_watchdog(green_loop_t loop, int64_t threshold,
+                        int fd, int signal);
+
+// Timers.  Times are in nanoseconds, deadlines are relative to `green_now()`.
+int64_t green_now();
+green_future_t green_timer_future(green_loop_t loop, int64_t deadline);
+int _green_sleep(green_loop_t loop, int64_t duration, const char * source);
+#define green_sleep(loop, duration) \
+    _green_sleep(loop, duration, __FILE__ ":" GREEN_STRING(__LINE__))
+
 // Poller.
 typedef struct green_poller * green_poller_t;
 green_poller_t green_poller_init(green_loop_t loop, size_t size);
@@ -94,14 +284,139 @@ size_t green_poller_size(green_poller_t poller);
 size_t green_poller_used(green_poller_t poller);
 size_t green_poller_done(green_poller_t poller);
 int green_poller_add(green_poller_t poller, green_future_t future);
+int green_poller_add_many(green_poller_t poller,
+                          green_future_t * futures, size_t size);
 int green_poller_rem(green_poller_t poller, green_future_t future);
 green_future_t green_poller_pop(green_poller_t poller);
+size_t green_poller_pop_many(green_poller_t poller,
+                             green_future_t * futures, size_t size);
 
 int green_poller_acquire(green_poller_t poller);
 int green_poller_release(green_poller_t poller);
 
 green_future_t _green_select(green_poller_t poller, const char * source);
 #define green_select(poller) \
-    green_select_ex(poller, timeout, __FILE__ ":" GREEN_STRING(__LINE__))
+    _green_select(poller, __FILE__ ":" GREEN_STRING(__LINE__))
+green_future_t _green_select_ex(green_poller_t poller, int64_t timeout,
+                                const char * source);
+#define green_select_ex(poller, timeout) \
+    _green_select_ex(poller, timeout, __FILE__ ":" GREEN_STRING(__LINE__))
+
+// Coroutine registry.
+#define GREEN_COROUTINE_PENDING 0
+#define GREEN_COROUTINE_RUNNING 1
+#define GREEN_COROUTINE_BLOCKED 2
+#define GREEN_COROUTINE_STOPPED 3
+
+typedef struct green_coroutine_info {
+    int id;
+    int state;
+    int ready;
+    int sleeping;
+    int waiting;
+    int64_t switched;
+    green_poller_t poller;
+    green_future_t future;
+    const char * source;
+    const char * origin;
+} green_coroutine_info_t;
+
+green_coroutine_t green_loop_next_coroutine(green_loop_t loop,
+                                            green_coroutine_t coro);
+int green_coroutine_info(green_coroutine_t coro,
+                         green_coroutine_info_t * info);
+int green_loop_dump(green_loop_t loop, FILE * file);
+int green_loop_dump_on_signal(green_loop_t loop, int signal, FILE * file);
+
+// Channel.
+typedef struct green_channel * green_channel_t;
+green_channel_t green_channel_init(green_loop_t loop, size_t size);
+size_t green_channel_size(green_channel_t channel);
+size_t green_channel_used(green_channel_t channel);
+int green_channel_close(green_channel_t channel);
+
+int green_channel_acquire(green_channel_t channel);
+int green_channel_release(green_channel_t channel);
+
+int _green_channel_send(green_channel_t channel, void * p, int i,
+                        const char * source);
+#define green_channel_send(channel, p, i) \
+    _green_channel_send(channel, p, i, __FILE__ ":" GREEN_STRING(__LINE__))
+int _green_channel_recv(green_channel_t channel, void ** p, int * i,
+                        const char * source);
+#define green_channel_recv(channel, p, i) \
+    _green_channel_recv(channel, p, i, __FILE__ ":" GREEN_STRING(__LINE__))
+green_future_t green_channel_send_future(green_channel_t channel,
+                                         void * p, int i);
+green_future_t green_channel_recv_future(green_channel_t channel);
+
+// Mutex.
+typedef struct green_mutex * green_mutex_t;
+green_mutex_t green_mutex_init(green_loop_t loop);
+int green_mutex_acquire(green_mutex_t mutex);
+int green_mutex_release(green_mutex_t mutex);
+int _green_mutex_lock(green_mutex_t mutex, const char * source);
+#define green_mutex_lock(mutex) \
+    _green_mutex_lock(mutex, __FILE__ ":" GREEN_STRING(__LINE__))
+int green_mutex_trylock(green_mutex_t mutex);
+int green_mutex_unlock(green_mutex_t mutex);
+
+// Condition variable.
+typedef struct green_cond * green_cond_t;
+green_cond_t green_cond_init(green_loop_t loop);
+int green_cond_acquire(green_cond_t cond);
+int green_cond_release(green_cond_t cond);
+int _green_cond_wait(green_cond_t cond, green_mutex_t mutex,
+                     const char * source);
+#define green_cond_wait(cond, mutex) \
+    _green_cond_wait(cond, mutex, __FILE__ ":" GREEN_STRING(__LINE__))
+int green_cond_signal(green_cond_t cond);
+int green_cond_broadcast(green_cond_t cond);
+
+// Semaphore.
+typedef struct green_sem * green_sem_t;
+green_sem_t green_sem_init(green_loop_t loop, size_t count);
+int green_sem_acquire(green_sem_t sem);
+int green_sem_release(green_sem_t sem);
+size_t green_sem_value(green_sem_t sem);
+int _green_sem_wait(green_sem_t sem, const char * source);
+#define green_sem_wait(sem) \
+    _green_sem_wait(sem, __FILE__ ":" GREEN_STRING(__LINE__))
+int green_sem_trywait(green_sem_t sem);
+int green_sem_post(green_sem_t sem);
+
+// Wait group.
+typedef struct green_waitgroup * green_waitgroup_t;
+green_waitgroup_t green_waitgroup_init(green_loop_t loop);
+int green_waitgroup_acquire(green_waitgroup_t group);
+int green_waitgroup_release(green_waitgroup_t group);
+size_t green_waitgroup_count(green_waitgroup_t group);
+int green_waitgroup_add(green_waitgroup_t group, size_t count);
+int green_waitgroup_done(green_waitgroup_t group);
+int _green_waitgroup_wait(green_waitgroup_t group, const char * source);
+#define green_waitgroup_wait(group) \
+    _green_waitgroup_wait(group, __FILE__ ":" GREEN_STRING(__LINE__))
+
+// Task group.
+typedef struct green_taskgroup * green_taskgroup_t;
+green_taskgroup_t green_taskgroup_init(green_loop_t loop,
+                                       green_taskgroup_t parent);
+int green_taskgroup_acquire(green_taskgroup_t group);
+int green_taskgroup_release(green_taskgroup_t group);
+size_t green_taskgroup_size(green_taskgroup_t group);
+green_taskgroup_t green_taskgroup_current(green_loop_t loop);
+green_coroutine_t _green_taskgroup_spawn(
+    green_taskgroup_t group, int(*method)(green_loop_t,void*),
+    void * object, size_t stack_size, const char * source
+);
+#define green_taskgroup_spawn(group, method, object, stack_size) \
+    _green_taskgroup_spawn(group, method, object, stack_size, \
+                           __FILE__ ":" GREEN_STRING(__LINE__))
+int _green_taskgroup_join(green_taskgroup_t group, const char * source);
+#define green_taskgroup_join(group) \
+    _green_taskgroup_join(group, __FILE__ ":" GREEN_STRING(__LINE__))
+int green_taskgroup_cancel(green_taskgroup_t group);
+int green_taskgroup_canceled(green_taskgroup_t group);
+int green_taskgroup_set_deadline(green_taskgroup_t group, int64_t deadline);
 
 #endif // _GREEN_H__
@@ -0,0 +1,186 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#ifndef _GREEN_CONTEXT_H__
+#define _GREEN_CONTEXT_H__
+
+// Minimal context switch for the supported ABIs.
+//
+// A suspended context is represented by its stack pointer alone: the switch
+// pushes the callee-saved registers onto the current stack, stores the stack
+// pointer, loads the other stack pointer and pops the registers saved there.
+// Everything else is already saved by the caller, as required by the calling
+// convention, so there is no need to save the full register file and, unlike
+// `swapcontext()`, the signal mask is left alone (no system call).
+//
+// NOTE: this header is also used by the configure probe, so it must stay
+//       self-contained.
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__x86_64__) && defined(__ELF__)
+#   define GREEN_CONTEXT_SUPPORTED 1
+#elif defined(__aarch64__) && defined(__ELF__)
+#   define GREEN_CONTEXT_SUPPORTED 1
+#else
+#   define GREEN_CONTEXT_SUPPORTED 0
+#endif
+
+#if GREEN_CONTEXT_SUPPORTED
+
+// Save the current context into `*from` and resume the context in `to`.
+void green_context_swap(void ** from, void * to);
+
+// Entry point of a new context.  It must never return.
+void green_context_trampoline(void);
+
+#if defined(__x86_64__)
+
+// Frame layout (from the stack pointer, upwards):
+//
+//   [0] MXCSR (low 32 bits) and x87 control word (next 16 bits).
+//   [1] r12 (entry point on first switch)
+//   [2] r13 (entry argument on first switch)
+//   [3] r14
+//   [4] r15
+//   [5] rbx
+//   [6] rbp
+//   [7] return address (trampoline on first switch)
+__asm__ (
+    ".text\n"
+    ".globl green_context_swap\n"
+    ".hidden green_context_swap\n"
+    ".type green_context_swap,@function\n"
+    ".align 16\n"
+    "green_context_swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r15\n"
+    "    pushq %r14\n"
+    "    pushq %r13\n"
+    "    pushq %r12\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r12\n"
+    "    popq %r13\n"
+    "    popq %r14\n"
+    "    popq %r15\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    ret\n"
+    ".size green_context_swap,.-green_context_swap\n"
+    "\n"
+    ".globl green_context_trampoline\n"
+    ".hidden green_context_trampoline\n"
+    ".type green_context_trampoline,@function\n"
+    ".align 16\n"
+    "green_context_trampoline:\n"
+    "    movq %r13, %rdi\n"
+    "    callq *%r12\n"
+    "    ud2\n"
+    ".size green_context_trampoline,.-green_context_trampoline\n"
+);
+
+#define GREEN_CONTEXT_FRAME_SIZE 8
+
+static inline void * green_context_make(void * stack, size_t size,
+                                        void(*entry)(void*), void * arg)
+{
+    // Stack must be 16-byte aligned after the trampoline is "called" by the
+    // final `ret` of the first switch.
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t * frame = (uint64_t*)top - GREEN_CONTEXT_FRAME_SIZE;
+    frame[0] = 0x1F80 | ((uint64_t)0x037F << 32);
+    frame[1] = (uint64_t)(uintptr_t)entry;
+    frame[2] = (uint64_t)(uintptr_t)arg;
+    frame[3] = 0;
+    frame[4] = 0;
+    frame[5] = 0;
+    frame[6] = 0;
+    frame[7] = (uint64_t)(uintptr_t)&green_context_trampoline;
+    return frame;
+}
+
+#elif defined(__aarch64__)
+
+// Frame layout (from the stack pointer, upwards):
+//
+//   [0..9]   x19-x28 (entry point in x19 and argument in x20 on first switch)
+//   [10]     x29 (frame pointer)
+//   [11]     x30 (return address, trampoline on first switch)
+//   [12..19] d8-d15
+__asm__ (
+    ".text\n"
+    ".globl green_context_swap\n"
+    ".hidden green_context_swap\n"
+    ".type green_context_swap,%function\n"
+    ".align 4\n"
+    "green_context_swap:\n"
+    "    sub sp, sp, #160\n"
+    "    stp x19, x20, [sp, #0]\n"
+    "    stp x21, x22, [sp, #16]\n"
+    "    stp x23, x24, [sp, #32]\n"
+    "    stp x25, x26, [sp, #48]\n"
+    "    stp x27, x28, [sp, #64]\n"
+    "    stp x29, x30, [sp, #80]\n"
+    "    stp d8, d9, [sp, #96]\n"
+    "    stp d10, d11, [sp, #112]\n"
+    "    stp d12, d13, [sp, #128]\n"
+    "    stp d14, d15, [sp, #144]\n"
+    "    mov x9, sp\n"
+    "    str x9, [x0]\n"
+    "    mov sp, x1\n"
+    "    ldp x19, x20, [sp, #0]\n"
+    "    ldp x21, x22, [sp, #16]\n"
+    "    ldp x23, x24, [sp, #32]\n"
+    "    ldp x25, x26, [sp, #48]\n"
+    "    ldp x27, x28, [sp, #64]\n"
+    "    ldp x29, x30, [sp, #80]\n"
+    "    ldp d8, d9, [sp, #96]\n"
+    "    ldp d10, d11, [sp, #112]\n"
+    "    ldp d12, d13, [sp, #128]\n"
+    "    ldp d14, d15, [sp, #144]\n"
+    "    add sp, sp, #160\n"
+    "    ret\n"
+    ".size green_context_swap,.-green_context_swap\n"
+    "\n"
+    ".globl green_context_trampoline\n"
+    ".hidden green_context_trampoline\n"
+    ".type green_context_trampoline,%function\n"
+    ".align 4\n"
+    "green_context_trampoline:\n"
+    "    mov x0, x20\n"
+    "    blr x19\n"
+    "    brk #0\n"
+    ".size green_context_trampoline,.-green_context_trampoline\n"
+);
+
+#define GREEN_CONTEXT_FRAME_SIZE 20
+
+static inline void * green_context_make(void * stack, size_t size,
+                                        void(*entry)(void*), void * arg)
+{
+    uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+    uint64_t * frame = (uint64_t*)top - GREEN_CONTEXT_FRAME_SIZE;
+    for (int i = 0; i < GREEN_CONTEXT_FRAME_SIZE; ++i) {
+        frame[i] = 0;
+    }
+    frame[0] = (uint64_t)(uintptr_t)entry;
+    frame[1] = (uint64_t)(uintptr_t)arg;
+    frame[11] = (uint64_t)(uintptr_t)&green_context_trampoline;
+    return frame;
+}
+
+#endif
+
+#endif // GREEN_CONTEXT_SUPPORTED
+
+#endif // _GREEN_CONTEXT_H__
@@ -6,28 +6,302 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <math.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include "configure.h"
 
 #if GREEN_USE_UCONTEXT
 #   include <ucontext.h>
 #endif
+#if GREEN_USE_ASMCONTEXT
+#   include "context.h"
+#endif
+
+#if GREEN_USE_EPOLL
+#   include <sys/epoll.h>
+#   include <sys/eventfd.h>
+#endif
+#if GREEN_USE_IO_URING
+#   include <linux/io_uring.h>
+#   include <sys/syscall.h>
+#endif
+#if GREEN_USE_BACKTRACE
+#   include <execinfo.h>
+#endif
+
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#   define MAP_ANONYMOUS MAP_ANON
+#endif
+
+// AddressSanitizer keeps track of stack frames, which get copied around in
+// shared stack mode.
+#if defined(__SANITIZE_ADDRESS__)
+#   include <sanitizer/asan_interface.h>
+#else
+#   define ASAN_UNPOISON_MEMORY_REGION(p, size) ((void)(p), (void)(size))
+#endif
 
 // ucontext documentation suggests using SIGSTKSZ, but it seems to be too
 // small on Linux and segfaults on first swapcontext.
 static const int DEFAULT_STACK_SIZE = 64 * 1024;
 
+// Coroutines spawned with `GREEN_STACK_SHARED` all run on one stack per loop
+// and keep a copy of their frames while they are blocked.
+static const size_t DEFAULT_SHARED_STACK_SIZE = 256 * 1024;
+
+// Released coroutines are kept (along with their stack) for reuse.  Stack
+// sizes are rounded up to a power of two pages so that each bucket holds
+// interchangeable stacks.  Larger stacks are not cached.
+#define GREEN_CACHE_BUCKETS 16
+static const size_t DEFAULT_CACHE_LOW = 32;
+static const size_t DEFAULT_CACHE_HIGH = 128;
+
+// Coroutine-local storage keys stored inline in each coroutine.
+#define GREEN_CLS_INLINE 8
+
+// Stack profiling.  Stacks are painted with a pattern before the coroutine
+// starts, so the high-water mark is the first word (from the bottom) that
+// doesn't hold the pattern anymore.  Call sites need a few samples before
+// their learned size is used.
+#define GREEN_STACK_PATTERN ((uintptr_t)0x5a5a5a5a5a5a5a5aULL)
+#define GREEN_STACK_SAMPLES 16
+
+// Fixed-size object pool.  Objects are carved out of large slabs and recycled
+// through a free list, so allocation is a list pop and objects allocated
+// around the same time are close to each other in memory.
+#define GREEN_SLAB_SIZE (16 * 1024)
+
+struct green_slab {
+    struct green_slab * next;
+};
+
+struct green_pool {
+    green_loop_t loop;
+    int category;
+    size_t size;
+    void * free;
+    struct green_slab * slabs;
+};
+
+// Readiness state for a file descriptor registered with the reactor.
+struct green_fd {
+    int registered;
+    int events;
+    green_future_t reader;
+    green_future_t writer;
+};
+
+// Timing wheel.  Level `l` has 64 slots of 64^l ticks each, so six levels of
+// one millisecond ticks cover about two years.  Timers are placed in the
+// level where their expiry first differs from the current tick, and move
+// down one or more levels when the wheel reaches their slot.  Insert and
+// cancel are O(1).
+#define GREEN_WHEEL_LEVELS 6
+#define GREEN_WHEEL_BITS 6
+#define GREEN_WHEEL_SLOTS (1 << GREEN_WHEEL_BITS)
+static const int64_t GREEN_TICK = 1000000;
+
+struct green_timer {
+    // Intrusive list (wheel slot).
+    struct green_timer * prev;
+    struct green_timer * next;
+    int64_t expiry;
+    int slot;
+
+    // What to do on expiry: complete the future, resume the coroutine
+    // (stop it from waiting on the poller first, if any) or cancel the task
+    // group.
+    green_future_t future;
+    green_coroutine_t coro;
+    green_poller_t poller;
+    green_taskgroup_t group;
+};
+
+// High-water marks of coroutines spawned from one call site.  Samples are
+// counted by the cache bucket that fits them, safety margin included (the
+// last slot counts samples too large for any bucket).
+struct green_stack_stats {
+    const char * source;
+    size_t count;
+    size_t max;
+    size_t buckets[GREEN_CACHE_BUCKETS + 1];
+};
+
+struct green_worker;
+
 struct green_loop {
 
     int refs;
     int coroutines;
     int nextcoroid;
 
+    // Cache of released coroutines, by stack size.  When it grows past the
+    // high watermark, it is trimmed down to the low watermark.
+    struct {
+        green_coroutine_t buckets[GREEN_CACHE_BUCKETS];
+        size_t size;
+        size_t low;
+        size_t high;
+    } cache;
+
+    // Memory held on behalf of this loop.
+    green_memory_stats_t memory;
+
+    // Activity counters (`live` is computed on demand).
+    green_loop_stats_t stats;
+
+    // Shared stack, mapped on first use, and the coroutine whose frames are
+    // on it right now.
+    struct {
+        void * stack;
+        size_t size;
+        size_t coroutines;
+        green_coroutine_t owner;
+    } shared;
+
+    // Stack profiling, by spawn site (open addressing on the `source`
+    // pointer, so each call site gets its own entry).
+    struct {
+        int flags;
+        struct green_stack_stats * sites;
+        size_t size;
+        size_t used;
+    } stacks;
+
+    // Object pools.
+    struct green_pool coroutine_pool;
+    struct green_pool future_pool;
+    struct green_pool poller_pool;
+    struct green_pool timer_pool;
+    struct green_pool wait_pool;
+
 #if GREEN_USE_UCONTEXT
     ucontext_t context;
 #endif
+#if GREEN_USE_ASMCONTEXT
+    void * context;
+#endif
 
     green_coroutine_t currentcoro;
+
+    // Coroutines that were not released yet, in spawn order.
+    struct {
+        green_coroutine_t head;
+        green_coroutine_t tail;
+    } registry;
+
+    // Time when the current batch of coroutines started, so that context
+    // switches can be timestamped without reading the clock each time.
+    int64_t clock;
+
+    // Dump requested by a signal: where to write it, and how many times the
+    // signal was caught as of the last dump.
+    struct {
+        int signal;
+        FILE * file;
+        int seen;
+    } dump;
+
+    // Coroutines waiting for their turn to run (FIFO).  The queue holds a
+    // reference to each coroutine it contains.
+    struct {
+        green_coroutine_t head;
+        green_coroutine_t tail;
+        size_t size;
+        size_t migratable;
+    } ready;
+
+    // I/O reactor, created on first use.  Registrations are indexed by file
+    // descriptor.
+    struct {
+        int fd;
+        struct green_fd * fds;
+        size_t size;
+        size_t waiting;
+    } reactor;
+
+    // Wake-up channel for other threads, created on first use.  `idle` is set
+    // while the loop is (about to be) blocked waiting for events.
+    struct {
+        int fd;
+        int idle;
+    } wake;
+
+#if GREEN_USE_TRACE
+    // Most recent trace events.  Only the loop's thread writes; `head`
+    // counts all events written so far.
+    struct {
+        int categories;
+        green_trace_event_t * events;
+        size_t size;
+        uint64_t head;
+    } trace;
+#endif
+
+    // Loop group worker that runs this loop, if any.
+    struct green_worker * worker;
+
+    // Watchdog.  The loop publishes which coroutine holds it, on which
+    // thread and since when (zero while the loop itself runs).  The rest belongs to the watchdog
+    // thread and is protected by its lock.
+    struct {
+        int enabled;
+        int64_t since;
+        int id;
+        const char * source;
+        pthread_t thread;
+        int64_t threshold;
+        int fd;
+        int signal;
+        int64_t reported;
+        green_loop_t next;
+    } watchdog;
+
+    // Futures completed from other threads (LIFO, shared with other threads)
+    // and number of futures shared with other threads.
+    struct {
+        green_future_t head;
+        size_t pending;
+    } remote;
+
+    // Timers, by expiry.  `now` is the next tick to process.
+    struct {
+        int64_t now;
+        size_t size;
+        uint64_t occupied[GREEN_WHEEL_LEVELS];
+        struct green_timer * slots[GREEN_WHEEL_LEVELS][GREEN_WHEEL_SLOTS];
+    } timers;
+
+#if GREEN_USE_IO_URING
+    // io_uring instance, created on first use.  The descriptor is -1 until
+    // then, and -2 if io_uring turns out to be unavailable.
+    struct {
+        int fd;
+        unsigned entries;
+        unsigned queued;
+        unsigned * sq_head;
+        unsigned * sq_tail;
+        unsigned * sq_mask;
+        unsigned * sq_array;
+        struct io_uring_sqe * sqes;
+        unsigned * cq_head;
+        unsigned * cq_tail;
+        unsigned * cq_mask;
+        struct io_uring_cqe * cqes;
+        void * sq_ring;
+        size_t sq_ring_size;
+        void * cq_ring;
+        size_t cq_ring_size;
+        size_t sqes_size;
+    } uring;
+#endif
 };
 
 typedef enum green_coroutine_state {
@@ -51,11 +325,65 @@ struct green_coroutine {
 
 #if GREEN_USE_UCONTEXT
     ucontext_t context;
-    void * stack;
 #endif
+#if GREEN_USE_ASMCONTEXT
+    void * context;
+#endif
+    void * stack;
+    size_t stack_size;
+    int bucket;
+
+    // Bytes at the top of the stack that may not hold the profiling pattern
+    // anymore, and whether the stack was painted for this run.
+    size_t stack_dirty;
+    int stack_painted;
+
+    // Coroutines on the loop's shared stack have no stack of their own.
+    // Their frames are copied here when another coroutine needs the stack.
+    int shared;
+    void * saved;
+    size_t saved_size;
+    size_t saved_capacity;
+
+    // Intrusive list (ready queue, coroutine cache or loop group migrants).
+    green_coroutine_t prev;
+    green_coroutine_t next;
+    int ready;
 
-    // Last known location (from init or yield).
+    // Parked in `green_yield_any()`, so a loop group may move it to another
+    // loop.
+    int migratable;
+
+    // Last known location (from init or yield) and spawn site.
     const char * source;
+    const char * origin;
+
+    // Loop's registry (intrusive list) and loop's clock when the coroutine
+    // last started or stopped running.
+    green_coroutine_t registry_prev;
+    green_coroutine_t registry_next;
+    int64_t switched;
+
+    // Wake-up timer for `green_sleep()` and `green_select_ex()`.
+    struct green_timer timer;
+
+    // Task group, if any (intrusive list of running members).
+    green_taskgroup_t group;
+    green_coroutine_t group_prev;
+    green_coroutine_t group_next;
+
+    // What the coroutine is blocked on, so that canceling its task group can
+    // wake it up.  Sleeping coroutines only have their timer armed.
+    green_poller_t blocked_poller;
+    struct green_wait * blocked_wait;
+
+    // Coroutine-local storage: the first keys are stored inline, the rest
+    // in an array that grows on demand.
+    struct {
+        void * values[GREEN_CLS_INLINE];
+        void ** overflow;
+        size_t size;
+    } cls;
 };
 
 
@@ -64,9 +392,43 @@ typedef enum green_future_state {
     green_future_pending,
     green_future_aborted,
     green_future_complete,
+    green_future_failed,
 
 } green_future_state_t;
 
+// System call that the reactor retries once the descriptor is ready, where
+// io_uring is not available.
+enum green_io_op {
+
+    green_io_none,
+    green_io_read,
+    green_io_write,
+    green_io_recv,
+    green_io_send,
+    green_io_accept,
+    green_io_connect,
+
+};
+
+struct green_io {
+    enum green_io_op op;
+    void * data;
+    size_t size;
+    off_t offset;
+    int flags;
+    socklen_t * length;
+    int started;
+};
+
+// State of `green_future_share()`, see `struct green_future`.
+enum green_share_state {
+
+    green_share_free,
+    green_share_shared,
+    green_share_posted,
+
+};
+
 struct green_future {
 
     green_loop_t loop;
@@ -82,6 +444,32 @@ struct green_future {
     // Intrusive set.
     green_poller_t poller;
     int slot;
+
+    // Timer that completes the future, if any.
+    struct green_timer * timer;
+
+    // Submitted to io_uring, until the completion is reaped.
+    int uring;
+
+    // Held in a reactor slot, until the descriptor is ready (and the system
+    // call in `io`, if any, no longer blocks).
+    struct {
+        int waiting;
+        int fd;
+        int write;
+        struct green_io io;
+    } reactor;
+
+    // Result posted from another thread (intrusive MPSC queue).  The future
+    // is its own queue node, so it can only be shared once at a time: the
+    // share goes from free to shared to posted, and back to free once the
+    // loop picks up the result.
+    struct {
+        green_future_t next;
+        void * p;
+        int i;
+        int share;
+    } remote;
 };
 
 struct green_poller {
@@ -94,6 +482,76 @@ struct green_poller {
     size_t used;
     size_t size;
     size_t busy;
+
+    // Coroutine blocked in `green_select()`, if any.
+    green_coroutine_t waiter;
+};
+
+// Coroutine or future blocked on a channel.  Coroutines keep this on their
+// stack while they are suspended, futures get one from the loop's pool.
+struct green_wait {
+    struct green_wait * next;
+    struct green_wait_queue * queue;
+    green_coroutine_t coro;
+    green_future_t future;
+
+    // Message to send or message received.
+    void * p;
+    int i;
+
+    // Outcome, set when the wait is over.
+    int status;
+    int done;
+};
+
+// FIFO of blocked coroutines and futures.
+struct green_wait_queue {
+    struct green_wait * head;
+    struct green_wait * tail;
+};
+
+struct green_channel {
+
+    green_loop_t loop;
+    int refs;
+    int closed;
+
+    // Ring buffer of messages.
+    struct {
+        void * p;
+        int i;
+    } * messages;
+    size_t size;
+    size_t head;
+    size_t used;
+
+    // Blocked senders (only when full) and receivers (only when empty).
+    struct green_wait_queue senders;
+    struct green_wait_queue receivers;
+};
+
+struct green_taskgroup {
+
+    green_loop_t loop;
+    int refs;
+    int canceled;
+
+    // Tree of nested groups.  Children hold a reference to their parent.
+    green_taskgroup_t parent;
+    green_taskgroup_t children;
+    green_taskgroup_t prev;
+    green_taskgroup_t next;
+
+    // Running members (each holds a reference to the group).
+    green_coroutine_t members;
+    size_t size;
+
+    // Coroutines waiting in `green_taskgroup_join()`.
+    struct green_wait_queue joiners;
+
+    // Deadline, armed only while members are running.
+    int64_t deadline;
+    struct green_timer timer;
 };
 
 #define green_panic()                           \
@@ -111,19 +569,238 @@ struct green_poller {
     } while (0)
 #define green_assert(exp) _green_assert(exp, __FILE__, __LINE__)
 
-void * green_malloc(int size)
+#if GREEN_USE_TRACE
+#   define green_trace(loop, category, type, source, arg)                 \
+        do {                                                              \
+            if ((loop)->trace.categories & (category)) {                  \
+                green_trace_emit(loop, type, source, (uint64_t)(arg));    \
+            }                                                             \
+        } while (0)
+#else
+#   define green_trace(loop, category, type, source, arg) ((void)0)
+#endif
+
+// Memory held by all loops.  Shared between threads, so always updated with
+// atomic operations.
+static green_memory_stats_t green_memory;
+
+static void green_usage_update(green_memory_usage_t * usage,
+                               ptrdiff_t bytes, int objects, int atomic)
 {
-    // TODO: insert block header for tracking.
-    void * p = malloc(size);
-    green_assert(p != NULL);
+    if (atomic) {
+        size_t b = __atomic_add_fetch(&usage->bytes, (size_t)bytes,
+                                      __ATOMIC_RELAXED);
+        size_t peak = __atomic_load_n(&usage->peak, __ATOMIC_RELAXED);
+        while ((b > peak) &&
+               !__atomic_compare_exchange_n(&usage->peak, &peak, b, 1,
+                                            __ATOMIC_RELAXED,
+                                            __ATOMIC_RELAXED)) {
+        }
+        __atomic_add_fetch(&usage->objects, (size_t)objects,
+                           __ATOMIC_RELAXED);
+        if (objects > 0) {
+            __atomic_add_fetch(&usage->allocs, (size_t)objects,
+                               __ATOMIC_RELAXED);
+        }
+    }
+    else {
+        usage->bytes += (size_t)bytes;
+        if (usage->bytes > usage->peak) {
+            usage->peak = usage->bytes;
+        }
+        usage->objects += (size_t)objects;
+        if (objects > 0) {
+            usage->allocs += (size_t)objects;
+        }
+    }
+}
+
+// Record a change in bytes held and/or objects in use.
+static void green_account(green_loop_t loop, int category,
+                          ptrdiff_t bytes, int objects)
+{
+    green_assert((category >= 0) && (category < GREEN_MEMORY_CATEGORIES));
+    green_usage_update(&green_memory.total, bytes, objects, 1);
+    green_usage_update(&green_memory.categories[category],
+                       bytes, objects, 1);
+    if (loop) {
+        green_usage_update(&loop->memory.total, bytes, objects, 0);
+        green_usage_update(&loop->memory.categories[category],
+                           bytes, objects, 0);
+    }
+}
+
+// Block header, padded so that blocks keep the same alignment as memory
+// returned by `malloc()`.
+typedef union green_block {
+    struct {
+        green_loop_t loop;
+        size_t size;
+        int category;
+    } info;
+    long double align;
+    void * pad[4];
+} green_block_t;
+
+void * green_malloc(green_loop_t loop, int category, size_t size)
+{
+    green_block_t * block = malloc(sizeof(green_block_t) + size);
+    green_assert(block != NULL);
+    block->info.loop = loop;
+    block->info.size = size;
+    block->info.category = category;
+    green_account(loop, category, (ptrdiff_t)size, 0);
+    void * p = block + 1;
     memset(p, 0, size);
     return p;
 }
 
 void green_free(void * p)
 {
-    // TODO: account for block header.
-    free(p);
+    green_assert(p != NULL);
+    green_block_t * block = (green_block_t*)p - 1;
+    green_account(block->info.loop, block->info.category,
+                  -(ptrdiff_t)block->info.size, 0);
+    free(block);
+}
+
+void * green_realloc(void * p, size_t size)
+{
+    green_assert(p != NULL);
+    green_block_t * block = (green_block_t*)p - 1;
+    const size_t prev = block->info.size;
+    block = realloc(block, sizeof(green_block_t) + size);
+    green_assert(block != NULL);
+    block->info.size = size;
+    green_account(block->info.loop, block->info.category,
+                  (ptrdiff_t)size - (ptrdiff_t)prev, 0);
+    p = block + 1;
+    if (size > prev) {
+        memset((char*)p + prev, 0, size - prev);
+    }
+    return p;
+}
+
+int green_memory_stats(green_memory_stats_t * stats)
+{
+    if (stats == NULL) {
+        return GREEN_EINVAL;
+    }
+    const size_t n = sizeof(green_memory_stats_t) / sizeof(size_t);
+    const size_t * src = (const size_t*)&green_memory;
+    size_t * dst = (size_t*)stats;
+    for (size_t i = 0; i < n; ++i) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    return GREEN_SUCCESS;
+}
+
+// Slab header is padded so that objects keep the same alignment as memory
+// returned by `malloc()`.
+static const size_t GREEN_SLAB_HEADER = 2 * sizeof(void*);
+
+static void green_pool_init(struct green_pool * pool, green_loop_t loop,
+                            int category, size_t size)
+{
+    const size_t align = 2 * sizeof(void*);
+    pool->loop = loop;
+    pool->category = category;
+    pool->size = (size + align - 1) & ~(align - 1);
+    pool->free = NULL;
+    pool->slabs = NULL;
+}
+
+static void green_pool_term(struct green_pool * pool)
+{
+    while (pool->slabs) {
+        struct green_slab * slab = pool->slabs;
+        pool->slabs = slab->next;
+        green_free(slab);
+    }
+    pool->free = NULL;
+}
+
+static void * green_pool_alloc(struct green_pool * pool)
+{
+    if (pool->free == NULL) {
+        struct green_slab * slab = green_malloc(pool->loop, pool->category,
+                                                GREEN_SLAB_SIZE);
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        // Thread objects in address order so that consecutive allocations
+        // are adjacent.
+        char * base = (char*)slab + GREEN_SLAB_HEADER;
+        size_t count = (GREEN_SLAB_SIZE - GREEN_SLAB_HEADER) / pool->size;
+        green_assert(count > 0);
+        for (size_t i = count; (i > 0); --i) {
+            void ** object = (void**)(base + (i-1) * pool->size);
+            *object = pool->free;
+            pool->free = object;
+        }
+    }
+    void ** object = pool->free;
+    pool->free = *object;
+    memset(object, 0, pool->size);
+    return object;
+}
+
+static void green_pool_free(struct green_pool * pool, void * object)
+{
+    green_assert(object != NULL);
+    *(void**)object = pool->free;
+    pool->free = object;
+}
+
+static size_t green_page_size()
+{
+    static size_t page_size = 0;
+    if (page_size == 0) {
+        long rc = sysconf(_SC_PAGESIZE);
+        page_size = (rc > 0)? (size_t)rc : 4096;
+    }
+    return page_size;
+}
+
+// Round up to a whole number of pages.
+static size_t green_stack_round(size_t size)
+{
+    const size_t page_size = green_page_size();
+    return (size + page_size - 1) & ~(page_size - 1);
+}
+
+// NOTE: the stack is mapped but never touched, so the kernel only commits the
+//       pages the coroutine actually uses.  The lowest page is left
+//       inaccessible so that a stack overflow faults instead of silently
+//       corrupting whatever is mapped below the stack.
+static void * green_stack_alloc(green_loop_t loop, size_t size)
+{
+    const size_t page_size = green_page_size();
+    green_assert(size == green_stack_round(size));
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#ifdef MAP_STACK
+    flags |= MAP_STACK;
+#endif
+    char * base = mmap(NULL, size + page_size,
+                       PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+    if (mprotect(base, page_size, PROT_NONE) != 0) {
+        munmap(base, size + page_size);
+        return NULL;
+    }
+    green_account(loop, GREEN_MEMORY_STACKS, (ptrdiff_t)(size + page_size), 0);
+    return base + page_size;
+}
+
+static void green_stack_free(green_loop_t loop, void * stack, size_t size)
+{
+    const size_t page_size = green_page_size();
+    green_assert(stack != NULL);
+    int rc = munmap((char*)stack - page_size, size + page_size);
+    green_assert(rc == 0);
+    green_account(loop, GREEN_MEMORY_STACKS,
+                  -(ptrdiff_t)(size + page_size), 0);
 }
 
 int green_version()
@@ -147,18 +824,98 @@ int _green_init(int major, int minor)
     return GREEN_SUCCESS;
 }
 
+static void green_offload_stop();
+static void green_watchdog_stop();
+static void green_watchdog_remove(green_loop_t loop);
+static void green_dump_check(green_loop_t loop);
+static void green_cls_clear(green_coroutine_t coro);
+static void green_cls_free(green_coroutine_t coro);
+static void green_taskgroup_leave(green_coroutine_t coro);
+static void green_taskgroup_expire(green_taskgroup_t group);
+
 int green_term()
 {
+    green_offload_stop();
+    green_watchdog_stop();
     return GREEN_SUCCESS;
 }
 
+// Pick the cache bucket for a stack size, rounding the size up to fit.
+static int green_cache_bucket(size_t * stack_size)
+{
+    const size_t page_size = green_page_size();
+    for (int i = 0; i < GREEN_CACHE_BUCKETS; ++i) {
+        if (*stack_size <= (page_size << i)) {
+            *stack_size = page_size << i;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void green_coroutine_destroy(green_coroutine_t coro)
+{
+    green_loop_t loop = coro->loop;
+    if (coro->shared) {
+        if (loop->shared.owner == coro) {
+            loop->shared.owner = NULL;
+        }
+        if (coro->saved) {
+            green_free(coro->saved);
+        }
+        --loop->shared.coroutines;
+        green_pool_free(&loop->coroutine_pool, coro);
+        return;
+    }
+    green_assert(coro->stack != NULL);
+    green_stack_free(loop, coro->stack, coro->stack_size);
+    coro->stack = NULL;
+    green_pool_free(&loop->coroutine_pool, coro);
+}
+
+// Release cached coroutines (largest stacks first) until `size` are left.
+static void green_loop_trim_cache(green_loop_t loop, size_t size)
+{
+    for (int i = GREEN_CACHE_BUCKETS-1; (i >= 0); --i) {
+        while ((loop->cache.size > size) && loop->cache.buckets[i]) {
+            green_coroutine_t coro = loop->cache.buckets[i];
+            loop->cache.buckets[i] = coro->next;
+            --loop->cache.size;
+            green_coroutine_destroy(coro);
+        }
+    }
+}
+
 green_loop_t green_loop_init()
 {
-    green_loop_t loop = green_malloc(sizeof(struct green_loop));
+    // NOTE: the loop itself is only accounted for globally.
+    green_loop_t loop = green_malloc(NULL, GREEN_MEMORY_OTHER,
+                                     sizeof(struct green_loop));
     loop->refs = 1;
     loop->coroutines = 0;
     loop->nextcoroid = 1;
     loop->currentcoro = NULL;
+    loop->cache.size = 0;
+    loop->cache.low = DEFAULT_CACHE_LOW;
+    loop->cache.high = DEFAULT_CACHE_HIGH;
+    loop->shared.size = DEFAULT_SHARED_STACK_SIZE;
+    loop->reactor.fd = -1;
+    loop->wake.fd = -1;
+#if GREEN_USE_IO_URING
+    loop->uring.fd = -1;
+#endif
+    green_pool_init(&loop->coroutine_pool, loop, GREEN_MEMORY_COROUTINES,
+                    sizeof(struct green_coroutine));
+    green_pool_init(&loop->future_pool, loop, GREEN_MEMORY_FUTURES,
+                    sizeof(struct green_future));
+    green_pool_init(&loop->poller_pool, loop, GREEN_MEMORY_POLLERS,
+                    sizeof(struct green_poller));
+    green_pool_init(&loop->timer_pool, loop, GREEN_MEMORY_TIMERS,
+                    sizeof(struct green_timer));
+    green_pool_init(&loop->wait_pool, loop, GREEN_MEMORY_OTHER,
+                    sizeof(struct green_wait));
+    loop->clock = green_now();
+    loop->timers.now = loop->clock / GREEN_TICK;
 
     return loop;
 }
@@ -170,6 +927,8 @@ int green_loop_acquire(green_loop_t loop)
     return GREEN_SUCCESS;
 }
 
+static void green_ready_unlink(green_loop_t loop, green_coroutine_t coro);
+
 int green_loop_release(green_loop_t loop)
 {
     green_assert(loop != NULL);
@@ -181,35 +940,616 @@ int green_loop_release(green_loop_t loop)
 
     green_assert(loop != NULL);
 
+    // Coroutines that never started may only be left in the ready queue.
+    green_coroutine_t next = NULL;
+    for (green_coroutine_t coro = loop->ready.head; coro; coro = next) {
+        next = coro->next;
+        if ((coro->state == pending) && (coro->refs == 1)) {
+            green_ready_unlink(loop, coro);
+            green_coroutine_release(coro);
+        }
+    }
     green_assert(loop->coroutines == 0);
+    if (loop->watchdog.enabled) {
+        green_watchdog_remove(loop);
+    }
+    green_loop_trim_cache(loop, 0);
+    green_assert(loop->cache.size == 0);
+    green_pool_term(&loop->coroutine_pool);
+    green_pool_term(&loop->future_pool);
+    green_pool_term(&loop->poller_pool);
+    green_pool_term(&loop->timer_pool);
+    green_pool_term(&loop->wait_pool);
+    // NOTE: timer futures keep the loop alive and sleeping coroutines can't
+    //       be released, so the wheel is empty at this point.
+    green_assert(loop->timers.size == 0);
+    // NOTE: pending I/O futures keep the loop alive, so there is nothing
+    //       left waiting on the reactor at this point.
+    green_assert(loop->reactor.waiting == 0);
+#if GREEN_USE_IO_URING
+    if (loop->uring.fd >= 0) {
+        munmap(loop->uring.sqes, loop->uring.sqes_size);
+        if (loop->uring.cq_ring != loop->uring.sq_ring) {
+            munmap(loop->uring.cq_ring, loop->uring.cq_ring_size);
+        }
+        munmap(loop->uring.sq_ring, loop->uring.sq_ring_size);
+        close(loop->uring.fd);
+    }
+#endif
+    if (loop->wake.fd >= 0) {
+        close(loop->wake.fd);
+    }
+#if GREEN_USE_TRACE
+    if (loop->trace.events) {
+        green_free(loop->trace.events);
+    }
+#endif
+    if (loop->reactor.fd >= 0) {
+        close(loop->reactor.fd);
+    }
+    if (loop->reactor.fds) {
+        green_free(loop->reactor.fds);
+    }
+    if (loop->stacks.sites) {
+        green_free(loop->stacks.sites);
+    }
+    if (loop->shared.stack) {
+        green_stack_free(loop, loop->shared.stack, loop->shared.size);
+    }
     green_free(loop);
 
     return GREEN_SUCCESS;
 }
 
-static void _coroutine(green_coroutine_t coro)
+int green_loop_memory_stats(green_loop_t loop, green_memory_stats_t * stats)
 {
-    green_assert(coro != NULL);
-    green_assert(coro->loop != NULL);
-    green_assert(coro->loop->currentcoro == coro);
-
-    // Bump refs count to prevent teardown while coroutine is running.
-    ++coro->loop->refs;
-    ++coro->refs;
+    if ((loop == NULL) || (stats == NULL)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    *stats = loop->memory;
+    return GREEN_SUCCESS;
+}
 
-    coro->state = running;
-    coro->result = (*coro->method)(coro->loop, coro->object);
-    green_assert(coro->loop->currentcoro == coro);
-    green_assert(coro->state == running);
+int green_loop_stats(green_loop_t loop, green_loop_stats_t * stats)
+{
+    if ((loop == NULL) || (stats == NULL)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    *stats = loop->stats;
+    stats->live = stats->spawned + stats->migrated_in -
+                  stats->migrated_out - stats->finished;
+    return GREEN_SUCCESS;
+}
 
-    coro->state = stopped;
-    coro->loop->currentcoro = NULL;
+// Histogram bucket for a duration: bucket 0 is under one microsecond, and
+// bucket `b` is from 2^(b-1) up to 2^b microseconds.  The last bucket also
+// holds everything longer.
+static int green_stats_bucket(int64_t duration)
+{
+    const uint64_t us = (duration > 0)? (uint64_t)duration / 1000 : 0;
+    const int bucket = (us > 0)? 64 - __builtin_clzll(us) : 0;
+    return (bucket < GREEN_STATS_BUCKETS)? bucket : GREEN_STATS_BUCKETS - 1;
+}
+
+int green_loop_set_cache_limits(green_loop_t loop, size_t low, size_t high)
+{
+    if ((loop == NULL) || (low > high)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    loop->cache.low = low;
+    loop->cache.high = high;
+    if (loop->cache.size > high) {
+        green_loop_trim_cache(loop, low);
+    }
+    return GREEN_SUCCESS;
+}
+
+int green_loop_trim(green_loop_t loop)
+{
+    if (loop == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    green_loop_trim_cache(loop, loop->cache.low);
+    return GREEN_SUCCESS;
+}
+
+size_t green_loop_cache_size(green_loop_t loop)
+{
+    if (loop == NULL) {
+        return 0;
+    }
+    green_assert(loop->refs > 0);
+    return loop->cache.size;
+}
+
+int green_loop_set_shared_stack(green_loop_t loop, size_t size)
+{
+    if ((loop == NULL) || (size == 0)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    if (loop->shared.coroutines > 0) {
+        return GREEN_EBUSY;
+    }
+    if (loop->shared.stack) {
+        green_stack_free(loop, loop->shared.stack, loop->shared.size);
+        loop->shared.stack = NULL;
+    }
+    loop->shared.size = green_stack_round(size);
+    return GREEN_SUCCESS;
+}
+
+// Stack size that fits `used` bytes with some room to spare: half again as
+// much, and at least one page.
+static size_t green_stack_margin(size_t used)
+{
+    const size_t page_size = green_page_size();
+    return used + ((used / 2 > page_size)? used / 2 : page_size);
+}
+
+// Find the entry for `source`, or the empty slot where it belongs.
+static struct green_stack_stats * green_stack_find(green_loop_t loop,
+                                                   const char * source)
+{
+    const size_t mask = loop->stacks.size - 1;
+    size_t i = (((uintptr_t)source >> 3) * (size_t)2654435761u) & mask;
+    while (loop->stacks.sites[i].source &&
+           (loop->stacks.sites[i].source != source)) {
+        i = (i + 1) & mask;
+    }
+    return &loop->stacks.sites[i];
+}
+
+static void green_stack_record(green_loop_t loop, const char * source,
+                               size_t used)
+{
+    // Keep the table at most half full.
+    if (2 * (loop->stacks.used + 1) > loop->stacks.size) {
+        struct green_stack_stats * sites = loop->stacks.sites;
+        const size_t size = loop->stacks.size;
+        loop->stacks.size = size? 2 * size : 16;
+        loop->stacks.sites = green_malloc(
+            loop, GREEN_MEMORY_OTHER,
+            loop->stacks.size * sizeof(struct green_stack_stats));
+        for (size_t i = 0; i < size; ++i) {
+            if (sites[i].source) {
+                *green_stack_find(loop, sites[i].source) = sites[i];
+            }
+        }
+        if (sites) {
+            green_free(sites);
+        }
+    }
+
+    struct green_stack_stats * site = green_stack_find(loop, source);
+    if (site->source == NULL) {
+        site->source = source;
+        ++loop->stacks.used;
+    }
+    ++site->count;
+    if (used > site->max) {
+        site->max = used;
+    }
+    size_t size = green_stack_margin(used);
+    const int bucket = green_cache_bucket(&size);
+    ++site->buckets[(bucket < 0)? GREEN_CACHE_BUCKETS : bucket];
+}
+
+// Smallest stack size that fits 99% of the samples for `source`, or zero
+// if there are not enough samples yet.
+static size_t green_stack_learned(green_loop_t loop, const char * source)
+{
+    if (loop->stacks.used == 0) {
+        return 0;
+    }
+    const struct green_stack_stats * site = green_stack_find(loop, source);
+    if ((site->source == NULL) || (site->count < GREEN_STACK_SAMPLES)) {
+        return 0;
+    }
+    size_t seen = 0;
+    for (int i = 0; i < GREEN_CACHE_BUCKETS; ++i) {
+        seen += site->buckets[i];
+        if (100 * seen >= 99 * site->count) {
+            return green_page_size() << i;
+        }
+    }
+    return green_stack_round(green_stack_margin(site->max));
+}
+
+// NOTE: painting touches the whole stack the first time, so profiled
+//       coroutines commit their whole stack.  Recycled stacks only need the
+//       part used by their last run to be painted again.
+static void green_stack_paint(green_coroutine_t coro)
+{
+    uintptr_t * top = (uintptr_t*)((char*)coro->stack + coro->stack_size);
+    uintptr_t * p = top - coro->stack_dirty / sizeof(uintptr_t);
+    while (p < top) {
+        *p++ = GREEN_STACK_PATTERN;
+    }
+    coro->stack_dirty = 0;
+}
+
+static size_t green_stack_measure(green_coroutine_t coro)
+{
+    const uintptr_t * p = coro->stack;
+    const uintptr_t * top =
+        (const uintptr_t*)((char*)coro->stack + coro->stack_size);
+    while ((p < top) && (*p == GREEN_STACK_PATTERN)) {
+        ++p;
+    }
+    return (size_t)((const char*)top - (const char*)p);
+}
+
+int green_loop_stack_profile(green_loop_t loop, int flags)
+{
+    if ((loop == NULL) ||
+        ((flags & ~(GREEN_STACK_MEASURE | GREEN_STACK_ADAPT)) != 0)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    loop->stacks.flags = flags;
+    return GREEN_SUCCESS;
+}
+
+size_t green_loop_stack_sites(green_loop_t loop,
+                              green_stack_site_t * sites, size_t size)
+{
+    if (loop == NULL) {
+        return 0;
+    }
+    green_assert(loop->refs > 0);
+    size_t count = 0;
+    for (size_t i = 0; i < loop->stacks.size; ++i) {
+        const struct green_stack_stats * site = &loop->stacks.sites[i];
+        if (site->source == NULL) {
+            continue;
+        }
+        if ((sites != NULL) && (count < size)) {
+            sites[count].source = site->source;
+            sites[count].count = site->count;
+            sites[count].max = site->max;
+            sites[count].size = green_stack_learned(loop, site->source);
+        }
+        ++count;
+    }
+    return count;
+}
+
+#if GREEN_USE_TRACE
+static void green_trace_emit(green_loop_t loop, int type,
+                             const char * source, uint64_t arg)
+{
+    const uint64_t head = loop->trace.head;
+    green_trace_event_t * event =
+        &loop->trace.events[head & (loop->trace.size - 1)];
+    event->time = green_now();
+    event->source = (uint64_t)(uintptr_t)source;
+    event->arg = arg;
+    event->coro = loop->currentcoro? (uint32_t)loop->currentcoro->id : 0;
+    event->type = (uint32_t)type;
+    __atomic_store_n(&loop->trace.head, head + 1, __ATOMIC_RELEASE);
+}
+#endif
+
+int green_loop_trace(green_loop_t loop, int categories, size_t size)
+{
+    if ((loop == NULL) || (categories & ~GREEN_TRACE_ALL)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+#if GREEN_USE_TRACE
+    if (categories == 0) {
+        loop->trace.categories = 0;
+        return GREEN_SUCCESS;
+    }
+    // Ring size is a power of two, so that indices wrap with a mask.
+    size_t ring = 64;
+    while (ring < size) {
+        ring <<= 1;
+    }
+    if (ring != loop->trace.size) {
+        if (loop->trace.events) {
+            green_free(loop->trace.events);
+        }
+        loop->trace.events = green_malloc(loop, GREEN_MEMORY_OTHER,
+                                          ring * sizeof(green_trace_event_t));
+        loop->trace.size = ring;
+    }
+    loop->trace.head = 0;
+    loop->trace.categories = categories;
+    return GREEN_SUCCESS;
+#else
+    return GREEN_EINVAL;
+#endif
+}
+
+size_t green_loop_trace_read(green_loop_t loop,
+                             green_trace_event_t * events, size_t size)
+{
+    if ((loop == NULL) || (events == NULL)) {
+        return 0;
+    }
+#if GREEN_USE_TRACE
+    if (loop->trace.events == NULL) {
+        return 0;
+    }
+    // Copy the most recent events, then drop those that the loop overwrote
+    // in the meantime.
+    const uint64_t head = __atomic_load_n(&loop->trace.head, __ATOMIC_ACQUIRE);
+    uint64_t n = (head < loop->trace.size)? head : loop->trace.size;
+    if (n > size) {
+        n = size;
+    }
+    uint64_t first = head - n;
+    for (uint64_t i = 0; i < n; ++i) {
+        events[i] = loop->trace.events[(first + i) & (loop->trace.size - 1)];
+    }
+    const uint64_t tail = __atomic_load_n(&loop->trace.head, __ATOMIC_ACQUIRE);
+    if (tail > first + loop->trace.size) {
+        const uint64_t lost = tail - (first + loop->trace.size);
+        if (lost >= n) {
+            return 0;
+        }
+        memmove(events, events + lost, (n - lost)*sizeof(*events));
+        n -= lost;
+    }
+    return (size_t)n;
+#else
+    return 0;
+#endif
+}
+
+#if GREEN_USE_TRACE
+static int green_write_all(int fd, const void * data, size_t size)
+{
+    const char * p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        p += n, size -= (size_t)n;
+    }
+    return 1;
+}
+#endif
+
+int green_loop_trace_dump(green_loop_t loop, int fd)
+{
+    if ((loop == NULL) || (fd < 0)) {
+        return GREEN_EINVAL;
+    }
+#if GREEN_USE_TRACE
+    const size_t size = loop->trace.size;
+    green_trace_event_t * events = green_malloc(
+        NULL, GREEN_MEMORY_OTHER, (size + 1) * sizeof(green_trace_event_t));
+    const size_t n = green_loop_trace_read(loop, events, size);
+
+    // Source locations are string literals, so collect each one once.
+    uint64_t * strings = green_malloc(NULL, GREEN_MEMORY_OTHER,
+                                      (n + 1) * sizeof(uint64_t));
+    size_t count = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t j = 0;
+        while ((j < count) && (strings[j] != events[i].source)) {
+            ++j;
+        }
+        if ((j == count) && (events[i].source != 0)) {
+            strings[count++] = events[i].source;
+        }
+    }
+
+    green_trace_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GREEN_TRACE_MAGIC, sizeof(header.magic));
+    header.format = GREEN_TRACE_FORMAT;
+    header.events = (uint32_t)n;
+    header.strings = (uint32_t)count;
+    int ok = green_write_all(fd, &header, sizeof(header)) &&
+             green_write_all(fd, events, n * sizeof(green_trace_event_t));
+    for (size_t i = 0; ok && (i < count); ++i) {
+        const char * string = (const char*)(uintptr_t)strings[i];
+        const uint32_t length[2] = {(uint32_t)strlen(string), 0};
+        ok = green_write_all(fd, &strings[i], sizeof(strings[i])) &&
+             green_write_all(fd, length, sizeof(length)) &&
+             green_write_all(fd, string, length[0]);
+    }
+    green_free(strings);
+    green_free(events);
+    return ok? GREEN_SUCCESS : GREEN_EBADFD;
+#else
+    return GREEN_EINVAL;
+#endif
+}
+
+static void green_ready_push(green_loop_t loop, green_coroutine_t coro)
+{
+    green_assert(coro->loop == loop);
+    green_assert(!coro->ready);
+    ++coro->refs;
+    coro->ready = 1;
+    coro->prev = loop->ready.tail;
+    coro->next = NULL;
+    if (loop->ready.tail) {
+        loop->ready.tail->next = coro;
+    }
+    else {
+        loop->ready.head = coro;
+    }
+    loop->ready.tail = coro;
+    ++loop->ready.size;
+}
+
+// NOTE: the caller inherits the queue's reference to the coroutine.
+static void green_ready_unlink(green_loop_t loop, green_coroutine_t coro)
+{
+    green_assert(coro->ready);
+    if (coro->prev) {
+        coro->prev->next = coro->next;
+    }
+    else {
+        loop->ready.head = coro->next;
+    }
+    if (coro->next) {
+        coro->next->prev = coro->prev;
+    }
+    else {
+        loop->ready.tail = coro->prev;
+    }
+    coro->prev = NULL;
+    coro->next = NULL;
+    coro->ready = 0;
+    --loop->ready.size;
+}
+
+static void green_registry_link(green_loop_t loop, green_coroutine_t coro)
+{
+    coro->registry_prev = loop->registry.tail;
+    coro->registry_next = NULL;
+    if (loop->registry.tail) {
+        loop->registry.tail->registry_next = coro;
+    }
+    else {
+        loop->registry.head = coro;
+    }
+    loop->registry.tail = coro;
+}
+
+static void green_registry_unlink(green_loop_t loop, green_coroutine_t coro)
+{
+    if (coro->registry_prev) {
+        coro->registry_prev->registry_next = coro->registry_next;
+    }
+    else {
+        loop->registry.head = coro->registry_next;
+    }
+    if (coro->registry_next) {
+        coro->registry_next->registry_prev = coro->registry_prev;
+    }
+    else {
+        loop->registry.tail = coro->registry_prev;
+    }
+    coro->registry_prev = NULL;
+    coro->registry_next = NULL;
+}
+
+// Check whether the coroutine's task group (if any) is canceled.
+static int green_coroutine_canceled(green_coroutine_t coro)
+{
+    return coro && coro->group && coro->group->canceled;
+}
+
+static void _coroutine(green_coroutine_t coro)
+{
+    green_assert(coro != NULL);
+    green_assert(coro->loop != NULL);
+    green_assert(coro->loop->currentcoro == coro);
+
+    // Bump refs count to prevent teardown while coroutine is running.
+    ++coro->loop->refs;
+    ++coro->refs;
+
+    coro->state = running;
+    coro->result = (*coro->method)(coro->loop, coro->object);
+    green_assert(coro->loop->currentcoro == coro);
+    green_assert(coro->state == running);
+    green_cls_clear(coro);
+    if (coro->group) {
+        green_taskgroup_leave(coro);
+    }
+    if (coro->stack_painted) {
+        coro->stack_dirty = green_stack_measure(coro);
+        green_stack_record(coro->loop, coro->origin, coro->stack_dirty);
+    }
+
+    coro->state = stopped;
+    ++coro->loop->stats.finished;
+    green_trace(coro->loop, GREEN_TRACE_SCHEDULER, GREEN_TRACE_STOP,
+                coro->source, coro->result);
+    coro->loop->currentcoro = NULL;
 
     // Coroutine is done, release artificial ref counts.
     //
     // TODO: handle case where this is last ref to coroutine!
     --coro->refs;
     --coro->loop->refs;
+
+    // Switch back to the loop for good.  NOTE: `uc_link` is not used since
+    // it points to the loop the coroutine started on, which is not where it
+    // finishes if a loop group moved it.
+#if GREEN_USE_UCONTEXT
+    swapcontext(&coro->context, &coro->loop->context);
+#endif
+#if GREEN_USE_ASMCONTEXT
+    green_context_swap(&coro->context, coro->loop->context);
+#endif
+}
+
+// Get a coroutine with a stack of its own, recycled when possible.
+static green_coroutine_t green_coroutine_alloc(green_loop_t loop,
+                                               size_t stack_size,
+                                               const char * source)
+{
+    if ((stack_size == 0) && (loop->stacks.flags & GREEN_STACK_ADAPT)) {
+        stack_size = green_stack_learned(loop, source);
+    }
+    if (stack_size == 0) {
+        stack_size = DEFAULT_STACK_SIZE;
+    }
+    stack_size = green_stack_round(stack_size);
+    int bucket = green_cache_bucket(&stack_size);
+
+    // Recycle a released coroutine (and its stack) when possible.
+    green_coroutine_t coro = NULL;
+    if ((bucket >= 0) && (loop->cache.buckets[bucket] != NULL)) {
+        coro = loop->cache.buckets[bucket];
+        loop->cache.buckets[bucket] = coro->next;
+        --loop->cache.size;
+        green_assert(coro->stack_size == stack_size);
+    }
+    else {
+        void * stack = green_stack_alloc(loop, stack_size);
+        if (stack == NULL) {
+            return NULL;
+        }
+        coro = green_pool_alloc(&loop->coroutine_pool);
+        coro->stack = stack;
+        coro->stack_size = stack_size;
+        coro->bucket = bucket;
+        coro->stack_dirty = stack_size;
+    }
+    coro->stack_painted = (loop->stacks.flags != 0);
+    if (coro->stack_painted) {
+        green_stack_paint(coro);
+    }
+    else {
+        coro->stack_dirty = coro->stack_size;
+    }
+    return coro;
+}
+
+// Get a coroutine that runs on the loop's shared stack.  These are not
+// cached: without a stack, they are cheap to make.
+static green_coroutine_t green_shared_alloc(green_loop_t loop)
+{
+    if (loop->shared.stack == NULL) {
+        loop->shared.stack = green_stack_alloc(loop, loop->shared.size);
+        if (loop->shared.stack == NULL) {
+            return NULL;
+        }
+    }
+    green_coroutine_t coro = green_pool_alloc(&loop->coroutine_pool);
+    coro->shared = 1;
+    coro->bucket = -1;
+    ++loop->shared.coroutines;
+    return coro;
 }
 
 green_coroutine_t _green_coroutine_init(green_loop_t loop,
@@ -221,11 +1561,34 @@ green_coroutine_t _green_coroutine_init(green_loop_t loop,
     green_assert(method != NULL);
     green_assert(source != NULL);
 
-    if (stack_size == 0) {
-        stack_size = DEFAULT_STACK_SIZE;
+    // NOTE: the shared stack needs the context switch to give us the stack
+    //       pointer of blocked coroutines, so ucontext builds give these
+    //       coroutines a stack of their own (as large as the shared stack).
+    green_coroutine_t coro = NULL;
+    if ((stack_size == GREEN_STACK_SHARED) && GREEN_USE_ASMCONTEXT) {
+        coro = green_shared_alloc(loop);
     }
-
-    green_coroutine_t coro = green_malloc(sizeof(struct green_coroutine));
+    else {
+        if (stack_size == GREEN_STACK_SHARED) {
+            stack_size = loop->shared.size;
+        }
+        coro = green_coroutine_alloc(loop, stack_size, source);
+    }
+    if (coro == NULL) {
+        return NULL;
+    }
+    coro->prev = NULL;
+    coro->next = NULL;
+    coro->ready = 0;
+    coro->timer.slot = -1;
+    coro->group = NULL;
+    coro->blocked_poller = NULL;
+    coro->blocked_wait = NULL;
+    // NOTE: cached coroutines freed their values when they were released.
+    green_assert(coro->cls.overflow == NULL);
+    memset(&coro->cls, 0, sizeof(coro->cls));
+    green_account(loop, GREEN_MEMORY_COROUTINES, 0, 1);
+    green_account(loop, GREEN_MEMORY_STACKS, 0, 1);
 
     coro->refs = 1;
     coro->loop = loop;
@@ -235,6 +1598,9 @@ green_coroutine_t _green_coroutine_init(green_loop_t loop,
     coro->state = pending;
     coro->result = -1;
     coro->source = source;
+    coro->origin = source;
+    coro->switched = green_now();
+    green_registry_link(loop, coro);
 
 #if GREEN_USE_UCONTEXT
     // NOTE: man pages says to check getcontext for -1 and check errno, but no
@@ -243,430 +1609,4259 @@ green_coroutine_t _green_coroutine_init(green_loop_t loop,
     //       it and deal with it if we ever hit the assertion in practice.
     int rc = getcontext(&coro->context);
     green_assert(rc == 0);
-    coro->stack = green_malloc(stack_size);
     coro->context.uc_stack.ss_sp = coro->stack;
-    coro->context.uc_stack.ss_size = stack_size;
+    coro->context.uc_stack.ss_size = coro->stack_size;
     coro->context.uc_link = &loop->context;
     makecontext(&coro->context, (void(*)())_coroutine, 1, coro);
 #endif
+#if GREEN_USE_ASMCONTEXT
+    // NOTE: coroutines on the shared stack get their first frame when they
+    //       first run, see `green_shared_enter()`.
+    if (!coro->shared) {
+        coro->context = green_context_make(coro->stack, coro->stack_size,
+                                           (void(*)(void*))_coroutine, coro);
+    }
+#endif
 
     loop->coroutines++;
+    ++loop->stats.spawned;
+    green_trace(loop, GREEN_TRACE_SCHEDULER, GREEN_TRACE_SPAWN,
+                source, coro->id);
+
+    // Start as soon as the loop gets to it.
+    green_ready_push(loop, coro);
 
     return coro;
 }
 
-int _green_yield(green_loop_t loop, green_coroutine_t coro, const char * source)
+#if GREEN_USE_ASMCONTEXT
+// Copy the frames of a blocked coroutine off the shared stack.  The buffer
+// is kept unless it gets much too large, so that coroutines that block at
+// about the same depth each time don't reallocate it.
+static void green_shared_save(green_loop_t loop, green_coroutine_t coro)
 {
-    green_assert(loop != NULL);
-    if (loop->currentcoro) {
-        green_assert(loop->currentcoro->state == running);
+    const char * top = (char*)loop->shared.stack + loop->shared.size;
+    const size_t size = (size_t)(top - (char*)coro->context);
+    if (coro->saved == NULL) {
+        coro->saved = green_malloc(loop, GREEN_MEMORY_STACKS, size);
+        coro->saved_capacity = size;
     }
-    if (coro) {
-        green_assert((coro->state == blocked) || (coro->state == pending));
+    else if ((size > coro->saved_capacity) ||
+             (size < coro->saved_capacity / 2)) {
+        coro->saved = green_realloc(coro->saved, size);
+        coro->saved_capacity = size;
     }
+    ASAN_UNPOISON_MEMORY_REGION(coro->context, size);
+    memcpy(coro->saved, coro->context, size);
+    coro->saved_size = size;
+}
 
-    if (coro) {
-        fprintf(stderr, "Yielding to coroutine %d.\n", coro->id);
-        green_assert(loop->currentcoro == NULL);
-        loop->currentcoro = coro;
-        loop->currentcoro->state = running;
-#if GREEN_USE_UCONTEXT
-        swapcontext(&loop->context, &coro->context);
-#endif
-        green_assert(loop->currentcoro == NULL);
-        if (coro->state != stopped) {
-            coro->state = blocked;
-        }
+// Put the frames of `coro` back on the shared stack.  The frames of the
+// coroutine that ran there last are only saved now, so a coroutine that
+// blocks and resumes with no other coroutine in between copies nothing.
+static void green_shared_enter(green_loop_t loop, green_coroutine_t coro)
+{
+    green_coroutine_t owner = loop->shared.owner;
+    if (owner == coro) {
+        return;
+    }
+    if (owner && (owner->state != stopped)) {
+        green_shared_save(loop, owner);
+    }
+    loop->shared.owner = coro;
+    if (coro->context == NULL) {
+        coro->context = green_context_make(loop->shared.stack,
+                                           loop->shared.size,
+                                           (void(*)(void*))_coroutine, coro);
     }
     else {
-        fprintf(stderr, "Yielding to event loop.\n");
-        green_assert(loop->currentcoro != NULL);
-        loop->currentcoro->state = blocked;
-        coro = loop->currentcoro;
-        loop->currentcoro = NULL;
-#if GREEN_USE_UCONTEXT
-        swapcontext(&coro->context, &loop->context);
-#endif
-        green_assert(loop->currentcoro != NULL);
-        loop->currentcoro->state = running;
+        ASAN_UNPOISON_MEMORY_REGION(coro->context, coro->saved_size);
+        memcpy(coro->context, coro->saved, coro->saved_size);
     }
-
-    return GREEN_SUCCESS;
 }
+#endif
 
-int green_coroutine_result(green_coroutine_t coro)
+// Switch from the loop to `coro`, until it yields back.
+static void green_resume(green_loop_t loop, green_coroutine_t coro)
 {
-    green_assert(coro != NULL);
-    green_assert(coro->state == stopped);
-    return coro->result;
+    green_assert((coro->state == blocked) || (coro->state == pending));
+    green_assert(loop->currentcoro == NULL);
+    loop->currentcoro = coro;
+    loop->currentcoro->state = running;
+    coro->switched = loop->clock;
+    ++loop->stats.switches;
+    green_trace(loop, GREEN_TRACE_SCHEDULER, GREEN_TRACE_RESUME,
+                coro->source, 0);
+    if (loop->watchdog.enabled) {
+        __atomic_store_n(&loop->watchdog.id, coro->id, __ATOMIC_RELAXED);
+        __atomic_store_n(&loop->watchdog.source, coro->source,
+                         __ATOMIC_RELAXED);
+        // NOTE: loops in a group may run on any worker thread.
+        const pthread_t self = pthread_self();
+        __atomic_store(&loop->watchdog.thread, &self, __ATOMIC_RELAXED);
+        __atomic_store_n(&loop->watchdog.since, green_now(),
+                         __ATOMIC_RELEASE);
+    }
+#if GREEN_USE_UCONTEXT
+    swapcontext(&loop->context, &coro->context);
+#endif
+#if GREEN_USE_ASMCONTEXT
+    if (coro->shared) {
+        green_shared_enter(loop, coro);
+    }
+    green_context_swap(&loop->context, coro->context);
+#endif
+    if (loop->watchdog.enabled) {
+        __atomic_store_n(&loop->watchdog.since, 0, __ATOMIC_RELEASE);
+    }
+    green_assert(loop->currentcoro == NULL);
+    coro->switched = loop->clock;
+    if (coro->state != stopped) {
+        coro->state = blocked;
+    }
 }
 
-int green_coroutine_acquire(green_coroutine_t coro)
+// Switch from the current coroutine to the loop, until the loop resumes it.
+static void green_suspend(green_loop_t loop, const char * source)
 {
-    green_assert(coro != NULL);
+    green_assert(loop->currentcoro != NULL);
+    green_coroutine_t coro = loop->currentcoro;
+    coro->source = source;
+    green_trace(loop, GREEN_TRACE_SCHEDULER, GREEN_TRACE_SUSPEND, source, 0);
+    coro->state = blocked;
+    loop->currentcoro = NULL;
+#if GREEN_USE_UCONTEXT
+    swapcontext(&coro->context, &loop->context);
+#endif
+#if GREEN_USE_ASMCONTEXT
+    green_context_swap(&coro->context, loop->context);
+#endif
+    // NOTE: a loop group may have moved the coroutine to another loop.
+    green_assert(coro->loop->currentcoro == coro);
+    coro->state = running;
+}
+
+int _green_yield(green_loop_t loop, green_coroutine_t coro, const char * source)
+{
+    green_assert(loop != NULL);
+    if (loop->currentcoro) {
+        green_assert(loop->currentcoro->state == running);
+    }
+
+    if (coro) {
+        // Explicit resume bypasses the ready queue (and the batch clock).
+        loop->clock = green_now();
+        int queued = coro->ready;
+        if (queued) {
+            green_ready_unlink(loop, coro);
+        }
+        green_resume(loop, coro);
+        if (queued) {
+            green_coroutine_release(coro);
+        }
+    }
+    else {
+        // Let other ready coroutines run before resuming this one.
+        green_assert(loop->currentcoro != NULL);
+        green_ready_push(loop, loop->currentcoro);
+        green_suspend(loop, source);
+    }
+
+    return GREEN_SUCCESS;
+}
+
+int64_t green_now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((int64_t)now.tv_sec * 1000000000) + now.tv_nsec;
+}
+
+static void green_timer_arm(green_loop_t loop, struct green_timer * timer,
+                            int64_t expiry)
+{
+    // Expired timers fire on the next tick.
+    if (expiry < loop->timers.now) {
+        expiry = loop->timers.now;
+    }
+    timer->expiry = expiry;
+
+    // Pick the level where the expiry first differs from the current tick.
+    uint64_t diff = (uint64_t)(expiry ^ loop->timers.now);
+    int level = 0;
+    if (diff >= GREEN_WHEEL_SLOTS) {
+        level = (63 - __builtin_clzll(diff)) / GREEN_WHEEL_BITS;
+        if (level >= GREEN_WHEEL_LEVELS) {
+            level = GREEN_WHEEL_LEVELS - 1;
+        }
+    }
+    const int slot = (int)(expiry >> (level*GREEN_WHEEL_BITS)) &
+                     (GREEN_WHEEL_SLOTS - 1);
+
+    struct green_timer ** head = &loop->timers.slots[level][slot];
+    timer->slot = (level * GREEN_WHEEL_SLOTS) + slot;
+    timer->prev = NULL;
+    timer->next = *head;
+    if (*head) {
+        (*head)->prev = timer;
+    }
+    *head = timer;
+    loop->timers.occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void green_timer_unlink(green_loop_t loop, struct green_timer * timer)
+{
+    green_assert(timer->slot >= 0);
+    const int level = timer->slot / GREEN_WHEEL_SLOTS;
+    const int slot = timer->slot % GREEN_WHEEL_SLOTS;
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    }
+    else {
+        loop->timers.slots[level][slot] = timer->next;
+        if (timer->next == NULL) {
+            loop->timers.occupied[level] &= ~((uint64_t)1 << slot);
+        }
+    }
+    if (timer->next) {
+        timer->next->prev = timer->prev;
+    }
+    timer->prev = NULL;
+    timer->next = NULL;
+    timer->slot = -1;
+}
+
+// Arm a timer for the current coroutine.
+static void green_timer_start(green_loop_t loop, int64_t deadline,
+                              green_poller_t poller)
+{
+    struct green_timer * timer = &loop->currentcoro->timer;
+    green_assert(timer->slot < 0);
+    // NOTE: the wheel holds a reference until the timer fires or stops.
+    timer->future = NULL;
+    timer->coro = loop->currentcoro;
+    timer->poller = poller;
+    timer->group = NULL;
+    ++timer->coro->refs;
+    // NOTE: round up so that timers never fire early.
+    green_timer_arm(loop, timer, (deadline + GREEN_TICK - 1) / GREEN_TICK);
+    ++loop->timers.size;
+}
+
+static void green_timer_stop(green_loop_t loop, struct green_timer * timer)
+{
+    if (timer->slot >= 0) {
+        green_timer_unlink(loop, timer);
+        --loop->timers.size;
+        if (timer->coro) {
+            green_coroutine_release(timer->coro);
+        }
+    }
+}
+
+static void green_timer_fire(green_loop_t loop, struct green_timer * timer)
+{
+    --loop->timers.size;
+    if (timer->group) {
+        green_taskgroup_expire(timer->group);
+        return;
+    }
+    if (timer->future) {
+        green_future_t future = timer->future;
+        future->timer = NULL;
+        green_pool_free(&loop->timer_pool, timer);
+        green_account(loop, GREEN_MEMORY_TIMERS, 0, -1);
+        green_future_set_result(future, NULL, 0);
+        green_future_release(future);
+        return;
+    }
+    // The poller may have woken up the coroutine already.
+    green_coroutine_t coro = timer->coro;
+    if (timer->poller == NULL) {
+        green_ready_push(loop, coro);
+    }
+    else if (timer->poller->waiter == coro) {
+        timer->poller->waiter = NULL;
+        green_ready_push(loop, coro);
+    }
+    green_coroutine_release(coro);
+}
+
+// Move timers in the slots that the wheel just reached down the wheel.
+static void green_timers_cascade(green_loop_t loop)
+{
+    const int64_t now = loop->timers.now;
+    for (int level = GREEN_WHEEL_LEVELS - 1; level > 0; --level) {
+        const int shift = level * GREEN_WHEEL_BITS;
+        if ((now & (((int64_t)1 << shift) - 1)) != 0) {
+            continue;
+        }
+        const int slot = (int)(now >> shift) & (GREEN_WHEEL_SLOTS - 1);
+        struct green_timer * timer = loop->timers.slots[level][slot];
+        loop->timers.slots[level][slot] = NULL;
+        loop->timers.occupied[level] &= ~((uint64_t)1 << slot);
+        while (timer) {
+            struct green_timer * next = timer->next;
+            green_timer_arm(loop, timer, timer->expiry);
+            timer = next;
+        }
+    }
+}
+
+// Fire all timers that expire at or before `tick`.
+static void green_timers_advance(green_loop_t loop, int64_t tick)
+{
+    while (loop->timers.now <= tick) {
+        const int64_t now = loop->timers.now;
+
+        // Skip windows in which nothing can happen.
+        int level = 0;
+        while ((level < GREEN_WHEEL_LEVELS) &&
+               (loop->timers.occupied[level] == 0)) {
+            ++level;
+        }
+        if (level == GREEN_WHEEL_LEVELS) {
+            loop->timers.now = tick + 1;
+            break;
+        }
+        if (level > 0) {
+            const int64_t mask = ((int64_t)1 << (level*GREEN_WHEEL_BITS)) - 1;
+            const int64_t next = (now | mask) + 1;
+            if (next > tick + 1) {
+                loop->timers.now = tick + 1;
+                break;
+            }
+            loop->timers.now = next;
+            green_timers_cascade(loop);
+            continue;
+        }
+
+        // Fire timers in the current window, up to `tick`.
+        int64_t last = now | (GREEN_WHEEL_SLOTS - 1);
+        if (last > tick) {
+            last = tick;
+        }
+        const int lo = (int)(now & (GREEN_WHEEL_SLOTS - 1));
+        const int hi = (int)(last & (GREEN_WHEEL_SLOTS - 1));
+        const uint64_t range = (~(uint64_t)0 >> (63 - hi)) &
+                               (~(uint64_t)0 << lo);
+        uint64_t bits;
+        while ((bits = loop->timers.occupied[0] & range) != 0) {
+            const int slot = __builtin_ctzll(bits);
+            // NOTE: an expired task group stops other timers, which may be
+            //       in the same slot, so take them out one at a time.
+            struct green_timer * timer = NULL;
+            while ((timer = loop->timers.slots[0][slot]) != NULL) {
+                green_timer_unlink(loop, timer);
+                green_timer_fire(loop, timer);
+            }
+        }
+        loop->timers.now = last + 1;
+        if ((loop->timers.now & (GREEN_WHEEL_SLOTS - 1)) == 0) {
+            green_timers_cascade(loop);
+        }
+    }
+}
+
+// Get the number of milliseconds until the wheel needs attention, or -1.
+static int green_timers_timeout(green_loop_t loop)
+{
+    if (loop->timers.size == 0) {
+        return -1;
+    }
+    const int64_t now = loop->timers.now;
+    int64_t next = -1;
+    for (int level = 0; level < GREEN_WHEEL_LEVELS; ++level) {
+        const uint64_t occupied = loop->timers.occupied[level];
+        if (occupied == 0) {
+            continue;
+        }
+        // Lower levels always come first.  Slots behind the current one only
+        // exist in the top level, for timers more than a full turn away.
+        const int shift = level * GREEN_WHEEL_BITS;
+        const int current = (int)(now >> shift) & (GREEN_WHEEL_SLOTS - 1);
+        const int64_t base = (now >> (shift + GREEN_WHEEL_BITS))
+                             << (shift + GREEN_WHEEL_BITS);
+        const uint64_t ahead = occupied & (~(uint64_t)0 << current);
+        if (ahead) {
+            next = base + ((int64_t)__builtin_ctzll(ahead) << shift);
+        }
+        else {
+            next = base + ((int64_t)1 << (shift + GREEN_WHEEL_BITS));
+        }
+        break;
+    }
+    const int64_t delay = next - (green_now() / GREEN_TICK);
+    if (delay <= 0) {
+        return 0;
+    }
+    return (delay > INT_MAX)? INT_MAX : (int)delay;
+}
+
+green_future_t green_timer_future(green_loop_t loop, int64_t deadline)
+{
+    if (loop == NULL) {
+        return NULL;
+    }
+    green_assert(loop->refs > 0);
+    struct green_timer * timer = green_pool_alloc(&loop->timer_pool);
+    green_account(loop, GREEN_MEMORY_TIMERS, 0, 1);
+
+    // NOTE: the wheel holds a reference until the timer fires.
+    green_future_t future = green_future_init(loop);
+    green_future_acquire(future);
+    future->timer = timer;
+    timer->future = future;
+    timer->coro = NULL;
+    timer->poller = NULL;
+    green_timer_arm(loop, timer, (deadline + GREEN_TICK - 1) / GREEN_TICK);
+    ++loop->timers.size;
+    return future;
+}
+
+int _green_sleep(green_loop_t loop, int64_t duration, const char * source)
+{
+    if (loop == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    const int64_t deadline = green_now() + ((duration > 0)? duration : 0);
+
+    // When called from the loop itself, run coroutines in the meantime.
+    if (loop->currentcoro == NULL) {
+        green_future_t future = green_timer_future(loop, deadline);
+        int rc = green_loop_run_until(loop, future);
+        green_future_release(future);
+        return rc;
+    }
+
+    if (green_coroutine_canceled(loop->currentcoro)) {
+        return GREEN_ECANCELED;
+    }
+    green_timer_start(loop, deadline, NULL);
+    green_suspend(loop, source);
+    // NOTE: an explicit `green_yield()` may resume us before the deadline.
+    green_timer_stop(loop, &loop->currentcoro->timer);
+    if (green_coroutine_canceled(loop->currentcoro)) {
+        return GREEN_ECANCELED;
+    }
+    return GREEN_SUCCESS;
+}
+
+// Take the future out of a reactor slot.  The caller inherits the reactor's
+// reference.
+static green_future_t green_fd_take(green_loop_t loop, green_future_t * slot)
+{
+    green_future_t future = *slot;
+    *slot = NULL;
+    future->reactor.waiting = 0;
+    --loop->reactor.waiting;
+    return future;
+}
+
+// Try a system call without blocking.  Blocking descriptors are switched to
+// non-blocking mode for the duration of the call.
+static long green_io_attempt(int fd, struct green_io * io)
+{
+    if (io->op == green_io_recv) {
+        return recv(fd, io->data, io->size, io->flags | MSG_DONTWAIT);
+    }
+    if (io->op == green_io_send) {
+        return send(fd, io->data, io->size, io->flags | MSG_DONTWAIT);
+    }
+    if ((io->op == green_io_connect) && io->started) {
+        int error = 0;
+        socklen_t size = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &size) != 0) {
+            return -1;
+        }
+        errno = error;
+        return (error == 0)? 0 : -1;
+    }
+    const int mode = fcntl(fd, F_GETFL);
+    if (mode < 0) {
+        return -1;
+    }
+    if (!(mode & O_NONBLOCK) && (fcntl(fd, F_SETFL, mode | O_NONBLOCK) != 0)) {
+        return -1;
+    }
+    long result = -1;
+    switch (io->op) {
+    case green_io_read:
+        result = (io->offset < 0)? read(fd, io->data, io->size) :
+                                   pread(fd, io->data, io->size, io->offset);
+        break;
+    case green_io_write:
+        result = (io->offset < 0)? write(fd, io->data, io->size) :
+                                   pwrite(fd, io->data, io->size, io->offset);
+        break;
+    case green_io_accept:
+        result = accept(fd, io->data, io->length);
+        break;
+    case green_io_connect:
+        result = connect(fd, io->data, (socklen_t)io->size);
+        io->started = 1;
+        break;
+    default:
+        green_assert(0);
+    }
+    const int error = errno;
+    if (!(mode & O_NONBLOCK)) {
+        fcntl(fd, F_SETFL, mode);
+    }
+    errno = error;
+    return result;
+}
+
+// Check if the last attempt failed only because it would have blocked.
+static int green_io_blocked(long result)
+{
+    return (result < 0) &&
+           ((errno == EAGAIN) || (errno == EWOULDBLOCK) ||
+            (errno == EINPROGRESS));
+}
+
+// Complete the future in a reactor slot, unless its system call would still
+// block.
+static void green_fd_complete(green_loop_t loop, green_future_t * slot,
+                              int events)
+{
+    green_future_t future = *slot;
+    struct green_io * io = &future->reactor.io;
+    long result = events;
+    if ((io->op != green_io_none) &&
+        (future->state == green_future_pending)) {
+        result = green_io_attempt(future->reactor.fd, io);
+        if (green_io_blocked(result)) {
+            return;
+        }
+        if (result < 0) {
+            result = -errno;
+        }
+    }
+    green_fd_take(loop, slot);
+    green_future_set_result(future, NULL, (int)result);
+    green_future_release(future);
+}
+
+// Complete futures waiting on a file descriptor.
+static void green_fd_notify(green_loop_t loop, struct green_fd * entry)
+{
+    const int readable = GREEN_FD_READABLE | GREEN_FD_ERROR;
+    const int writable = GREEN_FD_WRITABLE | GREEN_FD_ERROR;
+    if (entry->reader && (entry->events & readable)) {
+        entry->events &= ~GREEN_FD_READABLE;
+        green_fd_complete(loop, &entry->reader,
+                          entry->events | GREEN_FD_READABLE);
+    }
+    if (entry->writer && (entry->events & writable)) {
+        entry->events &= ~GREEN_FD_WRITABLE;
+        green_fd_complete(loop, &entry->writer,
+                          entry->events | GREEN_FD_WRITABLE);
+    }
+}
+
+// Create the epoll instance, if necessary.
+static int green_reactor_open(green_loop_t loop)
+{
+#if GREEN_USE_EPOLL
+    if (loop->reactor.fd < 0) {
+        loop->reactor.fd = epoll_create1(EPOLL_CLOEXEC);
+    }
+    return loop->reactor.fd >= 0;
+#else
+    return 0;
+#endif
+}
+
+#if GREEN_USE_IO_URING
+
+static const unsigned GREEN_URING_ENTRIES = 256;
+
+// Create the io_uring instance, if necessary.
+static int green_uring_open(green_loop_t loop)
+{
+    if (loop->uring.fd != -1) {
+        return loop->uring.fd >= 0;
+    }
+    loop->uring.fd = -2;
+
+    // Completions are signaled through the reactor, so the loop only ever
+    // blocks in `epoll_wait()`.
+    if (!green_reactor_open(loop)) {
+        return 0;
+    }
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, GREEN_URING_ENTRIES, &params);
+    if (fd < 0) {
+        return 0;
+    }
+
+    size_t sq_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes +
+        params.cq_entries*sizeof(struct io_uring_cqe);
+    const int single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single) {
+        sq_size = cq_size = (sq_size > cq_size)? sq_size : cq_size;
+    }
+    size_t sqes_size = params.sq_entries*sizeof(struct io_uring_sqe);
+
+    char * sq = mmap(NULL, sq_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    char * cq = single? sq : mmap(NULL, cq_size, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED | MAP_POPULATE, fd,
+                                  IORING_OFF_CQ_RING);
+    void * sqes = mmap(NULL, sqes_size, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if ((sq == MAP_FAILED) || (cq == MAP_FAILED) || (sqes == MAP_FAILED) ||
+        (epoll_ctl(loop->reactor.fd, EPOLL_CTL_ADD, fd, &event) != 0)) {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqes_size);
+        }
+        if ((cq != MAP_FAILED) && (cq != sq)) {
+            munmap(cq, cq_size);
+        }
+        if (sq != MAP_FAILED) {
+            munmap(sq, sq_size);
+        }
+        close(fd);
+        return 0;
+    }
+
+    loop->uring.entries = params.sq_entries;
+    loop->uring.queued = 0;
+    loop->uring.sq_head = (unsigned*)(sq + params.sq_off.head);
+    loop->uring.sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    loop->uring.sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    loop->uring.sq_array = (unsigned*)(sq + params.sq_off.array);
+    loop->uring.sqes = sqes;
+    loop->uring.cq_head = (unsigned*)(cq + params.cq_off.head);
+    loop->uring.cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    loop->uring.cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    loop->uring.cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    loop->uring.sq_ring = sq;
+    loop->uring.sq_ring_size = sq_size;
+    loop->uring.cq_ring = cq;
+    loop->uring.cq_ring_size = cq_size;
+    loop->uring.sqes_size = sqes_size;
+    loop->uring.fd = fd;
+    return 1;
+}
+
+// Hand all queued submissions to the kernel in a single system call, and
+// wait for `wait` completions.
+static void green_uring_enter(green_loop_t loop, unsigned wait)
+{
+    int rc = (int)syscall(__NR_io_uring_enter, loop->uring.fd,
+                          loop->uring.queued, wait,
+                          wait? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    // NOTE: on failure, submissions stay queued until the next tick.
+    if (rc > 0) {
+        loop->uring.queued -= (unsigned)rc;
+    }
+}
+
+static void green_uring_submit(green_loop_t loop)
+{
+    if ((loop->uring.fd < 0) || (loop->uring.queued == 0)) {
+        return;
+    }
+    green_uring_enter(loop, 0);
+}
+
+static void green_uring_reap(green_loop_t loop)
+{
+    if (loop->uring.fd < 0) {
+        return;
+    }
+    unsigned head = *loop->uring.cq_head;
+    unsigned tail = __atomic_load_n(loop->uring.cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        struct io_uring_cqe * cqe =
+            &loop->uring.cqes[head & *loop->uring.cq_mask];
+        green_future_t future = (green_future_t)(uintptr_t)cqe->user_data;
+        int result = cqe->res;
+        __atomic_store_n(loop->uring.cq_head, ++head, __ATOMIC_RELEASE);
+        // Cancel requests have no future.
+        if (future == NULL) {
+            continue;
+        }
+        future->uring = 0;
+        --loop->reactor.waiting;
+        // NOTE: the result of a canceled future is simply dropped.
+        green_future_set_result(future, NULL, result);
+        green_future_release(future);
+    }
+}
+
+// Get a blank submission queue entry, or NULL if the queue is full.  The
+// entry is queued by `green_uring_push()`.
+static struct io_uring_sqe * green_uring_sqe(green_loop_t loop)
+{
+    unsigned head = __atomic_load_n(loop->uring.sq_head, __ATOMIC_ACQUIRE);
+    unsigned tail = *loop->uring.sq_tail;
+    if ((tail - head) >= loop->uring.entries) {
+        // Submission queue is full, flush it early.
+        green_uring_submit(loop);
+        head = __atomic_load_n(loop->uring.sq_head, __ATOMIC_ACQUIRE);
+        if ((tail - head) >= loop->uring.entries) {
+            return NULL;
+        }
+    }
+    struct io_uring_sqe * sqe =
+        &loop->uring.sqes[tail & *loop->uring.sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+static void green_uring_push(green_loop_t loop)
+{
+    const unsigned tail = *loop->uring.sq_tail;
+    const unsigned index = tail & *loop->uring.sq_mask;
+    loop->uring.sq_array[index] = index;
+    __atomic_store_n(loop->uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+    ++loop->uring.queued;
+}
+
+static green_future_t green_uring_op(green_loop_t loop, int opcode, int fd,
+                                     const void * addr, size_t size,
+                                     uint64_t off, int flags)
+{
+    struct io_uring_sqe * sqe = green_uring_sqe(loop);
+    if (sqe == NULL) {
+        return NULL;
+    }
+
+    // NOTE: the ring holds a reference until the completion is reaped.
+    green_future_t future = green_future_init(loop);
+    green_future_acquire(future);
+    future->uring = 1;
+
+    sqe->opcode = (unsigned char)opcode;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)addr;
+    sqe->len = (size > 0x7ffff000)? 0x7ffff000 : (unsigned)size;
+    sqe->off = off;
+    sqe->rw_flags = flags;
+    sqe->user_data = (uint64_t)(uintptr_t)future;
+    green_uring_push(loop);
+    ++loop->reactor.waiting;
+    return future;
+}
+
+// Stop an operation in flight and wait until the kernel is done with it, so
+// that the buffer can be reused (or the stack it is on recycled) as soon as
+// the future is canceled.  Other completions are processed meanwhile.
+static void green_uring_cancel(green_loop_t loop, green_future_t future)
+{
+    struct io_uring_sqe * sqe = NULL;
+    while ((sqe = green_uring_sqe(loop)) == NULL) {
+        green_uring_enter(loop, 1);
+        green_uring_reap(loop);
+        if (!future->uring) {
+            return;
+        }
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = (uint64_t)(uintptr_t)future;
+    green_uring_push(loop);
+    while (future->uring) {
+        green_uring_enter(loop, 1);
+        green_uring_reap(loop);
+    }
+}
+
+#endif
+
+// Get a future for an operation that completed synchronously.
+static green_future_t green_future_now(green_loop_t loop, long result)
+{
+    green_future_t future = green_future_init(loop);
+    green_future_set_result(future, NULL, (result < 0)? -errno : (int)result);
+    return future;
+}
+
+static green_future_t green_fd_future(green_loop_t loop, int fd, int write,
+                                      const struct green_io * io);
+
+// Perform an operation without io_uring: try it right away, and let the
+// reactor try again each time the descriptor becomes ready.  Without a
+// reactor, operations that would block fail with `-ENOSYS`.
+static green_future_t green_io_start(green_loop_t loop, int fd, int write,
+                                     struct green_io * io)
+{
+    const long result = green_io_attempt(fd, io);
+    if (!green_io_blocked(result)) {
+        return green_future_now(loop, result);
+    }
+    green_future_t future = green_fd_future(loop, fd, write, io);
+    if (future == NULL) {
+        return green_future_now(loop, -1);
+    }
+    return future;
+}
+
+green_future_t green_read(green_loop_t loop, int fd,
+                          void * data, size_t size, off_t offset)
+{
+    if ((loop == NULL) || (fd < 0) || ((data == NULL) && (size > 0))) {
+        return NULL;
+    }
+#if GREEN_USE_IO_URING
+    if (green_uring_open(loop)) {
+        return green_uring_op(loop, IORING_OP_READ, fd, data, size,
+                              (uint64_t)offset, 0);
+    }
+#endif
+    struct green_io io = {green_io_read, data, size, offset, 0, NULL, 0};
+    return green_io_start(loop, fd, 0, &io);
+}
+
+green_future_t green_write(green_loop_t loop, int fd,
+                           const void * data, size_t size, off_t offset)
+{
+    if ((loop == NULL) || (fd < 0) || ((data == NULL) && (size > 0))) {
+        return NULL;
+    }
+#if GREEN_USE_IO_URING
+    if (green_uring_open(loop)) {
+        return green_uring_op(loop, IORING_OP_WRITE, fd, data, size,
+                              (uint64_t)offset, 0);
+    }
+#endif
+    struct green_io io = {green_io_write, (void*)data, size, offset, 0, NULL, 0};
+    return green_io_start(loop, fd, 1, &io);
+}
+
+green_future_t green_recv(green_loop_t loop, int fd,
+                          void * data, size_t size, int flags)
+{
+    if ((loop == NULL) || (fd < 0) || ((data == NULL) && (size > 0))) {
+        return NULL;
+    }
+#if GREEN_USE_IO_URING
+    if (green_uring_open(loop)) {
+        return green_uring_op(loop, IORING_OP_RECV, fd, data, size, 0, flags);
+    }
+#endif
+    struct green_io io = {green_io_recv, data, size, 0, flags, NULL, 0};
+    return green_io_start(loop, fd, 0, &io);
+}
+
+green_future_t green_send(green_loop_t loop, int fd,
+                          const void * data, size_t size, int flags)
+{
+    if ((loop == NULL) || (fd < 0) || ((data == NULL) && (size > 0))) {
+        return NULL;
+    }
+#if GREEN_USE_IO_URING
+    if (green_uring_open(loop)) {
+        return green_uring_op(loop, IORING_OP_SEND, fd, data, size, 0, flags);
+    }
+#endif
+    struct green_io io = {green_io_send, (void*)data, size, 0, flags, NULL, 0};
+    return green_io_start(loop, fd, 1, &io);
+}
+
+green_future_t green_accept(green_loop_t loop, int fd,
+                            struct sockaddr * addr, socklen_t * size)
+{
+    if ((loop == NULL) || (fd < 0)) {
+        return NULL;
+    }
+#if GREEN_USE_IO_URING
+    if (green_uring_open(loop)) {
+        return green_uring_op(loop, IORING_OP_ACCEPT, fd, addr, 0,
+                              (uint64_t)(uintptr_t)size, 0);
+    }
+#endif
+    struct green_io io = {green_io_accept, addr, 0, 0, 0, size, 0};
+    return green_io_start(loop, fd, 0, &io);
+}
+
+green_future_t green_connect(green_loop_t loop, int fd,
+                             const struct sockaddr * addr, socklen_t size)
+{
+    if ((loop == NULL) || (fd < 0) || (addr == NULL)) {
+        return NULL;
+    }
+#if GREEN_USE_IO_URING
+    if (green_uring_open(loop)) {
+        return green_uring_op(loop, IORING_OP_CONNECT, fd, addr, 0,
+                              (uint64_t)size, 0);
+    }
+#endif
+    struct green_io io = {green_io_connect, (void*)addr, size, 0, 0, NULL, 0};
+    return green_io_start(loop, fd, 1, &io);
+}
+
+static int green_worker_has_work(struct green_worker * worker);
+static void green_loop_drain(green_loop_t loop);
+
+// Create the channel through which other threads wake up the loop.
+static int green_loop_wake_open(green_loop_t loop)
+{
+#if GREEN_USE_EPOLL
+    if (loop->wake.fd >= 0) {
+        return 1;
+    }
+    if (!green_reactor_open(loop)) {
+        return 0;
+    }
+    int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (fd < 0) {
+        return 0;
+    }
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(loop->reactor.fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        close(fd);
+        return 0;
+    }
+    loop->wake.fd = fd;
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Wake up the loop if it is blocked (or about to block) waiting for events.
+static void green_loop_wake(green_loop_t loop)
+{
+    if (__atomic_exchange_n(&loop->wake.idle, 0, __ATOMIC_SEQ_CST) &&
+        (loop->wake.fd >= 0)) {
+        const uint64_t one = 1;
+        ssize_t rc = write(loop->wake.fd, &one, sizeof(one));
+        (void)rc;
+    }
+}
+
+// Wait for I/O events for up to `timeout` milliseconds (-1 for no limit).
+static void green_loop_poll(green_loop_t loop, int timeout)
+{
+    // Other threads must wake us up if we block.  Check for work that they
+    // posted before they could see the flag.
+    if ((timeout != 0) &&
+        ((loop->worker != NULL) || (loop->remote.pending > 0))) {
+        green_loop_wake_open(loop);
+        __atomic_store_n(&loop->wake.idle, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if ((__atomic_load_n(&loop->remote.head, __ATOMIC_RELAXED) != NULL) ||
+            (loop->worker && green_worker_has_work(loop->worker))) {
+            timeout = 0;
+        }
+        // Without a wake-up channel, check for work every tick.
+        else if ((loop->wake.fd < 0) && ((timeout < 0) || (timeout > 1))) {
+            timeout = 1;
+        }
+    }
+
+    // Nothing to wait for but timers.
+    if (loop->reactor.fd < 0) {
+        if (timeout > 0) {
+            poll(NULL, 0, timeout);
+        }
+        __atomic_store_n(&loop->wake.idle, 0, __ATOMIC_RELAXED);
+        return;
+    }
+#if GREEN_USE_EPOLL
+    struct epoll_event events[64];
+    int n = epoll_wait(loop->reactor.fd, events, 64, timeout);
+    __atomic_store_n(&loop->wake.idle, 0, __ATOMIC_RELAXED);
+    for (int i = 0; i < n; ++i) {
+        const int fd = events[i].data.fd;
+        if (fd == loop->wake.fd) {
+            uint64_t count = 0;
+            ssize_t rc = read(fd, &count, sizeof(count));
+            (void)rc;
+            continue;
+        }
+        // Stale event for a descriptor that was detached.
+        if ((fd < 0) || ((size_t)fd >= loop->reactor.size) ||
+            !loop->reactor.fds[fd].registered) {
+            continue;
+        }
+        struct green_fd * entry = &loop->reactor.fds[fd];
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP)) {
+            entry->events |= GREEN_FD_READABLE;
+        }
+        if (events[i].events & EPOLLOUT) {
+            entry->events |= GREEN_FD_WRITABLE;
+        }
+        if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+            entry->events |= GREEN_FD_ERROR;
+        }
+        green_fd_notify(loop, entry);
+    }
+#endif
+#if GREEN_USE_IO_URING
+    green_uring_reap(loop);
+#endif
+}
+
+// Check if anything can still make progress.
+static int green_loop_alive(green_loop_t loop)
+{
+    return (loop->ready.head != NULL) || (loop->reactor.waiting > 0) ||
+           (loop->timers.size > 0) || (loop->remote.pending > 0);
+}
+
+// Find (or create) the reactor entry for `fd`.
+static struct green_fd * green_fd_entry(green_loop_t loop, int fd)
+{
+#if GREEN_USE_EPOLL
+    if ((fd < 0) || !green_reactor_open(loop)) {
+        return NULL;
+    }
+    if ((size_t)fd >= loop->reactor.size) {
+        size_t size = (loop->reactor.size > 0)? loop->reactor.size : 64;
+        while (size <= (size_t)fd) {
+            size *= 2;
+        }
+        struct green_fd * fds = green_malloc(loop, GREEN_MEMORY_OTHER,
+                                             size * sizeof(struct green_fd));
+        if (loop->reactor.fds) {
+            memcpy(fds, loop->reactor.fds,
+                   loop->reactor.size * sizeof(struct green_fd));
+            green_free(loop->reactor.fds);
+        }
+        loop->reactor.fds = fds;
+        loop->reactor.size = size;
+    }
+    struct green_fd * entry = &loop->reactor.fds[fd];
+    if (!entry->registered) {
+        // Registration is edge-triggered and persistent, so each request
+        // afterwards costs no system call.
+        struct epoll_event event;
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        event.data.fd = fd;
+        if (epoll_ctl(loop->reactor.fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            return NULL;
+        }
+        entry->registered = 1;
+        entry->events = 0;
+    }
+    return entry;
+#else
+    errno = ENOSYS;
+    return NULL;
+#endif
+}
+
+static green_future_t green_fd_future(green_loop_t loop, int fd, int write,
+                                      const struct green_io * io)
+{
+    if (loop == NULL) {
+        return NULL;
+    }
+    green_assert(loop->refs > 0);
+    struct green_fd * entry = green_fd_entry(loop, fd);
+    if (entry == NULL) {
+        return NULL;
+    }
+    green_future_t * slot = write? &entry->writer : &entry->reader;
+
+    // Drop stale (completed by hand) request.
+    if (*slot && (*slot)->state != green_future_pending) {
+        green_future_release(green_fd_take(loop, slot));
+    }
+
+    // One pending request per direction.
+    if (*slot) {
+        errno = EBUSY;
+        return NULL;
+    }
+
+    // NOTE: the reactor holds a reference until the future completes.
+    green_future_t future = green_future_init(loop);
+    green_future_acquire(future);
+    *slot = future;
+    future->reactor.waiting = 1;
+    future->reactor.fd = fd;
+    future->reactor.write = write;
+    if (io) {
+        future->reactor.io = *io;
+    }
+    ++loop->reactor.waiting;
+
+    // Readiness may have been reported before anybody asked for it.
+    green_fd_notify(loop, entry);
+    return future;
+}
+
+green_future_t green_fd_readable(green_loop_t loop, int fd)
+{
+    return green_fd_future(loop, fd, 0, NULL);
+}
+
+green_future_t green_fd_writable(green_loop_t loop, int fd)
+{
+    return green_fd_future(loop, fd, 1, NULL);
+}
+
+int green_fd_detach(green_loop_t loop, int fd)
+{
+    if ((loop == NULL) || (fd < 0)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    if (((size_t)fd >= loop->reactor.size) ||
+        !loop->reactor.fds[fd].registered) {
+        return GREEN_ENOENT;
+    }
+    struct green_fd * entry = &loop->reactor.fds[fd];
+#if GREEN_USE_EPOLL
+    // NOTE: this fails if the descriptor is already closed, but closing the
+    //       descriptor already removed it from the epoll set.
+    epoll_ctl(loop->reactor.fd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+    green_future_t futures[2] = {NULL, NULL};
+    if (entry->reader) {
+        futures[0] = green_fd_take(loop, &entry->reader);
+    }
+    if (entry->writer) {
+        futures[1] = green_fd_take(loop, &entry->writer);
+    }
+    memset(entry, 0, sizeof(*entry));
+    for (int i = 0; i < 2; ++i) {
+        if (futures[i]) {
+            green_future_cancel(futures[i]);
+            green_future_release(futures[i]);
+        }
+    }
+    return GREEN_SUCCESS;
+}
+
+int green_loop_run_once(green_loop_t loop)
+{
+    if (loop == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+
+    // Only the loop can dispatch coroutines.
+    if (loop->currentcoro != NULL) {
+        return GREEN_EBUSY;
+    }
+
+#if GREEN_USE_IO_URING
+    green_uring_submit(loop);
+#endif
+
+    // Collect I/O completions, expired timers and results from other
+    // threads.  Block only if there is nothing else to do, and no longer than
+    // the next timer.
+    if ((loop->reactor.waiting > 0) || (loop->timers.size > 0) ||
+        (loop->remote.pending > 0)) {
+        const int timeout = (loop->ready.head != NULL)? 0 :
+                            green_timers_timeout(loop);
+        const int64_t start = green_now();
+        green_loop_poll(loop, timeout);
+        const int64_t now = green_now();
+        if (timeout != 0) {
+            loop->stats.idle += now - start;
+        }
+        loop->clock = now;
+        green_timers_advance(loop, now / GREEN_TICK);
+        green_loop_drain(loop);
+    }
+
+    // Coroutines that become ready while this batch runs wait for the next
+    // batch, so that a coroutine that keeps yielding can't starve the loop.
+    // Dump requested by a signal, which also cut the wait short.
+    if (loop->dump.signal != 0) {
+        green_dump_check(loop);
+    }
+
+    if (loop->ready.head) {
+        const int64_t start = green_now();
+        loop->clock = start;
+        for (size_t n = loop->ready.size; (n > 0) && loop->ready.head; --n) {
+            green_coroutine_t coro = loop->ready.head;
+            green_ready_unlink(loop, coro);
+            green_resume(loop, coro);
+            green_coroutine_release(coro);
+        }
+        loop->stats.busy += green_now() - start;
+    }
+
+    return GREEN_SUCCESS;
+}
+
+int green_loop_run(green_loop_t loop)
+{
+    if (loop == NULL) {
+        return GREEN_EINVAL;
+    }
+    while (green_loop_alive(loop)) {
+        int rc = green_loop_run_once(loop);
+        if (rc != GREEN_SUCCESS) {
+            return rc;
+        }
+    }
+    return GREEN_SUCCESS;
+}
+
+int green_loop_run_until(green_loop_t loop, green_future_t future)
+{
+    if ((loop == NULL) || (future == NULL)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(future->refs > 0);
+    if (future->loop != loop) {
+        return GREEN_EINVAL;
+    }
+    while (!green_future_done(future)) {
+        // Nothing left that could complete the future.
+        if (!green_loop_alive(loop)) {
+            return GREEN_EBUSY;
+        }
+        int rc = green_loop_run_once(loop);
+        if (rc != GREEN_SUCCESS) {
+            return rc;
+        }
+    }
+    return GREEN_SUCCESS;
+}
+
+// Loop group.  Each worker thread runs its own loop and keeps spawned tasks
+// in a Chase-Lev deque: the owner pushes and pops at the bottom while idle
+// workers steal from the top.  Tasks spawned from outside the group go to a
+// shared queue.
+//
+// NOTE: a coroutine that already started may hold futures and pollers that
+//       belong to its loop on its stack, so it can't move to another loop in
+//       general.  Tasks are only turned into coroutines when a loop is about
+//       to run them, so stealing moves them between threads for free.
+//       Coroutines that keep computing start no new tasks, so the remaining
+//       imbalance comes from a few long-running coroutines piling up on one
+//       loop: those that park in `green_yield_any()` (promising to hold
+//       nothing that belongs to their loop) are handed by busy workers to
+//       idle ones.
+#define GREEN_DEQUE_SIZE 1024
+
+struct green_task {
+    green_loop_group_t group;
+    struct green_task * next;
+    int(*method)(green_loop_t,void*);
+    void * object;
+    size_t stack_size;
+    const char * source;
+};
+
+struct green_worker {
+    green_loop_group_t group;
+    green_loop_t loop;
+    pthread_t thread;
+    int started;
+    unsigned seed;
+
+    // Deque indices, on their own cache lines.
+    char pad0[64];
+    int64_t top;
+    char pad1[64];
+    int64_t bottom;
+    char pad2[64];
+    struct green_task * tasks[GREEN_DEQUE_SIZE];
+};
+
+struct green_loop_group {
+    int refs;
+    int running;
+    size_t size;
+    struct green_worker * workers;
+
+    // Tasks spawned but not finished yet.
+    size_t pending;
+
+    // Tasks spawned from outside the group (FIFO).
+    pthread_mutex_t lock;
+    struct green_task * head;
+    struct green_task * tail;
+    size_t injected;
+
+    // Coroutines handed over by busy workers (FIFO, under the same lock),
+    // and number of workers waiting for something to do.
+    green_coroutine_t migrants_head;
+    green_coroutine_t migrants_tail;
+    size_t migrating;
+    size_t idle;
+};
+
+// Worker that runs on the current thread, if any.
+static __thread struct green_worker * green_current_worker = NULL;
+
+static int green_deque_push(struct green_worker * worker,
+                            struct green_task * task)
+{
+    const int64_t b = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED);
+    const int64_t t = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    if ((b - t) >= GREEN_DEQUE_SIZE) {
+        return 0;
+    }
+    __atomic_store_n(&worker->tasks[b & (GREEN_DEQUE_SIZE - 1)], task,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&worker->bottom, b + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static struct green_task * green_deque_pop(struct green_worker * worker)
+{
+    const int64_t b = __atomic_load_n(&worker->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&worker->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    int64_t t = __atomic_load_n(&worker->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&worker->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    struct green_task * task = __atomic_load_n(
+        &worker->tasks[b & (GREEN_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (t == b) {
+        // Last task, race against thieves.
+        if (!__atomic_compare_exchange_n(&worker->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = NULL;
+        }
+        __atomic_store_n(&worker->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+static struct green_task * green_deque_steal(struct green_worker * worker)
+{
+    int64_t t = __atomic_load_n(&worker->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    const int64_t b = __atomic_load_n(&worker->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return NULL;
+    }
+    struct green_task * task = __atomic_load_n(
+        &worker->tasks[t & (GREEN_DEQUE_SIZE - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&worker->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return task;
+}
+
+static void green_inject_push(green_loop_group_t group,
+                              struct green_task * task)
+{
+    pthread_mutex_lock(&group->lock);
+    task->next = NULL;
+    if (group->tail) {
+        group->tail->next = task;
+    }
+    else {
+        group->head = task;
+    }
+    group->tail = task;
+    __atomic_add_fetch(&group->injected, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&group->lock);
+}
+
+static struct green_task * green_inject_pop(green_loop_group_t group)
+{
+    if (__atomic_load_n(&group->injected, __ATOMIC_ACQUIRE) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&group->lock);
+    struct green_task * task = group->head;
+    if (task) {
+        group->head = task->next;
+        if (group->head == NULL) {
+            group->tail = NULL;
+        }
+        __atomic_sub_fetch(&group->injected, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&group->lock);
+    return task;
+}
+
+static void green_migrant_push(green_loop_group_t group,
+                               green_coroutine_t coro)
+{
+    pthread_mutex_lock(&group->lock);
+    coro->next = NULL;
+    if (group->migrants_tail) {
+        group->migrants_tail->next = coro;
+    }
+    else {
+        group->migrants_head = coro;
+    }
+    group->migrants_tail = coro;
+    __atomic_add_fetch(&group->migrating, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&group->lock);
+}
+
+static green_coroutine_t green_migrant_pop(green_loop_group_t group)
+{
+    if (__atomic_load_n(&group->migrating, __ATOMIC_ACQUIRE) == 0) {
+        return NULL;
+    }
+    pthread_mutex_lock(&group->lock);
+    green_coroutine_t coro = group->migrants_head;
+    if (coro) {
+        group->migrants_head = coro->next;
+        if (group->migrants_head == NULL) {
+            group->migrants_tail = NULL;
+        }
+        coro->next = NULL;
+        __atomic_sub_fetch(&group->migrating, 1, __ATOMIC_SEQ_CST);
+    }
+    pthread_mutex_unlock(&group->lock);
+    return coro;
+}
+
+// Take a coroutine off its loop, which keeps none of its resources.  The
+// caller inherits the ready queue's reference.
+static void green_migrate_out(green_loop_t loop, green_coroutine_t coro)
+{
+    const ptrdiff_t stack = (ptrdiff_t)(coro->stack_size + green_page_size());
+    green_ready_unlink(loop, coro);
+    green_registry_unlink(loop, coro);
+    --loop->ready.migratable;
+    --loop->coroutines;
+    // NOTE: the coroutine keeps its loop alive while it runs.
+    --loop->refs;
+    ++loop->stats.migrated_out;
+    green_account(loop, GREEN_MEMORY_COROUTINES, 0, -1);
+    green_account(loop, GREEN_MEMORY_STACKS, -stack, -1);
+}
+
+static void green_migrate_in(green_loop_t loop, green_coroutine_t coro)
+{
+    const ptrdiff_t stack = (ptrdiff_t)(coro->stack_size + green_page_size());
+    coro->loop = loop;
+    green_registry_link(loop, coro);
+    ++loop->ready.migratable;
+    ++loop->coroutines;
+    ++loop->refs;
+    ++loop->stats.migrated_in;
+    green_account(loop, GREEN_MEMORY_COROUTINES, 0, 1);
+    green_account(loop, GREEN_MEMORY_STACKS, stack, 1);
+    green_ready_push(loop, coro);
+    // The ready queue's reference came along.
+    --coro->refs;
+}
+
+// Hand coroutines parked in `green_yield_any()` to idle workers, the ones
+// that waited longest first.  Keep at least one ready coroutine, since
+// handing over all of them would just move the imbalance.
+static void green_worker_donate(struct green_worker * worker)
+{
+    green_loop_group_t group = worker->group;
+    green_loop_t loop = worker->loop;
+    const size_t idle = __atomic_load_n(&group->idle, __ATOMIC_RELAXED);
+    size_t count = 0;
+    green_coroutine_t coro = loop->ready.tail;
+    while (coro && (count < idle) && (loop->ready.size > 1)) {
+        green_coroutine_t prev = coro->prev;
+        // NOTE: the ready queue and the coroutine itself must hold the only
+        //       references, or somebody on this loop could still reach it.
+        if (coro->migratable && (coro->refs == 2)) {
+            green_migrate_out(loop, coro);
+            green_migrant_push(group, coro);
+            ++count;
+        }
+        coro = prev;
+    }
+
+    // Wake up idle workers to pick them up.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (size_t i = 0; (i < group->size) && (count > 0); ++i) {
+        struct green_worker * other = &group->workers[i];
+        if ((other != worker) &&
+            __atomic_load_n(&other->loop->wake.idle, __ATOMIC_RELAXED)) {
+            green_loop_wake(other->loop);
+            --count;
+        }
+    }
+}
+
+// Check if the worker should not block: there are tasks or coroutines left
+// to start, or there is nothing left to do at all.
+static int green_worker_has_work(struct green_worker * worker)
+{
+    green_loop_group_t group = worker->group;
+    if ((__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) == 0) ||
+        (__atomic_load_n(&group->injected, __ATOMIC_SEQ_CST) > 0) ||
+        (__atomic_load_n(&group->migrating, __ATOMIC_SEQ_CST) > 0)) {
+        return 1;
+    }
+    for (size_t i = 0; i < group->size; ++i) {
+        struct green_worker * other = &group->workers[i];
+        if (__atomic_load_n(&other->bottom, __ATOMIC_SEQ_CST) >
+            __atomic_load_n(&other->top, __ATOMIC_SEQ_CST)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Get the next task to start: local tasks first (most recent first), then
+// tasks spawned from outside, then tasks stolen from other workers.
+static struct green_task * green_worker_take(struct green_worker * worker)
+{
+    struct green_task * task = green_deque_pop(worker);
+    if (task == NULL) {
+        task = green_inject_pop(worker->group);
+    }
+    if (task == NULL) {
+        green_loop_group_t group = worker->group;
+        worker->seed = (worker->seed * 1103515245) + 12345;
+        const size_t start = (worker->seed >> 16) % group->size;
+        for (size_t i = 0; (i < group->size) && (task == NULL); ++i) {
+            struct green_worker * victim =
+                &group->workers[(start + i) % group->size];
+            if (victim != worker) {
+                task = green_deque_steal(victim);
+            }
+        }
+    }
+    return task;
+}
+
+static int green_task_main(green_loop_t loop, void * object)
+{
+    struct green_task * task = object;
+    green_loop_group_t group = task->group;
+    int result = task->method(loop, task->object);
+    green_free(task);
+
+    // Last task, let all workers finish.
+    if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+        for (size_t i = 0; i < group->size; ++i) {
+            green_loop_wake(group->workers[i].loop);
+        }
+    }
+    return result;
+}
+
+static void * green_worker_main(void * object)
+{
+    struct green_worker * worker = object;
+    green_loop_group_t group = worker->group;
+    green_loop_t loop = worker->loop;
+    green_current_worker = worker;
+    green_loop_wake_open(loop);
+    loop->worker = worker;
+
+    for (;;) {
+        if ((loop->ready.migratable > 0) && (loop->ready.size > 1) &&
+            (__atomic_load_n(&group->idle, __ATOMIC_RELAXED) > 0)) {
+            green_worker_donate(worker);
+        }
+
+        // Start new tasks only when the loop runs out of ready coroutines,
+        // so that the others stay available to idle workers.  Coroutines
+        // handed over by other workers come first, they already started.
+        green_coroutine_t migrant = NULL;
+        if ((loop->ready.head == NULL) &&
+            ((migrant = green_migrant_pop(group)) != NULL)) {
+            green_migrate_in(loop, migrant);
+        }
+        if (loop->ready.head == NULL) {
+            struct green_task * task = green_worker_take(worker);
+            if (task) {
+                green_coroutine_t coro = _green_coroutine_init(
+                    loop, green_task_main, task,
+                    task->stack_size, task->source);
+                if (coro == NULL) {
+                    // Out of memory, let somebody else try.
+                    green_inject_push(group, task);
+                }
+                else {
+                    green_coroutine_release(coro);
+                }
+            }
+        }
+        if (green_loop_alive(loop)) {
+            green_loop_run_once(loop);
+            continue;
+        }
+        if (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) == 0) {
+            break;
+        }
+        // Nothing to do until a task is spawned (or a coroutine handed
+        // over).
+        __atomic_add_fetch(&group->idle, 1, __ATOMIC_SEQ_CST);
+        green_loop_poll(loop, -1);
+        __atomic_sub_fetch(&group->idle, 1, __ATOMIC_SEQ_CST);
+    }
+
+    loop->worker = NULL;
+    green_current_worker = NULL;
+    return NULL;
+}
+
+green_loop_group_t green_loop_group_init(size_t size)
+{
+    if (size == 0) {
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        size = (count > 0)? (size_t)count : 1;
+    }
+    green_loop_group_t group = green_malloc(NULL, GREEN_MEMORY_OTHER,
+                                            sizeof(struct green_loop_group));
+    group->workers = green_malloc(NULL, GREEN_MEMORY_OTHER,
+                                  size * sizeof(struct green_worker));
+    group->refs = 1;
+    group->size = size;
+    pthread_mutex_init(&group->lock, NULL);
+    for (size_t i = 0; i < size; ++i) {
+        group->workers[i].group = group;
+        group->workers[i].loop = green_loop_init();
+        group->workers[i].seed = (unsigned)i + 1;
+    }
+    return group;
+}
+
+int green_loop_group_acquire(green_loop_group_t group)
+{
+    if (group == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(group->refs > 0);
+    ++group->refs;
+    return GREEN_SUCCESS;
+}
+
+int green_loop_group_release(green_loop_group_t group)
+{
+    if (group == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(group->refs > 0);
+    if (--group->refs > 0) {
+        return GREEN_SUCCESS;
+    }
+    green_assert(!group->running);
+
+    // Tasks that never ran.
+    struct green_task * task = NULL;
+    while ((task = green_inject_pop(group)) != NULL) {
+        green_free(task);
+    }
+    for (size_t i = 0; i < group->size; ++i) {
+        while ((task = green_deque_pop(&group->workers[i])) != NULL) {
+            green_free(task);
+        }
+    }
+
+    // NOTE: coroutines that moved are recycled by the loop they finished
+    //       on, but they come from the pool of the loop they started on, so
+    //       empty all caches before any pool goes away.
+    green_assert(group->migrants_head == NULL);
+    for (size_t i = 0; i < group->size; ++i) {
+        green_loop_trim_cache(group->workers[i].loop, 0);
+    }
+    for (size_t i = 0; i < group->size; ++i) {
+        green_loop_release(group->workers[i].loop);
+    }
+    pthread_mutex_destroy(&group->lock);
+    green_free(group->workers);
+    green_free(group);
+    return GREEN_SUCCESS;
+}
+
+size_t green_loop_group_size(green_loop_group_t group)
+{
+    if (group == NULL) {
+        return 0;
+    }
+    green_assert(group->refs > 0);
+    return group->size;
+}
+
+int _green_loop_group_spawn(green_loop_group_t group,
+                            int(*method)(green_loop_t,void*),
+                            void * object, size_t stack_size,
+                            const char * source)
+{
+    if ((group == NULL) || (method == NULL)) {
+        return GREEN_EINVAL;
+    }
+    struct green_task * task = green_malloc(NULL, GREEN_MEMORY_OTHER,
+                                            sizeof(struct green_task));
+    task->group = group;
+    task->method = method;
+    task->object = object;
+    task->stack_size = stack_size;
+    task->source = source;
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_SEQ_CST);
+
+    // Keep tasks spawned by the group's own coroutines local.
+    struct green_worker * worker = green_current_worker;
+    if ((worker == NULL) || (worker->group != group) ||
+        !green_deque_push(worker, task)) {
+        green_inject_push(group, task);
+    }
+
+    // Wake up one idle worker to pick it up (or steal it).
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    for (size_t i = 0; i < group->size; ++i) {
+        struct green_worker * other = &group->workers[i];
+        if ((other != worker) &&
+            __atomic_load_n(&other->loop->wake.idle, __ATOMIC_RELAXED)) {
+            green_loop_wake(other->loop);
+            break;
+        }
+    }
+    return GREEN_SUCCESS;
+}
+
+int green_loop_group_run(green_loop_group_t group)
+{
+    if (group == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(group->refs > 0);
+    // Workers can't nest.
+    if (group->running || (green_current_worker != NULL)) {
+        return GREEN_EBUSY;
+    }
+    group->running = 1;
+
+    // The calling thread runs the first loop.  Run with fewer threads if some
+    // of them can't be created.
+    for (size_t i = 1; i < group->size; ++i) {
+        struct green_worker * worker = &group->workers[i];
+        worker->started = (pthread_create(&worker->thread, NULL,
+                                          green_worker_main, worker) == 0);
+    }
+    green_worker_main(&group->workers[0]);
+    for (size_t i = 1; i < group->size; ++i) {
+        struct green_worker * worker = &group->workers[i];
+        if (worker->started) {
+            pthread_join(worker->thread, NULL);
+            worker->started = 0;
+        }
+    }
+
+    group->running = 0;
+    return GREEN_SUCCESS;
+}
+
+green_loop_t _green_yield_any(green_loop_t loop, const char * source)
+{
+    if ((loop == NULL) || (loop->currentcoro == NULL)) {
+        return NULL;
+    }
+    green_coroutine_t coro = loop->currentcoro;
+    green_assert(coro->state == running);
+
+    // Coroutines on the shared stack or in a task group are tied to their
+    // loop, and so are all coroutines outside loop groups.
+    coro->migratable = (loop->worker != NULL) && !coro->shared &&
+                       (coro->group == NULL);
+    if (coro->migratable) {
+        ++loop->ready.migratable;
+    }
+    green_ready_push(loop, coro);
+    green_suspend(loop, source);
+
+    // NOTE: `loop` is stale if the coroutine moved.
+    if (coro->migratable) {
+        coro->migratable = 0;
+        --coro->loop->ready.migratable;
+    }
+    return coro->loop;
+}
+
+int green_coroutine_result(green_coroutine_t coro)
+{
+    green_assert(coro != NULL);
+    green_assert(coro->state == stopped);
+    return coro->result;
+}
+
+int green_coroutine_acquire(green_coroutine_t coro)
+{
+    green_assert(coro != NULL);
     ++coro->refs;
     return GREEN_SUCCESS;
 }
 
-int green_coroutine_release(green_coroutine_t coro)
+int green_coroutine_release(green_coroutine_t coro)
+{
+    green_assert(coro != NULL);
+    green_assert(coro->loop != NULL);
+    if (--coro->refs == 0) {
+        green_loop_t loop = coro->loop;
+        --loop->coroutines;
+        green_registry_unlink(loop, coro);
+        // NOTE: coroutines that never finished didn't clear their values.
+        green_cls_free(coro);
+        green_account(loop, GREEN_MEMORY_COROUTINES, 0, -1);
+        green_account(loop, GREEN_MEMORY_STACKS, 0, -1);
+        if ((coro->bucket < 0) || (loop->cache.high == 0)) {
+            green_coroutine_destroy(coro);
+            return GREEN_SUCCESS;
+        }
+        coro->next = loop->cache.buckets[coro->bucket];
+        loop->cache.buckets[coro->bucket] = coro;
+        if (++loop->cache.size > loop->cache.high) {
+            green_loop_trim_cache(loop, loop->cache.low);
+        }
+    }
+    return GREEN_SUCCESS;
+}
+
+// Coroutine-local storage.  Keys are shared by all loops and are never
+// deleted, so a key is just an index and a lookup is a single load.
+static void (*green_cls_destructors[GREEN_CLS_KEYS])(void*);
+static int green_cls_keys = 0;
+
+int green_cls_key_create(green_cls_key_t * key, void(*destructor)(void*))
+{
+    if (key == NULL) {
+        return GREEN_EINVAL;
+    }
+    int k = __atomic_load_n(&green_cls_keys, __ATOMIC_RELAXED);
+    do {
+        if (k >= GREEN_CLS_KEYS) {
+            return GREEN_EAGAIN;
+        }
+    }
+    while (!__atomic_compare_exchange_n(&green_cls_keys, &k, k + 1, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    __atomic_store_n(&green_cls_destructors[k], destructor, __ATOMIC_RELEASE);
+    *key = k;
+    return GREEN_SUCCESS;
+}
+
+static int green_cls_valid(green_loop_t loop, green_cls_key_t key)
+{
+    return (loop != NULL) && (loop->currentcoro != NULL) && (key >= 0) &&
+           (key < __atomic_load_n(&green_cls_keys, __ATOMIC_RELAXED));
+}
+
+void * green_cls_get(green_loop_t loop, green_cls_key_t key)
+{
+    if (!green_cls_valid(loop, key)) {
+        return NULL;
+    }
+    green_coroutine_t coro = loop->currentcoro;
+    if (key < GREEN_CLS_INLINE) {
+        return coro->cls.values[key];
+    }
+    const size_t index = (size_t)(key - GREEN_CLS_INLINE);
+    return (index < coro->cls.size)? coro->cls.overflow[index] : NULL;
+}
+
+int green_cls_set(green_loop_t loop, green_cls_key_t key, void * value)
+{
+    if (!green_cls_valid(loop, key)) {
+        return GREEN_EINVAL;
+    }
+    green_coroutine_t coro = loop->currentcoro;
+    if (key < GREEN_CLS_INLINE) {
+        coro->cls.values[key] = value;
+        return GREEN_SUCCESS;
+    }
+    const size_t index = (size_t)(key - GREEN_CLS_INLINE);
+    if (index >= coro->cls.size) {
+        if (value == NULL) {
+            return GREEN_SUCCESS;
+        }
+        size_t size = (coro->cls.size > 0)? coro->cls.size : GREEN_CLS_INLINE;
+        while (size <= index) {
+            size *= 2;
+        }
+        if (coro->cls.overflow) {
+            coro->cls.overflow = green_realloc(coro->cls.overflow,
+                                               size * sizeof(void*));
+        }
+        else {
+            coro->cls.overflow = green_malloc(loop, GREEN_MEMORY_COROUTINES,
+                                              size * sizeof(void*));
+        }
+        coro->cls.size = size;
+    }
+    coro->cls.overflow[index] = value;
+    return GREEN_SUCCESS;
+}
+
+// Free the values that don't fit inline.
+static void green_cls_free(green_coroutine_t coro)
+{
+    if (coro->cls.overflow) {
+        green_free(coro->cls.overflow);
+        coro->cls.overflow = NULL;
+        coro->cls.size = 0;
+    }
+}
+
+// Run destructors for values left when the coroutine returns.
+static void green_cls_clear(green_coroutine_t coro)
+{
+    const int keys = __atomic_load_n(&green_cls_keys, __ATOMIC_RELAXED);
+    for (int key = 0; key < keys; ++key) {
+        void ** slot = NULL;
+        if (key < GREEN_CLS_INLINE) {
+            slot = &coro->cls.values[key];
+        }
+        else if ((size_t)(key - GREEN_CLS_INLINE) < coro->cls.size) {
+            slot = &coro->cls.overflow[key - GREEN_CLS_INLINE];
+        }
+        else {
+            break;
+        }
+        void * value = *slot;
+        if (value == NULL) {
+            continue;
+        }
+        // NOTE: the destructor may look at (or set) other values.
+        *slot = NULL;
+        void (*destructor)(void*) =
+            __atomic_load_n(&green_cls_destructors[key], __ATOMIC_ACQUIRE);
+        if (destructor) {
+            (*destructor)(value);
+        }
+    }
+    green_cls_free(coro);
+}
+
+static void green_poller_swap(green_poller_t poller, int lhs, int rhs)
+{
+    if (lhs == rhs) {
+        return;
+    }
+    green_future_t f1 = poller->futures[lhs];
+    green_future_t f2 = poller->futures[rhs];
+    green_assert(f1->slot == lhs);
+    green_assert(f2->slot == rhs);
+    poller->futures[lhs] = f2, f2->slot = lhs;
+    poller->futures[rhs] = f1, f1->slot = rhs;
+}
+
+green_poller_t green_poller_init(green_loop_t loop, size_t size)
+{
+    if ((loop == NULL) || (size == 0)) {
+        return NULL;
+    }
+    green_assert(loop->refs > 0);
+
+    green_poller_t poller = green_pool_alloc(&loop->poller_pool);
+    green_account(loop, GREEN_MEMORY_POLLERS, 0, 1);
+    green_loop_acquire(loop);
+    poller->loop = loop;
+    poller->refs = 1;
+    poller->futures = green_malloc(loop, GREEN_MEMORY_POLLERS,
+                                   size * sizeof(green_future_t));
+    poller->size = size;
+
+    return poller;
+}
+
+size_t green_poller_size(green_poller_t poller)
+{
+    if (poller == NULL) {
+        return 0;
+    }
+    green_assert(poller->loop != NULL);
+    green_assert(poller->size >= poller->used);
+    green_assert(poller->used >= poller->busy);
+    return poller->size;
+}
+
+size_t green_poller_used(green_poller_t poller)
+{
+    if (poller == NULL) {
+        return 0;
+    }
+    green_assert(poller->loop != NULL);
+    green_assert(poller->size >= poller->used);
+    green_assert(poller->used >= poller->busy);
+    return poller->used;
+}
+
+size_t green_poller_done(green_poller_t poller)
+{
+    if (poller == NULL) {
+        return 0;
+    }
+    green_assert(poller->loop != NULL);
+    green_assert(poller->size >= poller->used);
+    green_assert(poller->used >= poller->busy);
+    return poller->used - poller->busy;
+}
+
+// Make room for `count` more futures.  Capacity doubles so that adding
+// futures one at a time takes amortized constant time.
+static int green_poller_reserve(green_poller_t poller, size_t count)
+{
+    // Slots are stored as `int` in futures.
+    if (count > (size_t)INT_MAX - poller->used) {
+        return GREEN_ENFILE;
+    }
+    if (poller->used + count <= poller->size) {
+        return GREEN_SUCCESS;
+    }
+    size_t size = poller->size;
+    while (size < poller->used + count) {
+        size = (size > (size_t)INT_MAX / 2)? (size_t)INT_MAX : 2 * size;
+    }
+    poller->futures = green_realloc(poller->futures,
+                                    size * sizeof(green_future_t));
+    poller->size = size;
+    return GREEN_SUCCESS;
+}
+
+static void green_poller_insert(green_poller_t poller, green_future_t future)
+{
+    green_trace(poller->loop, GREEN_TRACE_POLLERS, GREEN_TRACE_POLLER_ADD,
+                NULL, (uintptr_t)future);
+    green_future_acquire(future);
+    ++poller->loop->stats.poller_adds;
+    poller->futures[poller->used] = future;
+    future->slot = poller->used++;
+    future->poller = poller;
+    if (future->state == green_future_pending) {
+        green_poller_swap(poller, future->slot, poller->busy++);
+    }
+}
+
+int green_poller_acquire(green_poller_t poller)
+{
+    if (poller == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(poller->refs > 0);
+    ++poller->refs;
+    return GREEN_SUCCESS;
+}
+
+int green_poller_release(green_poller_t poller)
+{
+    if (poller == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(poller->refs > 0);
+    if (--poller->refs == 0) {
+        for (int i = 0; i < poller->used; ++i) {
+            poller->futures[i]->poller = NULL;
+            poller->futures[i]->slot = -1;
+            green_future_release(poller->futures[i]);
+            poller->futures[i] = NULL;
+        }
+        green_free(poller->futures);
+        poller->futures = NULL;
+        green_loop_t loop = poller->loop;
+        poller->loop = NULL;
+        green_pool_free(&loop->poller_pool, poller);
+        green_account(loop, GREEN_MEMORY_POLLERS, 0, -1);
+        green_loop_release(loop);
+    }
+    return GREEN_SUCCESS;
+}
+
+int green_poller_add(green_poller_t poller, green_future_t future)
+{
+    // Check for required arguments.
+    if ((poller == NULL) || (future == NULL)) {
+        return GREEN_EINVAL;
+    }
+
+    // Event loop must match.
+    if (future->loop != poller->loop) {
+        return GREEN_EINVAL;
+    }
+
+    // Future cannot be registered twice.
+    if (future->poller != NULL) {
+        return GREEN_EALREADY;
+    }
+
+    green_assert(poller->refs > 0);
+    green_assert(future->refs > 0);
+    green_assert(future->slot < 0);
+    green_assert(poller->used <= poller->size);
+
+    // Grow as needed.
+    const int error = green_poller_reserve(poller, 1);
+    if (error != GREEN_SUCCESS) {
+        return error;
+    }
+
+    green_poller_insert(poller, future);
+    return GREEN_SUCCESS;
+}
+
+int green_poller_add_many(green_poller_t poller,
+                          green_future_t * futures, size_t size)
+{
+    // Check for required arguments.
+    if ((poller == NULL) || ((futures == NULL) && (size > 0))) {
+        return GREEN_EINVAL;
+    }
+    green_assert(poller->refs > 0);
+
+    // Check all futures before adding any.  Futures are marked as they are
+    // checked so that duplicates within the batch are caught too.
+    int error = GREEN_SUCCESS;
+    size_t i = 0;
+    for (; i < size; ++i) {
+        if ((futures[i] == NULL) || (futures[i]->loop != poller->loop)) {
+            error = GREEN_EINVAL; break;
+        }
+        if (futures[i]->poller != NULL) {
+            error = GREEN_EALREADY; break;
+        }
+        futures[i]->poller = poller;
+    }
+    if (error == GREEN_SUCCESS) {
+        error = green_poller_reserve(poller, size);
+    }
+    while (i > 0) {
+        futures[--i]->poller = NULL;
+    }
+    if (error != GREEN_SUCCESS) {
+        return error;
+    }
+
+    for (i = 0; i < size; ++i) {
+        green_assert(futures[i]->refs > 0);
+        green_assert(futures[i]->slot < 0);
+        green_poller_insert(poller, futures[i]);
+    }
+    return GREEN_SUCCESS;
+}
+
+static void green_poller_remove(green_poller_t poller, green_future_t future)
+{
+    green_assert(poller->refs > 0);
+    green_assert(future->refs > 0);
+    green_assert(poller->loop == future->loop);
+    green_assert(future->poller == poller);
+    green_assert(future->slot >= 0);
+
+    if (future->slot >= poller->busy) {
+        green_assert(future->state != green_future_pending);
+        green_poller_swap(poller, future->slot, poller->used-1);
+    }
+    else {
+        green_assert(future->state == green_future_pending);
+        green_poller_swap(poller, future->slot, --poller->busy);
+        green_poller_swap(poller, poller->busy, poller->used-1);
+    }
+    future->slot = -1;
+    future->poller = NULL;
+    poller->futures[--poller->used] = NULL;
+    green_future_release(future);
+}
+
+int green_poller_rem(green_poller_t poller, green_future_t future)
+{
+    if ((poller == NULL) || (future == NULL)) {
+        return GREEN_EINVAL;
+    }
+    if (future->poller != poller) {
+        return GREEN_ENOENT;
+    }
+    green_trace(poller->loop, GREEN_TRACE_POLLERS, GREEN_TRACE_POLLER_REM,
+                NULL, (uintptr_t)future);
+    green_poller_remove(poller, future);
+    return GREEN_SUCCESS;
+}
+
+// Cancel all pending futures, which also removes them from the poller.
+static void green_poller_cancel(green_poller_t poller)
+{
+    while (poller->busy > 0) {
+        green_future_cancel(poller->futures[0]);
+    }
+}
+
+green_future_t green_poller_pop(green_poller_t poller)
+{
+    if (poller == NULL) {
+        return NULL;
+    }
+    if ((poller->used == 0) || (poller->busy == poller->used)) {
+        return NULL;
+    }
+    green_future_t f = poller->futures[poller->busy];
+    green_trace(poller->loop, GREEN_TRACE_POLLERS, GREEN_TRACE_POLLER_POP,
+                NULL, (uintptr_t)f);
+    ++poller->loop->stats.poller_pops;
+    green_poller_remove(poller, f);
+    return f;
+}
+
+size_t green_poller_pop_many(green_poller_t poller,
+                             green_future_t * futures, size_t size)
+{
+    if ((poller == NULL) || (futures == NULL)) {
+        return 0;
+    }
+    green_assert(poller->refs > 0);
+    green_assert(poller->used >= poller->busy);
+
+    // Completed futures sit at the end of the set, so take them from the
+    // end: nothing needs to move.
+    size_t n = poller->used - poller->busy;
+    if (n > size) {
+        n = size;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        green_future_t f = poller->futures[--poller->used];
+        green_assert(f->state != green_future_pending);
+        green_trace(poller->loop, GREEN_TRACE_POLLERS,
+                    GREEN_TRACE_POLLER_POP, NULL, (uintptr_t)f);
+        poller->futures[poller->used] = NULL;
+        f->slot = -1;
+        f->poller = NULL;
+        green_future_release(f);
+        futures[i] = f;
+    }
+    poller->loop->stats.poller_pops += n;
+    return n;
+}
+
+green_future_t green_future_init(green_loop_t loop)
+{
+    if (loop == NULL) {
+        return NULL;
+    }
+    green_future_t future = green_pool_alloc(&loop->future_pool);
+    green_account(loop, GREEN_MEMORY_FUTURES, 0, 1);
+    ++loop->stats.futures_created;
+    green_loop_acquire(loop);
+    future->loop = loop;
+    future->state = green_future_pending;
+    future->refs = 1;
+    future->slot = -1;
+    return future;
+}
+
+int green_future_acquire(green_future_t future)
+{
+    if (future == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(future != NULL);
+    green_assert(future->refs > 0);
+    ++future->refs;
+    return GREEN_SUCCESS;
+}
+
+int green_future_release(green_future_t future)
+{
+    if (future == NULL) {
+        return GREEN_EINVAL;
+    }
+    // NOTE: async operations hold an implicit ref count, so there is no risk
+    //       of async operations dereferencing a dangling pointer when
+    //       attempting to resolve the future.
+    green_assert(future != NULL);
+    green_assert(future->refs > 0);
+    if (--future->refs == 0) {
+        green_assert(future->poller == NULL);
+        green_loop_t loop = future->loop;
+        green_pool_free(&loop->future_pool, future);
+        green_account(loop, GREEN_MEMORY_FUTURES, 0, -1);
+        green_loop_release(loop);
+    }
+    return GREEN_SUCCESS;
+}
+
+int green_future_done(green_future_t future)
+{
+    if (future == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(future->refs > 0);
+    return future->state != green_future_pending;
+}
+
+int green_future_canceled(green_future_t future)
+{
+    if (future == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(future->refs > 0);
+    return future->state == green_future_aborted;
+}
+
+static int green_future_resolve(green_future_t future,
+                                green_future_state_t state, void * p, int i)
+{
+    if (future == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(future->refs > 0);
+
+    if (future->state == green_future_aborted) {
+        return GREEN_ECANCELED;
+    }
+    if (future->state != green_future_pending) {
+        return GREEN_EBADFD;
+    }
+
+    // Store result.
+    future->result.i = i;
+    future->result.p = p;
+
+    // Mark as complete (or failed).
+    future->state = state;
+    ++future->loop->stats.futures_completed;
+    green_trace(future->loop, GREEN_TRACE_FUTURES, GREEN_TRACE_COMPLETE,
+                NULL, (uintptr_t)future);
+
+    // Restore poller invariant.
+    if (future->poller) {
+        green_poller_t poller = future->poller;
+        green_poller_swap(poller, future->slot, --poller->busy);
+
+        // Resume coroutine blocked on poller, if any.
+        if (poller->waiter) {
+            green_ready_push(poller->loop, poller->waiter);
+            poller->waiter = NULL;
+        }
+    }
+
+    return GREEN_SUCCESS;
+}
+
+int green_future_set_result(green_future_t future, void * p, int i)
+{
+    return green_future_resolve(future, green_future_complete, p, i);
+}
+
+int green_future_set_error(green_future_t future, int error)
+{
+    if (error == GREEN_SUCCESS) {
+        return GREEN_EINVAL;
+    }
+    return green_future_resolve(future, green_future_failed, NULL, error);
+}
+
+int green_future_result(green_future_t future, void ** p, int * i)
+{
+    if (future == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(future->refs > 0);
+
+    if (future->state == green_future_pending) {
+        return GREEN_EBUSY;
+    }
+    if (future->state == green_future_aborted) {
+        return GREEN_EBADFD;
+    }
+    if (future->state == green_future_failed) {
+        return future->result.i;
+    }
+    if (p) {
+        *p = future->result.p;
+    }
+    if (i) {
+        *i = future->result.i;
+    }
+    return GREEN_SUCCESS;
+}
+
+int green_future_cancel(green_future_t future)
+{
+    // NOTE: when the async operation completes, the attempt to resolve the
+    //       future will may omit to post a completion notification if it is
+    //       possible to do so.  However, it's also possible that the
+    //       completion notification is already in flight.  In that case, the
+    //       coroutine that wakes up should also avoid to return control to
+    //       application code as a result of the completion notification for a
+    //       canceled future.
+    if (future == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(future->refs > 0);
+    if (future->state != green_future_pending) {
+        return GREEN_EBADFD;
+    }
+    // Canceled futures are never returned by `green_select()`.
+    if (future->poller) {
+        green_poller_remove(future->poller, future);
+    }
+    future->state = green_future_aborted;
+    ++future->loop->stats.futures_canceled;
+    green_trace(future->loop, GREEN_TRACE_FUTURES, GREEN_TRACE_CANCEL,
+                NULL, (uintptr_t)future);
+#if GREEN_USE_IO_URING
+    if (future->uring) {
+        green_uring_cancel(future->loop, future);
+    }
+#endif
+    // Leave the reactor right away, so that it doesn't keep the loop alive.
+    if (future->reactor.waiting) {
+        struct green_fd * entry = &future->loop->reactor.fds[future->reactor.fd];
+        green_future_release(green_fd_take(future->loop, future->reactor.write?
+                                           &entry->writer : &entry->reader));
+    }
+    // Stop the timer right away, the wheel's reference goes with it.
+    if (future->timer) {
+        green_loop_t loop = future->loop;
+        green_timer_stop(loop, future->timer);
+        green_pool_free(&loop->timer_pool, future->timer);
+        green_account(loop, GREEN_MEMORY_TIMERS, 0, -1);
+        future->timer = NULL;
+        green_future_release(future);
+    }
+    return GREEN_SUCCESS;
+}
+
+int green_future_share(green_future_t future)
+{
+    if (future == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(future->refs > 0);
+    int share = green_share_free;
+    if (!__atomic_compare_exchange_n(&future->remote.share, &share,
+                                     green_share_shared, 0, __ATOMIC_RELEASE,
+                                     __ATOMIC_RELAXED)) {
+        return GREEN_EALREADY;
+    }
+    ++future->refs;
+    ++future->loop->remote.pending;
+    return GREEN_SUCCESS;
+}
+
+int green_future_set_result_threadsafe(green_future_t future, void * p, int i)
+{
+    if (future == NULL) {
+        return GREEN_EINVAL;
+    }
+    // Only one result per share, since the future is the queue node.
+    int share = green_share_shared;
+    if (!__atomic_compare_exchange_n(&future->remote.share, &share,
+                                     green_share_posted, 0, __ATOMIC_ACQUIRE,
+                                     __ATOMIC_RELAXED)) {
+        return GREEN_EINVAL;
+    }
+    // NOTE: the future belongs to another thread, so all we can touch is the
+    //       remote result and the loop's queue.
+    green_loop_t loop = future->loop;
+    future->remote.p = p;
+    future->remote.i = i;
+    green_future_t head = __atomic_load_n(&loop->remote.head,
+                                          __ATOMIC_RELAXED);
+    do {
+        future->remote.next = head;
+    }
+    while (!__atomic_compare_exchange_n(&loop->remote.head, &head, future, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+    // Only pay for a system call if the loop is blocked.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&loop->wake.idle, __ATOMIC_RELAXED)) {
+        green_loop_wake(loop);
+    }
+    return GREEN_SUCCESS;
+}
+
+// Complete all futures posted from other threads, in order.
+static void green_loop_drain(green_loop_t loop)
+{
+    green_future_t future = __atomic_exchange_n(&loop->remote.head, NULL,
+                                                __ATOMIC_ACQUIRE);
+    green_future_t queue = NULL;
+    while (future) {
+        green_future_t next = future->remote.next;
+        future->remote.next = queue;
+        queue = future;
+        future = next;
+    }
+    while (queue) {
+        future = queue;
+        queue = future->remote.next;
+        future->remote.next = NULL;
+        __atomic_store_n(&future->remote.share, green_share_free,
+                         __ATOMIC_RELAXED);
+        --loop->remote.pending;
+        // NOTE: the result of a canceled future is simply dropped.
+        green_future_set_result(future, future->remote.p, future->remote.i);
+        green_future_release(future);
+    }
+}
+
+// Offload pool.  A fixed set of threads shared by all loops runs blocking
+// calls from a bounded FIFO queue.  Threads are started on first use and
+// stopped by `green_term()`.
+static const size_t DEFAULT_OFFLOAD_THREADS = 4;
+static const size_t DEFAULT_OFFLOAD_DEPTH = 1024;
+
+struct green_job {
+    int(*method)(void*);
+    void * object;
+    green_future_t future;
+};
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int started;
+    int stopping;
+
+    size_t threads;
+    pthread_t * workers;
+    size_t running;
+
+    // Queue of jobs that no thread picked up yet.
+    size_t depth;
+    struct green_job * jobs;
+    size_t head;
+    size_t used;
+} green_offload_pool = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0,
+    0, NULL, 0, 0, NULL, 0, 0,
+};
+
+static void * green_offload_main(void * object)
+{
+    pthread_mutex_lock(&green_offload_pool.lock);
+    for (;;) {
+        while ((green_offload_pool.used == 0) && !green_offload_pool.stopping) {
+            pthread_cond_wait(&green_offload_pool.ready,
+                              &green_offload_pool.lock);
+        }
+        // NOTE: queued jobs still run when stopping, since loops wait for
+        //       their futures.
+        if (green_offload_pool.used == 0) {
+            break;
+        }
+        struct green_job job = green_offload_pool.jobs[green_offload_pool.head];
+        green_offload_pool.head =
+            (green_offload_pool.head + 1) % green_offload_pool.depth;
+        --green_offload_pool.used;
+        pthread_mutex_unlock(&green_offload_pool.lock);
+
+        int result = job.method(job.object);
+        green_future_set_result_threadsafe(job.future, job.object, result);
+
+        pthread_mutex_lock(&green_offload_pool.lock);
+    }
+    pthread_mutex_unlock(&green_offload_pool.lock);
+    return NULL;
+}
+
+// Start the threads.  Called with the lock held.
+static int green_offload_start()
+{
+    if (green_offload_pool.threads == 0) {
+        green_offload_pool.threads = DEFAULT_OFFLOAD_THREADS;
+        green_offload_pool.depth = DEFAULT_OFFLOAD_DEPTH;
+    }
+    green_offload_pool.jobs = green_malloc(
+        NULL, GREEN_MEMORY_OTHER,
+        green_offload_pool.depth * sizeof(struct green_job));
+    green_offload_pool.workers = green_malloc(
+        NULL, GREEN_MEMORY_OTHER,
+        green_offload_pool.threads * sizeof(pthread_t));
+    green_offload_pool.head = 0;
+    green_offload_pool.used = 0;
+    green_offload_pool.running = 0;
+    for (size_t i = 0; i < green_offload_pool.threads; ++i) {
+        if (pthread_create(&green_offload_pool.workers[i], NULL,
+                           green_offload_main, NULL) != 0) {
+            break;
+        }
+        ++green_offload_pool.running;
+    }
+    // Run with fewer threads if some of them can't be created.
+    if (green_offload_pool.running == 0) {
+        green_free(green_offload_pool.workers);
+        green_free(green_offload_pool.jobs);
+        green_offload_pool.workers = NULL;
+        green_offload_pool.jobs = NULL;
+        return 0;
+    }
+    green_offload_pool.started = 1;
+    return 1;
+}
+
+static void green_offload_stop()
+{
+    pthread_mutex_lock(&green_offload_pool.lock);
+    if (!green_offload_pool.started) {
+        pthread_mutex_unlock(&green_offload_pool.lock);
+        return;
+    }
+    green_offload_pool.stopping = 1;
+    pthread_cond_broadcast(&green_offload_pool.ready);
+    pthread_mutex_unlock(&green_offload_pool.lock);
+    for (size_t i = 0; i < green_offload_pool.running; ++i) {
+        pthread_join(green_offload_pool.workers[i], NULL);
+    }
+    green_free(green_offload_pool.workers);
+    green_free(green_offload_pool.jobs);
+    green_offload_pool.workers = NULL;
+    green_offload_pool.jobs = NULL;
+    green_offload_pool.running = 0;
+    green_offload_pool.started = 0;
+    green_offload_pool.stopping = 0;
+}
+
+int green_offload_configure(size_t threads, size_t depth)
+{
+    if ((threads == 0) || (depth == 0)) {
+        return GREEN_EINVAL;
+    }
+    pthread_mutex_lock(&green_offload_pool.lock);
+    if (green_offload_pool.started) {
+        pthread_mutex_unlock(&green_offload_pool.lock);
+        return GREEN_EBUSY;
+    }
+    green_offload_pool.threads = threads;
+    green_offload_pool.depth = depth;
+    pthread_mutex_unlock(&green_offload_pool.lock);
+    return GREEN_SUCCESS;
+}
+
+green_future_t green_offload(green_loop_t loop,
+                             int(*method)(void*), void * object)
+{
+    if ((loop == NULL) || (method == NULL)) {
+        return NULL;
+    }
+    green_assert(loop->refs > 0);
+    green_future_t future = green_future_init(loop);
+
+    pthread_mutex_lock(&green_offload_pool.lock);
+    if (!green_offload_pool.started && !green_offload_start()) {
+        pthread_mutex_unlock(&green_offload_pool.lock);
+        green_future_set_error(future, GREEN_ENOMEM);
+        return future;
+    }
+    // Never block the loop, let the caller decide what to do instead.
+    if (green_offload_pool.used == green_offload_pool.depth) {
+        pthread_mutex_unlock(&green_offload_pool.lock);
+        green_future_set_error(future, GREEN_EAGAIN);
+        return future;
+    }
+    green_future_share(future);
+    const size_t tail = (green_offload_pool.head + green_offload_pool.used) %
+                        green_offload_pool.depth;
+    green_offload_pool.jobs[tail].method = method;
+    green_offload_pool.jobs[tail].object = object;
+    green_offload_pool.jobs[tail].future = future;
+    ++green_offload_pool.used;
+    pthread_cond_signal(&green_offload_pool.ready);
+    pthread_mutex_unlock(&green_offload_pool.lock);
+    return future;
+}
+
+// Watchdog.  One thread checks all loops that have a watchdog and reports
+// coroutines that hold their loop for too long.  It is started on first use
+// and stopped by `green_term()`.
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    int started;
+    int stopping;
+    green_loop_t loops;
+
+    // Backtrace request: where the signal handler writes, and whether it
+    // is done.
+    int fd;
+    int done;
+
+    pthread_t thread;
+} green_watchdog = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0, 0,
+    NULL, -1, 0,
+};
+
+#if GREEN_USE_BACKTRACE
+static void green_watchdog_backtrace(int signal)
+{
+    const int error = errno;
+    void * frames[64];
+    const int fd = __atomic_load_n(&green_watchdog.fd, __ATOMIC_ACQUIRE);
+    const int count = backtrace(frames, 64);
+    backtrace_symbols_fd(frames, count, fd);
+    __atomic_store_n(&green_watchdog.done, 1, __ATOMIC_RELEASE);
+    errno = error;
+}
+#endif
+
+// Report the coroutine that holds `loop`, if it held it for too long and
+// was not reported yet.  Called with the lock held.
+static void green_watchdog_check(green_loop_t loop, int64_t now)
+{
+    const int64_t since = __atomic_load_n(&loop->watchdog.since,
+                                          __ATOMIC_ACQUIRE);
+    if ((since == 0) || (since == loop->watchdog.reported) ||
+        (now - since < loop->watchdog.threshold)) {
+        return;
+    }
+    const int id = __atomic_load_n(&loop->watchdog.id, __ATOMIC_RELAXED);
+    const char * source = __atomic_load_n(&loop->watchdog.source,
+                                          __ATOMIC_RELAXED);
+    pthread_t thread;
+    __atomic_load(&loop->watchdog.thread, &thread, __ATOMIC_RELAXED);
+    // NOTE: the loop may have switched to another coroutine while we read.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&loop->watchdog.since, __ATOMIC_RELAXED) != since) {
+        return;
+    }
+    loop->watchdog.reported = since;
+
+    char line[256];
+    const int size = snprintf(line, sizeof(line),
+        "green: coroutine %d has held the loop for %lld ms (since %s)\n",
+        id, (long long)((now - since) / 1000000), source);
+    if (write(loop->watchdog.fd, line, (size_t)size) < 0) {
+        return;
+    }
+#if GREEN_USE_BACKTRACE
+    // Interrupt the loop's thread so that it prints its own stack, but
+    // don't wait for long: it may have signals blocked.
+    if (loop->watchdog.signal != 0) {
+        __atomic_store_n(&green_watchdog.done, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&green_watchdog.fd, loop->watchdog.fd,
+                         __ATOMIC_RELEASE);
+        if (pthread_kill(thread, loop->watchdog.signal) == 0) {
+            for (int i = 0; i < 100; ++i) {
+                if (__atomic_load_n(&green_watchdog.done, __ATOMIC_ACQUIRE)) {
+                    break;
+                }
+                poll(NULL, 0, 1);
+            }
+        }
+    }
+#else
+    (void)thread;
+#endif
+}
+
+static void * green_watchdog_main(void * object)
+{
+    pthread_mutex_lock(&green_watchdog.lock);
+    while (!green_watchdog.stopping) {
+        // Check about four times per threshold, so that stalls are reported
+        // when they are at most 25% longer than the threshold.
+        int64_t interval = 100000000;
+        for (green_loop_t loop = green_watchdog.loops; loop;
+             loop = loop->watchdog.next) {
+            if (loop->watchdog.threshold / 4 < interval) {
+                interval = loop->watchdog.threshold / 4;
+            }
+        }
+        if (interval < 1000000) {
+            interval = 1000000;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += interval / 1000000000;
+        deadline.tv_nsec += interval % 1000000000;
+        if (deadline.tv_nsec >= 1000000000) {
+            deadline.tv_nsec -= 1000000000;
+            ++deadline.tv_sec;
+        }
+        pthread_cond_timedwait(&green_watchdog.wake, &green_watchdog.lock,
+                               &deadline);
+
+        const int64_t now = green_now();
+        for (green_loop_t loop = green_watchdog.loops; loop;
+             loop = loop->watchdog.next) {
+            green_watchdog_check(loop, now);
+        }
+    }
+    pthread_mutex_unlock(&green_watchdog.lock);
+    return NULL;
+}
+
+static void green_watchdog_stop()
+{
+    pthread_mutex_lock(&green_watchdog.lock);
+    if (!green_watchdog.started) {
+        pthread_mutex_unlock(&green_watchdog.lock);
+        return;
+    }
+    green_watchdog.stopping = 1;
+    pthread_cond_broadcast(&green_watchdog.wake);
+    pthread_mutex_unlock(&green_watchdog.lock);
+    pthread_join(green_watchdog.thread, NULL);
+    green_watchdog.started = 0;
+    green_watchdog.stopping = 0;
+}
+
+// Unlink `loop` from the watchdog.  Called with the lock held.
+static void green_watchdog_unlink(green_loop_t loop)
+{
+    for (green_loop_t * link = &green_watchdog.loops; *link;
+         link = &(*link)->watchdog.next) {
+        if (*link == loop) {
+            *link = loop->watchdog.next;
+            break;
+        }
+    }
+    loop->watchdog.next = NULL;
+    loop->watchdog.enabled = 0;
+    __atomic_store_n(&loop->watchdog.since, 0, __ATOMIC_RELAXED);
+}
+
+static void green_watchdog_remove(green_loop_t loop)
+{
+    pthread_mutex_lock(&green_watchdog.lock);
+    green_watchdog_unlink(loop);
+    pthread_mutex_unlock(&green_watchdog.lock);
+}
+
+int green_loop_watchdog(green_loop_t loop, int64_t threshold,
+                        int fd, int signal)
+{
+    if (loop == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    if (threshold <= 0) {
+        if (loop->watchdog.enabled) {
+            green_watchdog_remove(loop);
+        }
+        return GREEN_SUCCESS;
+    }
+    if ((fd < 0) || (signal < 0)) {
+        return GREEN_EINVAL;
+    }
+#if GREEN_USE_BACKTRACE
+    if (signal != 0) {
+        // NOTE: the first call loads the unwinder, which is not safe to do
+        //       from a signal handler.
+        void * frame = NULL;
+        backtrace(&frame, 1);
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = green_watchdog_backtrace;
+        action.sa_flags = SA_RESTART;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(signal, &action, NULL) != 0) {
+            return GREEN_EINVAL;
+        }
+    }
+#else
+    if (signal != 0) {
+        return GREEN_EINVAL;
+    }
+#endif
+
+    pthread_mutex_lock(&green_watchdog.lock);
+    if (!green_watchdog.started) {
+        if (pthread_create(&green_watchdog.thread, NULL,
+                           green_watchdog_main, NULL) != 0) {
+            pthread_mutex_unlock(&green_watchdog.lock);
+            return GREEN_ENOMEM;
+        }
+        green_watchdog.started = 1;
+    }
+    if (!loop->watchdog.enabled) {
+        loop->watchdog.next = green_watchdog.loops;
+        green_watchdog.loops = loop;
+        loop->watchdog.enabled = 1;
+    }
+    loop->watchdog.threshold = threshold;
+    loop->watchdog.fd = fd;
+    loop->watchdog.signal = signal;
+    pthread_cond_broadcast(&green_watchdog.wake);
+    pthread_mutex_unlock(&green_watchdog.lock);
+    return GREEN_SUCCESS;
+}
+
+// Coroutine registry.
+green_coroutine_t green_loop_next_coroutine(green_loop_t loop,
+                                            green_coroutine_t coro)
+{
+    if (loop == NULL) {
+        return NULL;
+    }
+    green_assert(loop->refs > 0);
+    if (coro == NULL) {
+        return loop->registry.head;
+    }
+    green_assert(coro->loop == loop);
+    return coro->registry_next;
+}
+
+int green_coroutine_info(green_coroutine_t coro,
+                         green_coroutine_info_t * info)
+{
+    if ((coro == NULL) || (info == NULL)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(coro->refs > 0);
+    memset(info, 0, sizeof(*info));
+    info->id = coro->id;
+    // NOTE: public constants follow the order of `green_coroutine_state_t`.
+    info->state = (int)coro->state;
+    info->ready = coro->ready;
+    info->switched = coro->switched;
+    info->source = coro->source;
+    info->origin = coro->origin;
+    if (coro->blocked_poller) {
+        // Name the future too when there is only one to wait for.
+        green_poller_t poller = coro->blocked_poller;
+        info->poller = poller;
+        if (poller->busy == 1) {
+            info->future = poller->futures[0];
+        }
+    }
+    else if (coro->blocked_wait) {
+        info->waiting = 1;
+    }
+    else if ((coro->state == blocked) && (coro->timer.slot >= 0)) {
+        info->sleeping = 1;
+    }
+    return GREEN_SUCCESS;
+}
+
+static const char * green_coroutine_state_name(
+    const green_coroutine_info_t * info)
+{
+    switch (info->state) {
+    case GREEN_COROUTINE_PENDING:
+        return "pending";
+    case GREEN_COROUTINE_RUNNING:
+        return "running";
+    case GREEN_COROUTINE_BLOCKED:
+        return info->ready? "ready" : "blocked";
+    default:
+        return "stopped";
+    }
+}
+
+int green_loop_dump(green_loop_t loop, FILE * file)
+{
+    if ((loop == NULL) || (file == NULL)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    const int64_t now = green_now();
+    fprintf(file, "green: %d coroutines (%zu ready)\n",
+            loop->coroutines, loop->ready.size);
+    for (green_coroutine_t coro = loop->registry.head; coro;
+         coro = coro->registry_next) {
+        green_coroutine_info_t info;
+        green_coroutine_info(coro, &info);
+        fprintf(file, "  coroutine %d: %s for %lld ms at %s (spawned at %s)",
+                info.id, green_coroutine_state_name(&info),
+                (long long)((now - info.switched) / 1000000),
+                info.source, info.origin);
+        if (info.future) {
+            fprintf(file, ", select on future %p", (void*)info.future);
+        }
+        else if (info.poller) {
+            fprintf(file, ", select on poller %p", (void*)info.poller);
+        }
+        else if (info.waiting) {
+            fprintf(file, ", waiting on a channel, lock or task group");
+        }
+        else if (info.sleeping) {
+            fprintf(file, ", sleeping");
+        }
+        fprintf(file, "\n");
+    }
+    return (fflush(file) == 0)? GREEN_SUCCESS : GREEN_EBADFD;
+}
+
+// Times each signal was caught, by signal number.  The handler only counts,
+// loops dump at their next iteration.
+static int green_dump_requests[NSIG];
+
+static void green_dump_signal(int signal)
+{
+    __atomic_add_fetch(&green_dump_requests[signal], 1, __ATOMIC_RELAXED);
+}
+
+static void green_dump_check(green_loop_t loop)
+{
+    const int seen = __atomic_load_n(&green_dump_requests[loop->dump.signal],
+                                     __ATOMIC_RELAXED);
+    if (seen != loop->dump.seen) {
+        loop->dump.seen = seen;
+        green_loop_dump(loop, loop->dump.file);
+    }
+}
+
+int green_loop_dump_on_signal(green_loop_t loop, int signal, FILE * file)
+{
+    if ((loop == NULL) || (signal < 0) || (signal >= NSIG)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(loop->refs > 0);
+    if (signal == 0) {
+        loop->dump.signal = 0;
+        loop->dump.file = NULL;
+        return GREEN_SUCCESS;
+    }
+    if (file == NULL) {
+        return GREEN_EINVAL;
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = green_dump_signal;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(signal, &action, NULL) != 0) {
+        return GREEN_EINVAL;
+    }
+    loop->dump.seen = __atomic_load_n(&green_dump_requests[signal],
+                                      __ATOMIC_RELAXED);
+    loop->dump.signal = signal;
+    loop->dump.file = file;
+    return GREEN_SUCCESS;
+}
+
+green_future_t _green_select_ex(green_poller_t poller, int64_t timeout,
+                                const char * source)
+{
+    if (poller == NULL) {
+        return NULL;
+    }
+    green_assert(poller->refs > 0);
+    green_loop_t loop = poller->loop;
+    green_future_t timer = NULL;
+    int armed = 0;
+    int busy = 0;
+    int64_t blocked = 0;
+
+    // Members of a canceled task group don't wait for anything.
+    if (green_coroutine_canceled(loop->currentcoro)) {
+        green_poller_cancel(poller);
+    }
+
+    while (poller->busy == poller->used) {
+        // Nothing could ever complete.
+        if ((poller->used == 0) || (timeout == 0)) {
+            break;
+        }
+
+        // When called from the loop itself, run coroutines until one of them
+        // completes a future.
+        if (loop->currentcoro == NULL) {
+            if ((timeout > 0) && (timer == NULL)) {
+                timer = green_timer_future(loop, green_now() + timeout);
+            }
+            if ((timer && green_future_done(timer)) ||
+                !green_loop_alive(loop)) {
+                break;
+            }
+            green_loop_run_once(loop);
+            continue;
+        }
+
+        // Timed out on last wake-up.
+        if (armed && (loop->currentcoro->timer.slot < 0)) {
+            armed = 0;
+            break;
+        }
+        if ((timeout > 0) && !armed) {
+            green_timer_start(loop, green_now() + timeout, poller);
+            armed = 1;
+        }
+
+        // Only one coroutine can wait on a poller at a time.
+        if (poller->waiter != NULL) {
+            busy = 1;
+            break;
+        }
+
+        // Block until `green_future_set_result()` or the timer puts us back
+        // in the ready queue.  The future may be removed before we get to
+        // run, and an explicit `green_yield()` may resume us early, so check
+        // again after waking up.
+        if (blocked == 0) {
+            blocked = green_now();
+        }
+        poller->waiter = loop->currentcoro;
+        loop->currentcoro->blocked_poller = poller;
+        green_suspend(loop, source);
+        loop->currentcoro->blocked_poller = NULL;
+        if (poller->waiter == loop->currentcoro) {
+            poller->waiter = NULL;
+        }
+    }
+
+    if (timer) {
+        green_future_cancel(timer);
+        green_future_release(timer);
+    }
+    if (armed) {
+        green_timer_stop(loop, &loop->currentcoro->timer);
+    }
+    if (blocked != 0) {
+        ++loop->stats.blocked[green_stats_bucket(green_now() - blocked)];
+    }
+    return busy? NULL : green_poller_pop(poller);
+}
+
+green_future_t _green_select(green_poller_t poller, const char * source)
+{
+    return _green_select_ex(poller, -1, source);
+}
+
+// Channels.  Messages are moved by value through a ring buffer.  When a
+// receiver is already waiting, a send hands the message off directly, and
+// when a sender is waiting on a full channel, a receive refills the buffer
+// from it, so the order of messages is preserved.
+
+static void green_wait_push(struct green_wait_queue * queue,
+                            struct green_wait * wait)
+{
+    wait->next = NULL;
+    wait->queue = queue;
+    if (queue->tail) {
+        queue->tail->next = wait;
+    }
+    else {
+        queue->head = wait;
+    }
+    queue->tail = wait;
+}
+
+// End a wait with a message (or an error).
+static void green_wait_finish(green_loop_t loop, struct green_wait * wait,
+                              void * p, int i, int status)
+{
+    if (wait->future) {
+        if (status == GREEN_SUCCESS) {
+            green_future_set_result(wait->future, p, i);
+        }
+        else {
+            green_future_set_error(wait->future, status);
+        }
+        green_future_release(wait->future);
+        green_pool_free(&loop->wait_pool, wait);
+        return;
+    }
+    wait->p = p;
+    wait->i = i;
+    wait->status = status;
+    wait->done = 1;
+    // NOTE: the loop itself may be waiting, see `green_wait_block()`.
+    if (wait->coro) {
+        green_ready_push(loop, wait->coro);
+    }
+}
+
+// Get the first wait that is still current.  Futures canceled while they
+// wait are dropped here rather than when they are canceled.
+static struct green_wait * green_wait_pop(green_loop_t loop,
+                                          struct green_wait_queue * queue)
+{
+    while (queue->head) {
+        struct green_wait * wait = queue->head;
+        queue->head = wait->next;
+        if (queue->head == NULL) {
+            queue->tail = NULL;
+        }
+        wait->queue = NULL;
+        if (wait->future &&
+            (wait->future->state == green_future_aborted)) {
+            green_future_release(wait->future);
+            green_pool_free(&loop->wait_pool, wait);
+            continue;
+        }
+        return wait;
+    }
+    return NULL;
+}
+
+// Messages already sent can still be received, but nothing else will come
+// in.
+static void green_channel_shutdown(green_channel_t channel)
+{
+    green_loop_t loop = channel->loop;
+    struct green_wait * wait = NULL;
+    channel->closed = 1;
+    while ((wait = green_wait_pop(loop, &channel->receivers))) {
+        green_wait_finish(loop, wait, NULL, 0, GREEN_EPIPE);
+    }
+    while ((wait = green_wait_pop(loop, &channel->senders))) {
+        green_wait_finish(loop, wait, NULL, 0, GREEN_EPIPE);
+    }
+}
+
+// Withdraw a wait that is not over.
+static int green_wait_unlink(struct green_wait_queue * queue,
+                             struct green_wait * wait)
+{
+    struct green_wait * prev = NULL;
+    for (struct green_wait * w = queue->head; w; prev = w, w = w->next) {
+        if (w != wait) {
+            continue;
+        }
+        if (prev) {
+            prev->next = w->next;
+        }
+        else {
+            queue->head = w->next;
+        }
+        if (queue->tail == w) {
+            queue->tail = prev;
+        }
+        w->queue = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+// Block until `wait` is over.  When called from the loop itself, run
+// coroutines in the meantime and give up with `GREEN_EBUSY` once nothing is
+// left to run, in which case the caller must withdraw `wait`.  Members of a
+// canceled task group give up with `GREEN_ECANCELED` unless `shielded`.
+static int green_wait_block(green_loop_t loop, struct green_wait * wait,
+                            int shielded, const char * source)
+{
+    wait->coro = loop->currentcoro;
+    if (!shielded && green_coroutine_canceled(wait->coro)) {
+        return GREEN_ECANCELED;
+    }
+    while (!wait->done) {
+        // NOTE: an explicit `green_yield()` may resume us early.
+        if (wait->coro) {
+            wait->coro->blocked_wait = shielded? NULL : wait;
+            green_suspend(loop, source);
+            wait->coro->blocked_wait = NULL;
+            continue;
+        }
+        if (!green_loop_alive(loop)) {
+            return GREEN_EBUSY;
+        }
+        const int rc = green_loop_run_once(loop);
+        if (rc != GREEN_SUCCESS) {
+            return rc;
+        }
+    }
+    return wait->status;
+}
+
+// Waits live on the stack of the waiting coroutine, except for coroutines
+// on the shared stack: their frames are moved off the stack while they are
+// blocked, so their waits come from the pool instead.
+static struct green_wait * green_wait_open(green_loop_t loop,
+                                           struct green_wait * local)
+{
+    if (loop->currentcoro && loop->currentcoro->shared) {
+        return green_pool_alloc(&loop->wait_pool);
+    }
+    return local;
+}
+
+static void green_wait_close(green_loop_t loop, struct green_wait * wait,
+                             struct green_wait * local)
+{
+    if (wait != local) {
+        green_pool_free(&loop->wait_pool, wait);
+    }
+}
+
+green_channel_t green_channel_init(green_loop_t loop, size_t size)
+{
+    if (loop == NULL) {
+        return NULL;
+    }
+    green_assert(loop->refs > 0);
+
+    green_channel_t channel = green_malloc(loop, GREEN_MEMORY_OTHER,
+                                           sizeof(struct green_channel));
+    green_loop_acquire(loop);
+    channel->loop = loop;
+    channel->refs = 1;
+    if (size > 0) {
+        channel->messages = green_malloc(loop, GREEN_MEMORY_OTHER,
+                                         size * sizeof(*channel->messages));
+    }
+    channel->size = size;
+    return channel;
+}
+
+size_t green_channel_size(green_channel_t channel)
+{
+    if (channel == NULL) {
+        return 0;
+    }
+    green_assert(channel->refs > 0);
+    return channel->size;
+}
+
+size_t green_channel_used(green_channel_t channel)
+{
+    if (channel == NULL) {
+        return 0;
+    }
+    green_assert(channel->refs > 0);
+    green_assert(channel->used <= channel->size);
+    return channel->used;
+}
+
+int green_channel_close(green_channel_t channel)
+{
+    if (channel == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(channel->refs > 0);
+    if (channel->closed) {
+        return GREEN_EALREADY;
+    }
+    green_channel_shutdown(channel);
+    return GREEN_SUCCESS;
+}
+
+int green_channel_acquire(green_channel_t channel)
 {
-    green_assert(coro != NULL);
-    green_assert(coro->loop != NULL);
-    if (--coro->refs == 0) {
-#if GREEN_USE_UCONTEXT
-        green_assert(coro->stack != NULL);
-        green_free(coro->stack);
-        coro->stack = NULL;
-#endif
-        --coro->loop->coroutines;
-        green_free(coro);
+    if (channel == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(channel->refs > 0);
+    ++channel->refs;
+    return GREEN_SUCCESS;
+}
+
+int green_channel_release(green_channel_t channel)
+{
+    if (channel == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(channel->refs > 0);
+    if (--channel->refs > 0) {
+        return GREEN_SUCCESS;
+    }
+    // NOTE: blocked coroutines hold a reference, so only futures can still
+    //       be waiting.  They fail as if the channel was closed.
+    green_channel_shutdown(channel);
+    green_assert(channel->senders.head == NULL);
+    green_assert(channel->receivers.head == NULL);
+    green_loop_t loop = channel->loop;
+    if (channel->messages) {
+        green_free(channel->messages);
+    }
+    green_free(channel);
+    green_loop_release(loop);
+    return GREEN_SUCCESS;
+}
+
+// Send without blocking.  Returns `GREEN_EAGAIN` if the channel is full.
+static int green_channel_try_send(green_channel_t channel, void * p, int i)
+{
+    if (channel->closed) {
+        return GREEN_EPIPE;
+    }
+    struct green_wait * wait = green_wait_pop(channel->loop,
+                                              &channel->receivers);
+    if (wait) {
+        green_assert(channel->used == 0);
+        green_wait_finish(channel->loop, wait, p, i, GREEN_SUCCESS);
+        return GREEN_SUCCESS;
+    }
+    if (channel->used == channel->size) {
+        return GREEN_EAGAIN;
     }
+    const size_t tail = (channel->head + channel->used++) % channel->size;
+    channel->messages[tail].p = p;
+    channel->messages[tail].i = i;
     return GREEN_SUCCESS;
 }
 
-static void green_poller_dump(green_poller_t poller)
+// Receive without blocking.  Returns `GREEN_EAGAIN` if the channel is empty.
+static int green_channel_try_recv(green_channel_t channel,
+                                  void ** p, int * i)
 {
-    static const char* states[] = {
-        "pending",
-        "aborted",
-        "complete",
-    };
-    fprintf(stderr, "poller @ 0x%p, size=%zu, used=%zu, busy=%zu:\n",
-            poller, poller->size, poller->used, poller->busy);
-    int w = (int)ceil(log10((double)poller->size));
-    for (size_t i = 0; (i < poller->size); ++i) {
-        green_future_t f = poller->futures[i];
-        if (i == 0) {
-            fprintf(stderr, "  --busy--\n");
+    green_loop_t loop = channel->loop;
+    struct green_wait * wait = green_wait_pop(loop, &channel->senders);
+    if (channel->used > 0) {
+        *p = channel->messages[channel->head].p;
+        *i = channel->messages[channel->head].i;
+        channel->head = (channel->head + 1) % channel->size;
+        --channel->used;
+        // Make room for the first blocked sender.
+        if (wait) {
+            green_channel_try_send(channel, wait->p, wait->i);
+            green_wait_finish(loop, wait, wait->p, wait->i, GREEN_SUCCESS);
         }
-        if (i == poller->busy) {
-            fprintf(stderr, "  --done--\n");
+        return GREEN_SUCCESS;
+    }
+    if (wait) {
+        // Unbuffered channel: take the message from the sender.
+        *p = wait->p;
+        *i = wait->i;
+        green_wait_finish(loop, wait, wait->p, wait->i, GREEN_SUCCESS);
+        return GREEN_SUCCESS;
+    }
+    return channel->closed? GREEN_EPIPE : GREEN_EAGAIN;
+}
+
+// Block the current coroutine until `wait` is over.
+static int green_channel_wait(green_channel_t channel,
+                              struct green_wait_queue * queue,
+                              struct green_wait * wait, const char * source)
+{
+    green_wait_push(queue, wait);
+    green_channel_acquire(channel);
+    const int rc = green_wait_block(channel->loop, wait, 0, source);
+    if (!wait->done) {
+        green_wait_unlink(queue, wait);
+    }
+    green_channel_release(channel);
+    return rc;
+}
+
+int _green_channel_send(green_channel_t channel, void * p, int i,
+                        const char * source)
+{
+    if (channel == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(channel->refs > 0);
+    int rc = green_channel_try_send(channel, p, i);
+    if (rc != GREEN_EAGAIN) {
+        return rc;
+    }
+
+    // When called from the loop itself, run coroutines until the message
+    // goes through.
+    green_loop_t loop = channel->loop;
+    if (loop->currentcoro == NULL) {
+        green_future_t future = green_channel_send_future(channel, p, i);
+        rc = green_loop_run_until(loop, future);
+        if (rc == GREEN_SUCCESS) {
+            rc = green_future_result(future, NULL, NULL);
         }
-        if (i == poller->used) {
-            fprintf(stderr, "  --free--\n");
+        else {
+            green_future_cancel(future);
         }
-        if (f) {
-            fprintf(stderr, "  %*zu => (%*d) %p (%s)\n",
-                    w, i, w, f->slot, f, states[f->state]);
+        green_future_release(future);
+        return rc;
+    }
+
+    struct green_wait local = {0};
+    struct green_wait * wait = green_wait_open(loop, &local);
+    wait->p = p;
+    wait->i = i;
+    rc = green_channel_wait(channel, &channel->senders, wait, source);
+    green_wait_close(loop, wait, &local);
+    return rc;
+}
+
+int _green_channel_recv(green_channel_t channel, void ** p, int * i,
+                        const char * source)
+{
+    if (channel == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(channel->refs > 0);
+    void * _p = NULL;
+    int _i = 0;
+    int rc = green_channel_try_recv(channel, &_p, &_i);
+    if (rc == GREEN_EAGAIN) {
+        green_loop_t loop = channel->loop;
+        if (loop->currentcoro == NULL) {
+            green_future_t future = green_channel_recv_future(channel);
+            rc = green_loop_run_until(loop, future);
+            if (rc == GREEN_SUCCESS) {
+                rc = green_future_result(future, &_p, &_i);
+            }
+            else {
+                green_future_cancel(future);
+            }
+            green_future_release(future);
         }
         else {
-            fprintf(stderr, "  %*zu => null\n", w, i);
+            struct green_wait local = {0};
+            struct green_wait * wait = green_wait_open(loop, &local);
+            rc = green_channel_wait(channel, &channel->receivers,
+                                    wait, source);
+            _p = wait->p;
+            _i = wait->i;
+            green_wait_close(loop, wait, &local);
+        }
+    }
+    if (rc == GREEN_SUCCESS) {
+        if (p) {
+            *p = _p;
+        }
+        if (i) {
+            *i = _i;
         }
     }
-    fprintf(stderr, "  --------\n");
+    return rc;
 }
 
-static void green_poller_swap(green_poller_t poller, int lhs, int rhs)
+green_future_t green_channel_send_future(green_channel_t channel,
+                                         void * p, int i)
 {
-    fprintf(stderr, "swapping %d and %d.\n", lhs, rhs);
-    if (lhs == rhs) {
-        return;
+    if (channel == NULL) {
+        return NULL;
     }
-    green_poller_dump(poller);
-    green_future_t f1 = poller->futures[lhs];
-    green_future_t f2 = poller->futures[rhs];
-    green_assert(f1->slot == lhs);
-    green_assert(f2->slot == rhs);
-    poller->futures[lhs] = f2, f2->slot = lhs;
-    poller->futures[rhs] = f1, f1->slot = rhs;
-    green_poller_dump(poller);
+    green_assert(channel->refs > 0);
+    green_loop_t loop = channel->loop;
+    green_future_t future = green_future_init(loop);
+    const int rc = green_channel_try_send(channel, p, i);
+    if (rc == GREEN_SUCCESS) {
+        green_future_set_result(future, p, i);
+    }
+    else if (rc != GREEN_EAGAIN) {
+        green_future_set_error(future, rc);
+    }
+    else {
+        struct green_wait * wait = green_pool_alloc(&loop->wait_pool);
+        wait->future = future;
+        wait->p = p;
+        wait->i = i;
+        green_future_acquire(future);
+        green_wait_push(&channel->senders, wait);
+    }
+    return future;
 }
 
-green_poller_t green_poller_init(green_loop_t loop, size_t size)
+green_future_t green_channel_recv_future(green_channel_t channel)
 {
-    if ((loop == NULL) || (size == 0)) {
+    if (channel == NULL) {
+        return NULL;
+    }
+    green_assert(channel->refs > 0);
+    green_loop_t loop = channel->loop;
+    green_future_t future = green_future_init(loop);
+    void * p = NULL;
+    int i = 0;
+    const int rc = green_channel_try_recv(channel, &p, &i);
+    if (rc == GREEN_SUCCESS) {
+        green_future_set_result(future, p, i);
+    }
+    else if (rc != GREEN_EAGAIN) {
+        green_future_set_error(future, rc);
+    }
+    else {
+        struct green_wait * wait = green_pool_alloc(&loop->wait_pool);
+        wait->future = future;
+        green_future_acquire(future);
+        green_wait_push(&channel->receivers, wait);
+    }
+    return future;
+}
+
+// Synchronization primitives.  Waits live on the stack of the blocked
+// coroutine, and releasing a primitive hands it to the first waiter before
+// waking it up, so a coroutine that runs in the meantime can't barge in.
+
+struct green_mutex {
+    green_loop_t loop;
+    int refs;
+    int locked;
+    green_coroutine_t owner;
+    struct green_wait_queue waiters;
+};
+
+struct green_cond {
+    green_loop_t loop;
+    int refs;
+    struct green_wait_queue waiters;
+};
+
+struct green_sem {
+    green_loop_t loop;
+    int refs;
+    size_t count;
+    struct green_wait_queue waiters;
+};
+
+struct green_waitgroup {
+    green_loop_t loop;
+    int refs;
+    size_t count;
+    struct green_wait_queue waiters;
+};
+
+// Sync objects share allocation and reference counting: they all start with
+// the loop and the reference count.
+struct green_sync {
+    green_loop_t loop;
+    int refs;
+};
+
+static void * green_sync_init(green_loop_t loop, size_t size)
+{
+    if (loop == NULL) {
         return NULL;
     }
     green_assert(loop->refs > 0);
+    struct green_sync * sync = green_malloc(loop, GREEN_MEMORY_OTHER, size);
+    green_loop_acquire(loop);
+    sync->loop = loop;
+    sync->refs = 1;
+    return sync;
+}
 
-    green_poller_t poller = green_malloc(sizeof(struct green_poller));
-    poller->loop = loop;
-    poller->refs = 1;
-    poller->futures = green_malloc(size * sizeof(green_future_t));
-    poller->size = size;
+static int green_sync_acquire(struct green_sync * sync)
+{
+    if (sync == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(sync->refs > 0);
+    ++sync->refs;
+    return GREEN_SUCCESS;
+}
 
-    return poller;
+static int green_sync_release(struct green_sync * sync,
+                              struct green_wait_queue * waiters)
+{
+    if (sync == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(sync->refs > 0);
+    if (--sync->refs > 0) {
+        return GREEN_SUCCESS;
+    }
+    // NOTE: blocked coroutines hold a reference.
+    green_assert(waiters->head == NULL);
+    green_loop_t loop = sync->loop;
+    green_free(sync);
+    green_loop_release(loop);
+    return GREEN_SUCCESS;
+}
+
+green_mutex_t green_mutex_init(green_loop_t loop)
+{
+    return green_sync_init(loop, sizeof(struct green_mutex));
+}
+
+int green_mutex_acquire(green_mutex_t mutex)
+{
+    return green_sync_acquire((struct green_sync*)mutex);
+}
+
+int green_mutex_release(green_mutex_t mutex)
+{
+    return green_sync_release((struct green_sync*)mutex,
+                              mutex? &mutex->waiters : NULL);
+}
+
+int green_mutex_trylock(green_mutex_t mutex)
+{
+    if (mutex == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(mutex->refs > 0);
+    if (mutex->locked) {
+        return GREEN_EBUSY;
+    }
+    mutex->locked = 1;
+    mutex->owner = mutex->loop->currentcoro;
+    return GREEN_SUCCESS;
+}
+
+static int green_mutex_lock_ex(green_mutex_t mutex, int shielded,
+                               const char * source)
+{
+    green_loop_t loop = mutex->loop;
+    if (!mutex->locked) {
+        mutex->locked = 1;
+        mutex->owner = loop->currentcoro;
+        return GREEN_SUCCESS;
+    }
+    if (mutex->owner == loop->currentcoro) {
+        return GREEN_EALREADY;
+    }
+
+    struct green_wait local = {0};
+    struct green_wait * wait = green_wait_open(loop, &local);
+    green_wait_push(&mutex->waiters, wait);
+    green_mutex_acquire(mutex);
+    const int rc = green_wait_block(loop, wait, shielded, source);
+    if (!wait->done) {
+        green_wait_unlink(&mutex->waiters, wait);
+    }
+    green_wait_close(loop, wait, &local);
+    green_mutex_release(mutex);
+    return rc;
+}
+
+int _green_mutex_lock(green_mutex_t mutex, const char * source)
+{
+    if (mutex == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(mutex->refs > 0);
+    return green_mutex_lock_ex(mutex, 0, source);
+}
+
+// Give the mutex to the first waiter, if any.
+static void green_mutex_handoff(green_mutex_t mutex)
+{
+    struct green_wait * wait = green_wait_pop(mutex->loop, &mutex->waiters);
+    if (wait == NULL) {
+        mutex->locked = 0;
+        mutex->owner = NULL;
+        return;
+    }
+    mutex->owner = wait->coro;
+    green_wait_finish(mutex->loop, wait, NULL, 0, GREEN_SUCCESS);
+}
+
+int green_mutex_unlock(green_mutex_t mutex)
+{
+    if (mutex == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(mutex->refs > 0);
+    if (!mutex->locked || (mutex->owner != mutex->loop->currentcoro)) {
+        return GREEN_EBADFD;
+    }
+    green_mutex_handoff(mutex);
+    return GREEN_SUCCESS;
+}
+
+green_cond_t green_cond_init(green_loop_t loop)
+{
+    return green_sync_init(loop, sizeof(struct green_cond));
+}
+
+int green_cond_acquire(green_cond_t cond)
+{
+    return green_sync_acquire((struct green_sync*)cond);
+}
+
+int green_cond_release(green_cond_t cond)
+{
+    return green_sync_release((struct green_sync*)cond,
+                              cond? &cond->waiters : NULL);
+}
+
+int _green_cond_wait(green_cond_t cond, green_mutex_t mutex,
+                     const char * source)
+{
+    if ((cond == NULL) || (mutex == NULL) || (cond->loop != mutex->loop)) {
+        return GREEN_EINVAL;
+    }
+    green_assert(cond->refs > 0);
+    green_assert(mutex->refs > 0);
+    green_loop_t loop = cond->loop;
+    if (!mutex->locked || (mutex->owner != loop->currentcoro)) {
+        return GREEN_EBADFD;
+    }
+
+    // The wait remembers the mutex so that signaling can queue it on the
+    // mutex directly.  We get back with the mutex held.
+    struct green_wait local = {0};
+    struct green_wait * wait = green_wait_open(loop, &local);
+    wait->p = mutex;
+    green_wait_push(&cond->waiters, wait);
+    green_cond_acquire(cond);
+    green_mutex_acquire(mutex);
+    green_mutex_handoff(mutex);
+    const int rc = green_wait_block(loop, wait, 0, source);
+    if (!wait->done) {
+        // NOTE: the mutex is not held in this case.  The wait may already
+        //       have moved to the mutex.
+        green_wait_unlink(wait->queue, wait);
+    }
+    green_wait_close(loop, wait, &local);
+    if (rc == GREEN_ECANCELED) {
+        // Callers expect to unlock the mutex on the way out, so take it back
+        // even though the group is canceled.
+        green_mutex_lock_ex(mutex, 1, source);
+    }
+    green_mutex_release(mutex);
+    green_cond_release(cond);
+    return rc;
+}
+
+// Move the first waiter to the mutex, so that it only wakes up once it
+// holds the mutex.
+static int green_cond_wake(green_cond_t cond)
+{
+    struct green_wait * wait = green_wait_pop(cond->loop, &cond->waiters);
+    if (wait == NULL) {
+        return 0;
+    }
+    green_mutex_t mutex = wait->p;
+    if (mutex->locked) {
+        green_wait_push(&mutex->waiters, wait);
+    }
+    else {
+        mutex->locked = 1;
+        mutex->owner = wait->coro;
+        green_wait_finish(cond->loop, wait, mutex, 0, GREEN_SUCCESS);
+    }
+    return 1;
+}
+
+int green_cond_signal(green_cond_t cond)
+{
+    if (cond == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(cond->refs > 0);
+    green_cond_wake(cond);
+    return GREEN_SUCCESS;
 }
 
-size_t green_poller_size(green_poller_t poller)
+int green_cond_broadcast(green_cond_t cond)
 {
-    if (poller == NULL) {
-        return 0;
+    if (cond == NULL) {
+        return GREEN_EINVAL;
     }
-    green_assert(poller->loop != NULL);
-    green_assert(poller->size >= poller->used);
-    green_assert(poller->used >= poller->busy);
-    return poller->size;
+    green_assert(cond->refs > 0);
+    while (green_cond_wake(cond)) {
+    }
+    return GREEN_SUCCESS;
 }
 
-size_t green_poller_used(green_poller_t poller)
+green_sem_t green_sem_init(green_loop_t loop, size_t count)
 {
-    if (poller == NULL) {
-        return 0;
+    green_sem_t sem = green_sync_init(loop, sizeof(struct green_sem));
+    if (sem) {
+        sem->count = count;
     }
-    green_assert(poller->loop != NULL);
-    green_assert(poller->size >= poller->used);
-    green_assert(poller->used >= poller->busy);
-    return poller->used;
+    return sem;
 }
 
-size_t green_poller_done(green_poller_t poller)
+int green_sem_acquire(green_sem_t sem)
 {
-    if (poller == NULL) {
+    return green_sync_acquire((struct green_sync*)sem);
+}
+
+int green_sem_release(green_sem_t sem)
+{
+    return green_sync_release((struct green_sync*)sem,
+                              sem? &sem->waiters : NULL);
+}
+
+size_t green_sem_value(green_sem_t sem)
+{
+    if (sem == NULL) {
         return 0;
     }
-    green_assert(poller->loop != NULL);
-    green_assert(poller->size >= poller->used);
-    green_assert(poller->used >= poller->busy);
-    return poller->used - poller->busy;
+    green_assert(sem->refs > 0);
+    return sem->count;
 }
 
-int green_poller_acquire(green_poller_t poller)
+int green_sem_trywait(green_sem_t sem)
 {
-    if (poller == NULL) {
+    if (sem == NULL) {
         return GREEN_EINVAL;
     }
-    green_assert(poller->refs > 0);
-    ++poller->refs;
+    green_assert(sem->refs > 0);
+    if (sem->count == 0) {
+        return GREEN_EBUSY;
+    }
+    --sem->count;
     return GREEN_SUCCESS;
 }
 
-int green_poller_release(green_poller_t poller)
+int _green_sem_wait(green_sem_t sem, const char * source)
 {
-    fprintf(stderr, "green_poller_release()\n");
-
-    if (poller == NULL) {
+    if (sem == NULL) {
         return GREEN_EINVAL;
     }
-    green_assert(poller->refs > 0);
-    if (--poller->refs == 0) {
-        for (int i = 0; i < poller->used; ++i) {
-            poller->futures[i]->poller = NULL;
-            poller->futures[i]->slot = -1;
-            green_future_release(poller->futures[i]);
-            poller->futures[i] = NULL;
-        }
-        green_free(poller->futures);
-        poller->futures = NULL;
-        poller->loop = NULL;
-        green_free(poller);
+    green_assert(sem->refs > 0);
+    if (sem->count > 0) {
+        --sem->count;
+        return GREEN_SUCCESS;
     }
-    return GREEN_SUCCESS;
+
+    struct green_wait local = {0};
+    struct green_wait * wait = green_wait_open(sem->loop, &local);
+    green_wait_push(&sem->waiters, wait);
+    green_sem_acquire(sem);
+    const int rc = green_wait_block(sem->loop, wait, 0, source);
+    if (!wait->done) {
+        green_wait_unlink(&sem->waiters, wait);
+    }
+    green_wait_close(sem->loop, wait, &local);
+    green_sem_release(sem);
+    return rc;
 }
 
-int green_poller_add(green_poller_t poller, green_future_t future)
+int green_sem_post(green_sem_t sem)
 {
-    fprintf(stderr, "green_poller_add()\n");
-
-    // Check for required arguments.
-    if ((poller == NULL) || (future == NULL)) {
+    if (sem == NULL) {
         return GREEN_EINVAL;
     }
-
-    // Event loop must match.
-    if (future->loop != poller->loop) {
-        return GREEN_EINVAL;
+    green_assert(sem->refs > 0);
+    // The unit goes straight to the first waiter.
+    struct green_wait * wait = green_wait_pop(sem->loop, &sem->waiters);
+    if (wait) {
+        green_wait_finish(sem->loop, wait, NULL, 0, GREEN_SUCCESS);
     }
-
-    // Future cannot be registered twice.
-    if (future->poller != NULL) {
-        return GREEN_EALREADY;
+    else {
+        ++sem->count;
     }
+    return GREEN_SUCCESS;
+}
 
-    // Cannot exceed maximum poller size.
-    if (poller->used == poller->size) {
-        return GREEN_ENFILE;
-    }
+green_waitgroup_t green_waitgroup_init(green_loop_t loop)
+{
+    return green_sync_init(loop, sizeof(struct green_waitgroup));
+}
 
-    green_assert(poller->refs > 0);
-    green_assert(future->refs > 0);
-    green_assert(future->slot < 0);
-    green_assert(poller->used >= 0);
-    green_assert(poller->used <= poller->size);
+int green_waitgroup_acquire(green_waitgroup_t group)
+{
+    return green_sync_acquire((struct green_sync*)group);
+}
 
-    green_poller_dump(poller);
+int green_waitgroup_release(green_waitgroup_t group)
+{
+    return green_sync_release((struct green_sync*)group,
+                              group? &group->waiters : NULL);
+}
 
-    green_future_acquire(future);
-    poller->futures[poller->used] = future;
-    future->slot = poller->used++;
-    future->poller = poller;
-    if (future->state == green_future_pending) {
-        green_poller_swap(poller, future->slot, poller->busy++);
+size_t green_waitgroup_count(green_waitgroup_t group)
+{
+    if (group == NULL) {
+        return 0;
     }
+    green_assert(group->refs > 0);
+    return group->count;
+}
 
+int green_waitgroup_add(green_waitgroup_t group, size_t count)
+{
+    if (group == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(group->refs > 0);
+    group->count += count;
     return GREEN_SUCCESS;
 }
 
-int green_poller_rem(green_poller_t poller, green_future_t future)
+int green_waitgroup_done(green_waitgroup_t group)
 {
-    fprintf(stderr, "green_poller_rem()\n");
-    if ((poller == NULL) || (future == NULL)) {
+    if (group == NULL) {
         return GREEN_EINVAL;
     }
-    if (future->poller != poller) {
-        return GREEN_ENOENT;
+    green_assert(group->refs > 0);
+    if (group->count == 0) {
+        return GREEN_EBADFD;
     }
-
-    green_assert(poller->refs > 0);
-    green_assert(future->refs > 0);
-    green_assert(poller->loop == future->loop);
-    green_assert(future->poller == poller);
-    green_assert(future->slot >= 0);
-
-    if (future->slot >= poller->busy) {
-        green_assert(future->state != green_future_pending);
-        green_poller_swap(poller, future->slot, poller->used-1);
+    if (--group->count > 0) {
+        return GREEN_SUCCESS;
     }
-    else {
-        green_assert(future->state == green_future_pending);
-        green_poller_swap(poller, future->slot, --poller->busy);
-        green_poller_swap(poller, poller->busy, poller->used-1);
+    struct green_wait * wait = NULL;
+    while ((wait = green_wait_pop(group->loop, &group->waiters))) {
+        green_wait_finish(group->loop, wait, NULL, 0, GREEN_SUCCESS);
     }
-    future->slot = -1;
-    future->poller = NULL;
-    poller->futures[--poller->used] = NULL;
-    green_future_release(future);
     return GREEN_SUCCESS;
 }
 
-green_future_t green_poller_pop(green_poller_t poller)
+int _green_waitgroup_wait(green_waitgroup_t group, const char * source)
 {
-    fprintf(stderr, "green_poller_pop()\n");
-
-    if (poller == NULL) {
-        return NULL;
+    if (group == NULL) {
+        return GREEN_EINVAL;
     }
-    green_poller_dump(poller);
-    if ((poller->used == 0) || (poller->busy == poller->used)) {
-        return NULL;
+    green_assert(group->refs > 0);
+    if (group->count == 0) {
+        return GREEN_SUCCESS;
     }
-    green_future_t f = poller->futures[poller->busy];
-    green_assert(green_poller_rem(poller, f) == 0);
-    return f;
+
+    struct green_wait local = {0};
+    struct green_wait * wait = green_wait_open(group->loop, &local);
+    green_wait_push(&group->waiters, wait);
+    green_waitgroup_acquire(group);
+    const int rc = green_wait_block(group->loop, wait, 0, source);
+    if (!wait->done) {
+        green_wait_unlink(&group->waiters, wait);
+    }
+    green_wait_close(group->loop, wait, &local);
+    green_waitgroup_release(group);
+    return rc;
 }
 
-green_future_t green_future_init(green_loop_t loop)
+// Task groups.  Canceling a group wakes up each member that is blocked, as
+// if what it was waiting on had failed, and makes any blocking call by a
+// member fail right away from then on.  Nested groups are canceled along
+// with their parent.
+
+green_taskgroup_t green_taskgroup_init(green_loop_t loop,
+                                       green_taskgroup_t parent)
 {
-    if (loop == NULL) {
+    if ((loop == NULL) || (parent && (parent->loop != loop))) {
         return NULL;
     }
-    green_future_t future = green_malloc(sizeof(struct green_future));
-    future->loop = loop;
-    future->state = green_future_pending;
-    future->refs = 1;
-    future->slot = -1;
-    return future;
+    green_assert(loop->refs > 0);
+    green_taskgroup_t group = green_malloc(loop, GREEN_MEMORY_OTHER,
+                                           sizeof(struct green_taskgroup));
+    green_loop_acquire(loop);
+    group->loop = loop;
+    group->refs = 1;
+    group->deadline = -1;
+    group->timer.slot = -1;
+    group->timer.group = group;
+    if (parent) {
+        green_taskgroup_acquire(parent);
+        group->parent = parent;
+        group->next = parent->children;
+        if (parent->children) {
+            parent->children->prev = group;
+        }
+        parent->children = group;
+        group->canceled = parent->canceled;
+    }
+    return group;
 }
 
-int green_future_acquire(green_future_t future)
+int green_taskgroup_acquire(green_taskgroup_t group)
 {
-    if (future == NULL) {
+    if (group == NULL) {
         return GREEN_EINVAL;
     }
-    green_assert(future != NULL);
-    green_assert(future->refs > 0);
-    ++future->refs;
+    green_assert(group->refs > 0);
+    ++group->refs;
     return GREEN_SUCCESS;
 }
 
-int green_future_release(green_future_t future)
+int green_taskgroup_release(green_taskgroup_t group)
 {
-    if (future == NULL) {
+    if (group == NULL) {
         return GREEN_EINVAL;
     }
-    fprintf(stderr, "green_future_release(%p, %d)\n", future, future->refs);
-    // NOTE: async operations hold an implicit ref count, so there is no risk
-    //       of async operations dereferencing a dangling pointer when
-    //       attempting to resolve the future.
-    green_assert(future != NULL);
-    green_assert(future->refs > 0);
-    if (--future->refs == 0) {
-        green_assert(future->poller == NULL);
-        green_free(future);
+    green_assert(group->refs > 0);
+    if (--group->refs > 0) {
+        return GREEN_SUCCESS;
+    }
+    // NOTE: members, children, joiners and the deadline timer all hold a
+    //       reference, so the group is idle at this point.
+    green_assert(group->size == 0);
+    green_assert(group->children == NULL);
+    green_assert(group->timer.slot < 0);
+    green_taskgroup_t parent = group->parent;
+    if (parent) {
+        if (group->prev) {
+            group->prev->next = group->next;
+        }
+        else {
+            parent->children = group->next;
+        }
+        if (group->next) {
+            group->next->prev = group->prev;
+        }
+    }
+    green_loop_t loop = group->loop;
+    green_free(group);
+    if (parent) {
+        green_taskgroup_release(parent);
     }
+    green_loop_release(loop);
     return GREEN_SUCCESS;
 }
 
-int green_future_done(green_future_t future)
+size_t green_taskgroup_size(green_taskgroup_t group)
 {
-    if (future == NULL) {
-        return GREEN_EINVAL;
+    if (group == NULL) {
+        return 0;
     }
-    green_assert(future->refs > 0);
-    return (future->state == green_future_complete) ||
-           (future->state == green_future_aborted);
+    green_assert(group->refs > 0);
+    return group->size;
 }
 
-int green_future_set_result(green_future_t future, void * p, int i)
+int green_taskgroup_canceled(green_taskgroup_t group)
 {
-    if (future == NULL) {
+    if (group == NULL) {
         return GREEN_EINVAL;
     }
-    green_assert(future->refs > 0);
+    green_assert(group->refs > 0);
+    return group->canceled;
+}
 
-    if (future->state == green_future_aborted) {
-        return GREEN_ECANCELED;
-    }
-    if (future->state == green_future_complete) {
-        return GREEN_EBADFD;
+green_taskgroup_t green_taskgroup_current(green_loop_t loop)
+{
+    if ((loop == NULL) || (loop->currentcoro == NULL)) {
+        return NULL;
     }
+    return loop->currentcoro->group;
+}
 
-    // Store result.
-    future->result.i = i;
-    future->result.p = p;
+// The deadline timer runs only while members are running.
+static void green_taskgroup_arm(green_taskgroup_t group)
+{
+    if ((group->deadline < 0) || (group->size == 0) || group->canceled ||
+        (group->timer.slot >= 0)) {
+        return;
+    }
+    // NOTE: the wheel holds a reference until the timer fires or stops.
+    green_taskgroup_acquire(group);
+    green_timer_arm(group->loop, &group->timer,
+                    (group->deadline + GREEN_TICK - 1) / GREEN_TICK);
+    ++group->loop->timers.size;
+}
 
-    // Mark as complete.
-    future->state = green_future_complete;
+static void green_taskgroup_disarm(green_taskgroup_t group)
+{
+    if (group->timer.slot >= 0) {
+        green_timer_stop(group->loop, &group->timer);
+        green_taskgroup_release(group);
+    }
+}
 
-    // Restore poller invariant.
-    if (future->poller) {
-        green_poller_swap(future->poller,
-                          future->slot, --future->poller->busy);
+// Wake up a member blocked on something, as if it failed.
+static void green_coroutine_interrupt(green_coroutine_t coro)
+{
+    green_loop_t loop = coro->loop;
+    if ((coro->state != blocked) || coro->ready) {
+        return;
+    }
+    if (coro->blocked_poller) {
+        green_poller_t poller = coro->blocked_poller;
+        green_poller_cancel(poller);
+        if (poller->waiter == coro) {
+            poller->waiter = NULL;
+            green_ready_push(loop, coro);
+        }
+    }
+    else if (coro->blocked_wait) {
+        struct green_wait * wait = coro->blocked_wait;
+        green_wait_unlink(wait->queue, wait);
+        green_wait_finish(loop, wait, NULL, 0, GREEN_ECANCELED);
+    }
+    else if (coro->timer.slot >= 0) {
+        // NOTE: the wheel may hold the last reference.
+        green_ready_push(loop, coro);
+        green_timer_stop(loop, &coro->timer);
+    }
+}
 
-        // TODO: resume coroutine blocked on poller, if any.
+static void green_taskgroup_interrupt(green_taskgroup_t group)
+{
+    group->canceled = 1;
+    green_taskgroup_disarm(group);
+    for (green_coroutine_t coro = group->members; coro;
+         coro = coro->group_next) {
+        green_coroutine_interrupt(coro);
+    }
+    for (green_taskgroup_t child = group->children; child;
+         child = child->next) {
+        if (!child->canceled) {
+            green_taskgroup_interrupt(child);
+        }
     }
+}
 
+int green_taskgroup_cancel(green_taskgroup_t group)
+{
+    if (group == NULL) {
+        return GREEN_EINVAL;
+    }
+    green_assert(group->refs > 0);
+    if (group->canceled) {
+        return GREEN_EALREADY;
+    }
+    green_taskgroup_acquire(group);
+    green_taskgroup_interrupt(group);
+    green_taskgroup_release(group);
     return GREEN_SUCCESS;
 }
 
-int green_future_result(green_future_t future, void ** p, int * i)
+static void green_taskgroup_expire(green_taskgroup_t group)
 {
-    if (future == NULL) {
+    if (!group->canceled) {
+        green_taskgroup_interrupt(group);
+    }
+    green_taskgroup_release(group);
+}
+
+int green_taskgroup_set_deadline(green_taskgroup_t group, int64_t deadline)
+{
+    if (group == NULL) {
         return GREEN_EINVAL;
     }
-    green_assert(future->refs > 0);
+    green_assert(group->refs > 0);
+    green_taskgroup_acquire(group);
+    green_taskgroup_disarm(group);
+    group->deadline = deadline;
+    green_taskgroup_arm(group);
+    green_taskgroup_release(group);
+    return GREEN_SUCCESS;
+}
 
-    if (future->state == green_future_pending) {
-        return GREEN_EBUSY;
+green_coroutine_t _green_taskgroup_spawn(green_taskgroup_t group,
+                                         int(*method)(green_loop_t,void*),
+                                         void * object, size_t stack_size,
+                                         const char * source)
+{
+    if ((group == NULL) || (method == NULL) || group->canceled) {
+        return NULL;
     }
-    if (future->state == green_future_aborted) {
-        return GREEN_EBADFD;
+    green_assert(group->refs > 0);
+    green_coroutine_t coro = _green_coroutine_init(
+        group->loop, method, object, stack_size, source);
+    if (coro == NULL) {
+        return NULL;
     }
-    if (p) {
-        *p = future->result.p;
+    green_taskgroup_acquire(group);
+    coro->group = group;
+    coro->group_prev = NULL;
+    coro->group_next = group->members;
+    if (group->members) {
+        group->members->group_prev = coro;
     }
-    if (i) {
-        *i = future->result.i;
+    group->members = coro;
+    ++group->size;
+    green_taskgroup_arm(group);
+    return coro;
+}
+
+static void green_taskgroup_leave(green_coroutine_t coro)
+{
+    green_taskgroup_t group = coro->group;
+    if (coro->group_prev) {
+        coro->group_prev->group_next = coro->group_next;
     }
-    return GREEN_SUCCESS;
+    else {
+        group->members = coro->group_next;
+    }
+    if (coro->group_next) {
+        coro->group_next->group_prev = coro->group_prev;
+    }
+    coro->group = NULL;
+    if (--group->size == 0) {
+        green_taskgroup_disarm(group);
+        struct green_wait * wait = NULL;
+        while ((wait = green_wait_pop(group->loop, &group->joiners))) {
+            green_wait_finish(group->loop, wait, NULL, 0, GREEN_SUCCESS);
+        }
+    }
+    green_taskgroup_release(group);
 }
 
-int green_future_cancel(green_future_t future)
+int _green_taskgroup_join(green_taskgroup_t group, const char * source)
 {
-    // NOTE: when the async operation completes, the attempt to resolve the
-    //       future will may omit to post a completion notification if it is
-    //       possible to do so.  However, it's also possible that the
-    //       completion notification is already in flight.  In that case, the
-    //       coroutine that wakes up should also avoid to return control to
-    //       application code as a result of the completion notification for a
-    //       canceled future.
-    if (future == NULL) {
+    if (group == NULL) {
         return GREEN_EINVAL;
     }
-    green_assert(future->refs > 0);
-    if (future->state != green_future_pending) {
-        return GREEN_EBADFD;
+    green_assert(group->refs > 0);
+    green_loop_t loop = group->loop;
+    if (loop->currentcoro && (loop->currentcoro->group == group)) {
+        return GREEN_EINVAL;
     }
-    future->state = green_future_aborted;
-    return GREEN_SUCCESS;
+
+    // NOTE: joining is not interrupted when the joiner's own group is
+    //       canceled, otherwise members could outlive the scope that owns
+    //       them.
+    int rc = GREEN_SUCCESS;
+    if (group->size > 0) {
+        struct green_wait local = {0};
+        struct green_wait * wait = green_wait_open(loop, &local);
+        green_wait_push(&group->joiners, wait);
+        green_taskgroup_acquire(group);
+        rc = green_wait_block(loop, wait, 1, source);
+        if (!wait->done) {
+            green_wait_unlink(&group->joiners, wait);
+        }
+        green_wait_close(loop, wait, &local);
+        green_taskgroup_release(group);
+    }
+    if ((rc == GREEN_SUCCESS) && group->canceled) {
+        rc = GREEN_ECANCELED;
+    }
+    return rc;
 }
@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+
+int mycoroutine(green_loop_t loop, void * object)
+{
+    return (int)(size_t)object;
+}
+
+static green_coroutine_t spawn(green_loop_t loop, size_t stack_size, int i)
+{
+    green_coroutine_t coro = green_coroutine_init(
+        loop, mycoroutine, (void*)(size_t)i, stack_size);
+    check_ne(coro, NULL);
+    check_eq(green_yield(loop, coro), 0);
+    check_eq(green_coroutine_result(coro), i);
+    return coro;
+}
+
+int test(green_loop_t loop)
+{
+    green_coroutine_t coro = NULL;
+    green_coroutine_t next = NULL;
+
+    // Methods are NULL-safe.
+    check_eq(green_loop_set_cache_limits(NULL, 0, 0), GREEN_EINVAL);
+    check_eq(green_loop_trim(NULL), GREEN_EINVAL);
+    check_eq(green_loop_cache_size(NULL), 0);
+
+    // Low watermark can't exceed high watermark.
+    check_eq(green_loop_set_cache_limits(loop, 2, 1), GREEN_EINVAL);
+    check_eq(green_loop_set_cache_limits(loop, 2, 4), 0);
+    check_eq(green_loop_cache_size(loop), 0);
+
+    // Released coroutines are recycled.
+    coro = spawn(loop, 0, 1);
+    check_eq(green_coroutine_release(coro), 0);
+    check_eq(green_loop_cache_size(loop), 1);
+    next = spawn(loop, 0, 2);
+    check_eq(next, coro);
+    check_eq(green_loop_cache_size(loop), 0);
+    check_eq(green_coroutine_release(next), 0);
+    check_eq(green_loop_cache_size(loop), 1);
+
+    // Only coroutines with a matching stack size are recycled.
+    next = spawn(loop, 1024 * 1024, 3);
+    check_ne(next, coro);
+    check_eq(green_loop_cache_size(loop), 1);
+    check_eq(green_coroutine_release(next), 0);
+    check_eq(green_loop_cache_size(loop), 2);
+
+    // Stack sizes are rounded up, so close sizes share a bucket.
+    coro = spawn(loop, 1000 * 1000, 4);
+    check_eq(coro, next);
+    check_eq(green_coroutine_release(coro), 0);
+    check_eq(green_loop_cache_size(loop), 2);
+
+    // Going over the high watermark trims down to the low watermark.
+    green_coroutine_t coros[5];
+    for (int i = 0; i < 5; ++i) {
+        coros[i] = spawn(loop, 16 * 1024, i);
+    }
+    for (int i = 0; i < 5; ++i) {
+        check_eq(green_coroutine_release(coros[i]), 0);
+        coros[i] = NULL;
+    }
+    check_le(green_loop_cache_size(loop), 4);
+    check_ge(green_loop_cache_size(loop), 2);
+
+    // Trim down to low watermark on demand.
+    check_eq(green_loop_set_cache_limits(loop, 0, 4), 0);
+    check_eq(green_loop_trim(loop), 0);
+    check_eq(green_loop_cache_size(loop), 0);
+
+    // Caching can be disabled.
+    check_eq(green_loop_set_cache_limits(loop, 0, 0), 0);
+    coro = spawn(loop, 0, 5);
+    check_eq(green_coroutine_release(coro), 0);
+    check_eq(green_loop_cache_size(loop), 0);
+
+    // Leave something in the cache for teardown.
+    check_eq(green_loop_set_cache_limits(loop, 1, 1), 0);
+    coro = spawn(loop, 0, 6);
+    check_eq(green_coroutine_release(coro), 0);
+    check_eq(green_loop_cache_size(loop), 1);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
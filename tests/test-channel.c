@@ -0,0 +1,174 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+
+#define MESSAGES 100
+
+static int values[MESSAGES];
+static int received = 0;
+
+int producer(green_loop_t loop, void * object)
+{
+    green_channel_t channel = object;
+    for (int i = 0; i < MESSAGES; ++i) {
+        check_eq(green_channel_send(channel, &values[i], i), 0);
+    }
+    check_eq(green_channel_close(channel), 0);
+    check_eq(green_channel_send(channel, NULL, 0), GREEN_EPIPE);
+    return 0;
+}
+
+int consumer(green_loop_t loop, void * object)
+{
+    green_channel_t channel = object;
+    void * p = NULL;
+    int i = 0;
+    int rc = 0;
+    while ((rc = green_channel_recv(channel, &p, &i)) == GREEN_SUCCESS) {
+        // Messages come out in order.
+        check_eq(i, received);
+        check_eq(p, &values[received]);
+        ++received;
+    }
+    check_eq(rc, GREEN_EPIPE);
+    return 0;
+}
+
+// Run a producer and a consumer through `channel`.
+static void pipeline(green_loop_t loop, green_channel_t channel)
+{
+    received = 0;
+    green_coroutine_t c1 = green_coroutine_init(loop, consumer, channel, 0);
+    check_ne(c1, NULL);
+    green_coroutine_t c2 = green_coroutine_init(loop, producer, channel, 0);
+    check_ne(c2, NULL);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(received, MESSAGES);
+    check_eq(green_coroutine_release(c2), 0);
+    check_eq(green_coroutine_release(c1), 0);
+}
+
+int test(green_loop_t loop)
+{
+    void * p = NULL;
+    int i = 0;
+
+    // Arguments are required.
+    check_eq(green_channel_init(NULL, 1), NULL);
+    check_eq(green_channel_size(NULL), 0);
+    check_eq(green_channel_used(NULL), 0);
+    check_eq(green_channel_close(NULL), GREEN_EINVAL);
+    check_eq(green_channel_acquire(NULL), GREEN_EINVAL);
+    check_eq(green_channel_release(NULL), GREEN_EINVAL);
+    check_eq(green_channel_send(NULL, NULL, 0), GREEN_EINVAL);
+    check_eq(green_channel_recv(NULL, &p, &i), GREEN_EINVAL);
+    check_eq(green_channel_send_future(NULL, NULL, 0), NULL);
+    check_eq(green_channel_recv_future(NULL), NULL);
+
+    // Buffered and unbuffered channels keep messages in order.
+    green_channel_t channel = green_channel_init(loop, 4);
+    check_ne(channel, NULL);
+    check_eq(green_channel_size(channel), 4);
+    check_eq(green_channel_used(channel), 0);
+    pipeline(loop, channel);
+    check_eq(green_channel_close(channel), GREEN_EALREADY);
+    check_eq(green_channel_release(channel), 0);
+    channel = green_channel_init(loop, 0);
+    check_ne(channel, NULL);
+    pipeline(loop, channel);
+    check_eq(green_channel_release(channel), 0);
+
+    // Send from outside any coroutine buffers the message, receive gets it.
+    channel = green_channel_init(loop, 2);
+    check_eq(green_channel_acquire(channel), 0);
+    check_eq(green_channel_release(channel), 0);
+    check_eq(green_channel_send(channel, &values[1], 1), 0);
+    check_eq(green_channel_send(channel, &values[2], 2), 0);
+    check_eq(green_channel_used(channel), 2);
+    check_eq(green_channel_recv(channel, &p, &i), 0);
+    check_eq(p, &values[1]);
+    check_eq(i, 1);
+
+    // Blocking with nothing left to run doesn't hang.
+    check_eq(green_channel_send(channel, &values[3], 3), 0);
+    check_eq(green_channel_send(channel, &values[4], 4), GREEN_EBUSY);
+    check_eq(green_channel_used(channel), 2);
+    check_eq(green_channel_recv(channel, NULL, &i), 0);
+    check_eq(i, 2);
+    check_eq(green_channel_recv(channel, NULL, &i), 0);
+    check_eq(i, 3);
+    check_eq(green_channel_recv(channel, &p, &i), GREEN_EBUSY);
+
+    // Pending receive completes with the next message, in order.
+    green_poller_t poller = green_poller_init(loop, 2);
+    green_future_t r1 = green_channel_recv_future(channel);
+    check_ne(r1, NULL);
+    green_future_t r2 = green_channel_recv_future(channel);
+    check_ne(r2, NULL);
+    check_eq(green_poller_add(poller, r1), 0);
+    check_eq(green_poller_add(poller, r2), 0);
+    check_eq(green_poller_done(poller), 0);
+    check_eq(green_future_cancel(r1), 0);
+    check_eq(green_channel_send(channel, &values[5], 5), 0);
+    check_eq(green_channel_used(channel), 0);
+    check_eq(green_poller_pop(poller), r2);
+    check_eq(green_future_result(r2, &p, &i), 0);
+    check_eq(p, &values[5]);
+    check_eq(i, 5);
+    check_eq(green_future_release(r2), 0);
+    check_eq(green_future_release(r1), 0);
+
+    // Pending send completes once there is room, in order.
+    green_future_t s1 = green_channel_send_future(channel, &values[6], 6);
+    green_future_t s2 = green_channel_send_future(channel, &values[7], 7);
+    green_future_t s3 = green_channel_send_future(channel, &values[8], 8);
+    check_eq(green_future_done(s1), 1);
+    check_eq(green_future_done(s2), 1);
+    check_eq(green_future_done(s3), 0);
+    check_eq(green_channel_used(channel), 2);
+    check_eq(green_channel_recv(channel, NULL, &i), 0);
+    check_eq(i, 6);
+    check_eq(green_future_done(s3), 1);
+    check_eq(green_future_result(s3, &p, &i), 0);
+    check_eq(p, &values[8]);
+    check_eq(i, 8);
+    check_eq(green_channel_used(channel), 2);
+    check_eq(green_future_release(s3), 0);
+    check_eq(green_future_release(s2), 0);
+    check_eq(green_future_release(s1), 0);
+
+    // Closing fails blocked senders, but buffered messages still go through.
+    s1 = green_channel_send_future(channel, &values[9], 9);
+    check_eq(green_future_done(s1), 0);
+    check_eq(green_channel_close(channel), 0);
+    check_eq(green_future_result(s1, NULL, NULL), GREEN_EPIPE);
+    check_eq(green_future_release(s1), 0);
+    check_eq(green_channel_send(channel, NULL, 0), GREEN_EPIPE);
+    r1 = green_channel_recv_future(channel);
+    check_eq(green_future_result(r1, NULL, &i), 0);
+    check_eq(i, 7);
+    check_eq(green_future_release(r1), 0);
+    check_eq(green_channel_recv(channel, NULL, &i), 0);
+    check_eq(i, 8);
+    check_eq(green_channel_recv(channel, NULL, &i), GREEN_EPIPE);
+    r1 = green_channel_recv_future(channel);
+    check_eq(green_future_result(r1, NULL, NULL), GREEN_EPIPE);
+    check_eq(green_future_release(r1), 0);
+    check_eq(green_channel_release(channel), 0);
+
+    // Releasing the channel fails futures still waiting on it.
+    channel = green_channel_init(loop, 1);
+    r1 = green_channel_recv_future(channel);
+    check_eq(green_poller_add(poller, r1), 0);
+    check_eq(green_channel_release(channel), 0);
+    check_eq(green_poller_pop(poller), r1);
+    check_eq(green_future_result(r1, NULL, NULL), GREEN_EPIPE);
+    check_eq(green_future_release(r1), 0);
+    check_eq(green_poller_release(poller), 0);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -0,0 +1,94 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+
+#define KEYS 20
+
+static green_cls_key_t keys[KEYS];
+static int destroyed[KEYS];
+
+static void destroy(void * value)
+{
+    ++destroyed[*(int*)value];
+}
+
+// Each coroutine sees its own values.
+int worker(green_loop_t loop, void * object)
+{
+    int * values = object;
+    for (int i = 0; i < KEYS; ++i) {
+        check_eq(green_cls_get(loop, keys[i]), NULL);
+    }
+    for (int i = 0; i < KEYS; ++i) {
+        check_eq(green_cls_set(loop, keys[i], &values[i]), 0);
+    }
+    check_eq(green_yield(loop, NULL), 0);
+    for (int i = 0; i < KEYS; ++i) {
+        check_eq(green_cls_get(loop, keys[i]), &values[i]);
+    }
+    // Cleared values are not destroyed.
+    check_eq(green_cls_set(loop, keys[0], NULL), 0);
+    check_eq(green_cls_get(loop, keys[0]), NULL);
+    return 0;
+}
+
+int test(green_loop_t loop)
+{
+    static int values[2][KEYS];
+
+    for (int i = 0; i < KEYS; ++i) {
+        values[0][i] = values[1][i] = i;
+        destroyed[i] = 0;
+    }
+
+    // Arguments are required.
+    check_eq(green_cls_key_create(NULL, destroy), GREEN_EINVAL);
+    for (int i = 0; i < KEYS; ++i) {
+        check_eq(green_cls_key_create(&keys[i], (i % 2)? destroy : NULL), 0);
+        if (i > 0) {
+            check_ne(keys[i], keys[i-1]);
+        }
+    }
+
+    // Values only exist inside coroutines.
+    check_eq(green_cls_get(NULL, keys[0]), NULL);
+    check_eq(green_cls_get(loop, keys[0]), NULL);
+    check_eq(green_cls_set(loop, keys[0], &values[0][0]), GREEN_EINVAL);
+    check_eq(green_cls_set(NULL, keys[0], &values[0][0]), GREEN_EINVAL);
+
+    green_coroutine_t c1 = green_coroutine_init(loop, worker, values[0], 0);
+    check_ne(c1, NULL);
+    green_coroutine_t c2 = green_coroutine_init(loop, worker, values[1], 0);
+    check_ne(c2, NULL);
+    check_eq(green_loop_run(loop), 0);
+
+    // Destructors ran once per coroutine, for keys that have one.
+    for (int i = 0; i < KEYS; ++i) {
+        check_eq(destroyed[i], (i % 2)? 2 : 0);
+    }
+    check_eq(green_coroutine_release(c2), 0);
+    check_eq(green_coroutine_release(c1), 0);
+
+    // Recycled coroutines start out empty.
+    c1 = green_coroutine_init(loop, worker, values[0], 0);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_release(c1), 0);
+    check_eq(destroyed[1], 3);
+
+    // Keys are limited.
+    green_cls_key_t key;
+    int rc = 0;
+    int n = KEYS;
+    while ((rc = green_cls_key_create(&key, NULL)) == GREEN_SUCCESS) {
+        ++n;
+    }
+    check_eq(rc, GREEN_EAGAIN);
+    check_eq(n, GREEN_CLS_KEYS);
+    check_eq(green_cls_get(loop, GREEN_CLS_KEYS), NULL);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -15,6 +15,20 @@ int mycoroutine(green_loop_t loop, void * object)
     return 777;
 }
 
+int mycounter(green_loop_t loop, void * object)
+{
+    // Locals must survive switches, including floating-point ones.
+    int i = 0;
+    double d = 0.0;
+    for (; i < 1000; ++i) {
+        d += 0.5;
+        check_eq(green_yield(loop, NULL), 0);
+        check_eq(d, 0.5 * (i + 1));
+    }
+    *(int*)object = i;
+    return 0;
+}
+
 int test(green_loop_t loop)
 {
     fprintf(stderr, "spawning coroutine.\n");
@@ -38,6 +52,21 @@ int test(green_loop_t loop)
     check_eq(green_coroutine_release(coro), 0);
     coro = NULL;
 
+    // Switch back and forth many times.
+    int count = 0;
+    double d = 1.0;
+    coro = green_coroutine_init(loop, mycounter, &count, 0);
+    check_ne(coro, NULL);
+    for (int i = 0; i <= 1000; ++i) {
+        d *= 1.5;
+        check_eq(green_yield(loop, coro), 0);
+    }
+    check_eq(count, 1000);
+    check_eq(green_coroutine_result(coro), 0);
+    check_gt(d, 1.0);
+    check_eq(green_coroutine_release(coro), 0);
+    coro = NULL;
+
     return EXIT_SUCCESS;
 }
 
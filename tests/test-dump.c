@@ -0,0 +1,168 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include <signal.h>
+#include <string.h>
+
+#define MILLISECOND ((int64_t)1000000)
+
+static green_sem_t sem = NULL;
+
+int selector(green_loop_t loop, void * object)
+{
+    green_poller_t poller = green_poller_init(loop, 1);
+    check_eq(green_poller_add(poller, object), 0);
+    check_eq(green_select(poller), object);
+    check_eq(green_poller_release(poller), 0);
+    return 0;
+}
+
+int sleeper(green_loop_t loop, void * object)
+{
+    check_eq(green_sleep(loop, 20 * MILLISECOND), 0);
+    return 0;
+}
+
+int waiter(green_loop_t loop, void * object)
+{
+    check_eq(green_sem_wait(sem), 0);
+    return 0;
+}
+
+int yielder(green_loop_t loop, void * object)
+{
+    check_eq(green_yield(loop, NULL), 0);
+    return 0;
+}
+
+int quitter(green_loop_t loop, void * object)
+{
+    return 0;
+}
+
+// Check the dump has a line with both strings.
+static void check_line(const char * dump, const char * a, const char * b)
+{
+    const char * line = strstr(dump, a);
+    check_ne(line, NULL);
+    const char * end = strchr(line, '\n');
+    check_ne(end, NULL);
+    const char * match = strstr(line, b);
+    check_ne(match, NULL);
+    check_lt(match, end);
+}
+
+int test(green_loop_t loop)
+{
+    green_coroutine_info_t info;
+    green_coroutine_t coros[6];
+    char * dump = NULL;
+    size_t size = 0;
+
+    // Arguments are required.
+    check_eq(green_loop_next_coroutine(NULL, NULL), NULL);
+    check_eq(green_coroutine_info(NULL, &info), GREEN_EINVAL);
+    check_eq(green_loop_dump(NULL, stderr), GREEN_EINVAL);
+    check_eq(green_loop_dump(loop, NULL), GREEN_EINVAL);
+    check_eq(green_loop_dump_on_signal(NULL, SIGUSR2, stderr), GREEN_EINVAL);
+    check_eq(green_loop_dump_on_signal(loop, -1, stderr), GREEN_EINVAL);
+    check_eq(green_loop_dump_on_signal(loop, SIGUSR2, NULL), GREEN_EINVAL);
+    check_eq(green_loop_next_coroutine(loop, NULL), NULL);
+
+    // One coroutine in each state.
+    sem = green_sem_init(loop, 0);
+    green_future_t future = green_future_init(loop);
+    coros[0] = green_coroutine_init(loop, selector, future, 0);
+    coros[1] = green_coroutine_init(loop, sleeper, NULL, 0);
+    coros[2] = green_coroutine_init(loop, waiter, NULL, 0);
+    coros[3] = green_coroutine_init(loop, yielder, NULL, 0);
+    coros[4] = green_coroutine_init(loop, quitter, NULL, 0);
+    check_eq(green_loop_run_once(loop), 0);
+    coros[5] = green_coroutine_init(loop, quitter, NULL, 0);
+
+    // Coroutines are listed in spawn order.
+    green_coroutine_t coro = NULL;
+    for (int i = 0; i < 6; ++i) {
+        coro = green_loop_next_coroutine(loop, coro);
+        check_eq(coro, coros[i]);
+    }
+    check_eq(green_loop_next_coroutine(loop, coro), NULL);
+
+    check_eq(green_coroutine_info(coros[0], &info), 0);
+    check_eq(info.state, GREEN_COROUTINE_BLOCKED);
+    check_eq(info.ready, 0);
+    check_ne(info.poller, NULL);
+    check_eq(info.future, future);
+    check_ne(strstr(info.source, "test-dump.c"), NULL);
+    check_ne(strcmp(info.source, info.origin), 0);
+    check_le(info.switched, green_now());
+    check_eq(green_coroutine_info(coros[1], &info), 0);
+    check_eq(info.state, GREEN_COROUTINE_BLOCKED);
+    check_eq(info.sleeping, 1);
+    check_eq(info.poller, NULL);
+    check_eq(green_coroutine_info(coros[2], &info), 0);
+    check_eq(info.state, GREEN_COROUTINE_BLOCKED);
+    check_eq(info.waiting, 1);
+    check_eq(info.sleeping, 0);
+    check_eq(green_coroutine_info(coros[3], &info), 0);
+    check_eq(info.state, GREEN_COROUTINE_BLOCKED);
+    check_eq(info.ready, 1);
+    check_eq(green_coroutine_info(coros[4], &info), 0);
+    check_eq(info.state, GREEN_COROUTINE_STOPPED);
+    check_eq(green_coroutine_info(coros[5], &info), 0);
+    check_eq(info.state, GREEN_COROUTINE_PENDING);
+    check_eq(info.ready, 1);
+    check_eq(strcmp(info.source, info.origin), 0);
+
+    // Dump has a line per coroutine.
+    FILE * file = open_memstream(&dump, &size);
+    check_ne(file, NULL);
+    check_eq(green_loop_dump(loop, file), 0);
+    check_ne(strstr(dump, "green: 6 coroutines (2 ready)\n"), NULL);
+    check_line(dump, "coroutine 1: blocked", ", select on future");
+    check_line(dump, "coroutine 2: blocked", ", sleeping");
+    check_line(dump, "coroutine 3: blocked", ", waiting on");
+    check_line(dump, "coroutine 4: ready", "test-dump.c");
+    check_line(dump, "coroutine 5: stopped", "(spawned at ");
+    check_line(dump, "coroutine 6: pending", "test-dump.c");
+
+    // Released coroutines leave the registry.
+    check_eq(green_coroutine_release(coros[4]), 0);
+    check_eq(green_loop_next_coroutine(loop, coros[3]), coros[5]);
+
+    // A signal makes the loop dump on its next iteration.
+    check_eq(fclose(file), 0);
+    free(dump);
+    dump = NULL;
+    file = open_memstream(&dump, &size);
+    check_eq(green_loop_dump_on_signal(loop, SIGUSR2, file), 0);
+    check_eq(green_loop_run_once(loop), 0);
+    check_eq(fflush(file), 0);
+    check_eq(size, 0);
+    check_eq(raise(SIGUSR2), 0);
+    check_eq(green_loop_run_once(loop), 0);
+    check_ne(strstr(dump, "green: 5 coroutines"), NULL);
+    check_eq(green_loop_run_once(loop), 0);
+    check_eq(strstr(dump + 1, "green: "), NULL);
+    check_eq(green_loop_dump_on_signal(loop, 0, NULL), 0);
+
+    // Let everything finish.
+    check_eq(green_future_set_result(future, NULL, 0), 0);
+    check_eq(green_sem_post(sem), 0);
+    check_eq(green_loop_run(loop), 0);
+    for (int i = 0; i < 6; ++i) {
+        if (i != 4) {
+            check_eq(green_coroutine_release(coros[i]), 0);
+        }
+    }
+    check_eq(green_loop_next_coroutine(loop, NULL), NULL);
+    check_eq(green_future_release(future), 0);
+    check_eq(green_sem_release(sem), 0);
+    check_eq(fclose(file), 0);
+    free(dump);
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -0,0 +1,138 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+
+static green_loop_group_t group = NULL;
+static int started = 0;
+static int finished = 0;
+static int sum = 0;
+
+// Yield a few times, then record the result.
+int leaf(green_loop_t loop, void * object)
+{
+    __atomic_add_fetch(&started, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < 3; ++i) {
+        check_eq(green_yield(loop, NULL), 0);
+    }
+    __atomic_add_fetch(&sum, (int)(intptr_t)object, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+// Spawn leaves from inside the group, some of which block for a while.
+int root(green_loop_t loop, void * object)
+{
+    const int n = (int)(intptr_t)object;
+    for (int i = 1; i <= n; ++i) {
+        check_eq(green_loop_group_spawn(group, leaf, (void*)(intptr_t)i, 0),
+                 0);
+    }
+    check_eq(green_sleep(loop, 1000000), 0);
+    __atomic_add_fetch(&finished, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+// Compute for a while, letting the group move us to another loop.
+static int crunched = 0;
+static int moved = 0;
+
+int cruncher(green_loop_t loop, void * object)
+{
+    for (int i = 0; i < 200; ++i) {
+        const int64_t start = green_now();
+        while (green_now() - start < 20000) {
+        }
+        green_loop_t next = green_yield_any(loop);
+        check_ne(next, NULL);
+        if (next != loop) {
+            __atomic_add_fetch(&moved, 1, __ATOMIC_SEQ_CST);
+        }
+        loop = next;
+    }
+    __atomic_add_fetch(&crunched, 1, __ATOMIC_SEQ_CST);
+    return 0;
+}
+
+// Start all crunchers on one loop.
+int hub(green_loop_t loop, void * object)
+{
+    for (int i = 0; i < 4; ++i) {
+        green_coroutine_t coro = green_coroutine_init(loop, cruncher, NULL, 0);
+        check_ne(coro, NULL);
+        check_eq(green_coroutine_release(coro), 0);
+    }
+    while (__atomic_load_n(&crunched, __ATOMIC_SEQ_CST) < 4) {
+        check_eq(green_sleep(loop, 1000000), 0);
+    }
+    return 0;
+}
+
+int local(green_loop_t loop, void * object)
+{
+    check_eq(green_yield_any(loop), loop);
+    return 0;
+}
+
+int test(green_loop_t loop)
+{
+    // Arguments are required.
+    check_eq(green_loop_group_spawn(NULL, leaf, NULL, 0), GREEN_EINVAL);
+    check_eq(green_loop_group_run(NULL), GREEN_EINVAL);
+    check_eq(green_loop_group_size(NULL), 0);
+
+    // Default size is one loop per processor.
+    group = green_loop_group_init(0);
+    check_ne(group, NULL);
+    check_gt(green_loop_group_size(group), 0);
+    check_eq(green_loop_group_release(group), 0);
+
+    group = green_loop_group_init(4);
+    check_ne(group, NULL);
+    check_eq(green_loop_group_size(group), 4);
+
+    // Nothing to do.
+    check_eq(green_loop_group_run(group), 0);
+
+    // Tasks spawned from outside and inside the group all run to completion.
+    for (int i = 0; i < 8; ++i) {
+        check_eq(green_loop_group_spawn(group, root, (void*)(intptr_t)100, 0),
+                 0);
+    }
+    check_eq(green_loop_group_run(group), 0);
+    check_eq(started, 800);
+    check_eq(finished, 808);
+    check_eq(sum, 8 * 5050);
+
+    // Group can run again.
+    check_eq(green_loop_group_spawn(group, leaf, (void*)(intptr_t)1, 0), 0);
+    check_eq(green_loop_group_run(group), 0);
+    check_eq(finished, 809);
+
+    // Coroutines that compute on a busy loop move to idle ones.
+    green_loop_group_t pair = green_loop_group_init(2);
+    check_ne(pair, NULL);
+    check_eq(green_loop_group_spawn(pair, hub, NULL, 0), 0);
+    check_eq(green_loop_group_run(pair), 0);
+    check_eq(crunched, 4);
+    check_gt(moved, 0);
+    check_eq(green_loop_group_release(pair), 0);
+
+    // Outside loop groups, coroutines stay where they are.
+    check_eq(green_yield_any(NULL), NULL);
+    check_eq(green_yield_any(loop), NULL);
+    green_coroutine_t coro = green_coroutine_init(loop, local, NULL, 0);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_result(coro), 0);
+    check_eq(green_coroutine_release(coro), 0);
+
+    // Tasks that never ran are dropped.
+    check_eq(green_loop_group_spawn(group, leaf, NULL, 0), 0);
+    check_eq(green_loop_group_release(group), 0);
+    check_eq(started, 801);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -4,11 +4,28 @@
 
 #include "loop-fixture.h"
 
+static int ran = 0;
+
+int runner(green_loop_t loop, void * object)
+{
+    ++ran;
+    return 0;
+}
+
 int test(green_loop_t loop)
 {
     check_eq(green_loop_acquire(loop), 0);
     check_eq(green_loop_release(loop), 0);
 
+    // Coroutines that never ran don't hold up the loop.
+    green_loop_t other = green_loop_init();
+    check_ne(other, NULL);
+    green_coroutine_t coro = green_coroutine_init(other, runner, NULL, 0);
+    check_ne(coro, NULL);
+    check_eq(green_coroutine_release(coro), 0);
+    check_eq(green_loop_release(other), 0);
+    check_eq(ran, 0);
+
     return EXIT_SUCCESS;
 }
 
@@ -0,0 +1,93 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+
+int mycoroutine(green_loop_t loop, void * object)
+{
+    return 0;
+}
+
+int test(green_loop_t loop)
+{
+    green_memory_stats_t before;
+    green_memory_stats_t after;
+    green_memory_stats_t global;
+
+    // Arguments are required.
+    check_eq(green_memory_stats(NULL), GREEN_EINVAL);
+    check_eq(green_loop_memory_stats(NULL, &before), GREEN_EINVAL);
+    check_eq(green_loop_memory_stats(loop, NULL), GREEN_EINVAL);
+
+    // Nothing allocated yet.
+    check_eq(green_loop_memory_stats(loop, &before), 0);
+    check_eq(before.total.bytes, 0);
+    check_eq(before.total.objects, 0);
+
+    // The loop itself is accounted for globally.
+    check_eq(green_memory_stats(&global), 0);
+    check_gt(global.categories[GREEN_MEMORY_OTHER].bytes, 0);
+
+    // Futures are tracked.
+    green_future_t f = green_future_init(loop);
+    check_ne(f, NULL);
+    check_eq(green_loop_memory_stats(loop, &after), 0);
+    check_gt(after.categories[GREEN_MEMORY_FUTURES].bytes, 0);
+    check_eq(after.categories[GREEN_MEMORY_FUTURES].objects, 1);
+    check_eq(after.categories[GREEN_MEMORY_FUTURES].allocs, 1);
+
+    // Pollers are tracked, including their storage.
+    green_poller_t poller = green_poller_init(loop, 16);
+    check_ne(poller, NULL);
+    check_eq(green_loop_memory_stats(loop, &after), 0);
+    check_ge(after.categories[GREEN_MEMORY_POLLERS].bytes,
+             16 * sizeof(green_future_t));
+    check_eq(after.categories[GREEN_MEMORY_POLLERS].objects, 1);
+
+    // Coroutines and their stack are tracked separately.
+    green_coroutine_t coro = green_coroutine_init(loop, mycoroutine, NULL,
+                                                  64 * 1024);
+    check_ne(coro, NULL);
+    check_eq(green_loop_memory_stats(loop, &after), 0);
+    check_ge(after.categories[GREEN_MEMORY_STACKS].bytes, 64 * 1024);
+    check_eq(after.categories[GREEN_MEMORY_STACKS].objects, 1);
+    check_gt(after.categories[GREEN_MEMORY_COROUTINES].bytes, 0);
+    check_eq(after.categories[GREEN_MEMORY_COROUTINES].objects, 1);
+
+    // Totals add up.
+    size_t bytes = 0;
+    for (int i = 0; i < GREEN_MEMORY_CATEGORIES; ++i) {
+        bytes += after.categories[i].bytes;
+    }
+    check_eq(after.total.bytes, bytes);
+
+    // Global stats include the loop's.
+    check_eq(green_memory_stats(&global), 0);
+    check_ge(global.total.bytes, after.total.bytes);
+    check_ge(global.categories[GREEN_MEMORY_STACKS].objects, 1);
+
+    check_eq(green_yield(loop, coro), 0);
+    check_eq(green_coroutine_release(coro), 0); coro = NULL;
+    check_eq(green_poller_release(poller), 0); poller = NULL;
+    check_eq(green_future_release(f), 0); f = NULL;
+
+    // Objects are gone, but caches and slabs still hold memory.
+    check_eq(green_loop_memory_stats(loop, &after), 0);
+    check_eq(after.categories[GREEN_MEMORY_FUTURES].objects, 0);
+    check_eq(after.categories[GREEN_MEMORY_POLLERS].objects, 0);
+    check_eq(after.categories[GREEN_MEMORY_COROUTINES].objects, 0);
+    check_eq(after.categories[GREEN_MEMORY_STACKS].objects, 0);
+    check_gt(after.categories[GREEN_MEMORY_STACKS].bytes, 0);
+    check_gt(after.categories[GREEN_MEMORY_FUTURES].bytes, 0);
+
+    // Trimming the cache releases stacks.
+    check_eq(green_loop_set_cache_limits(loop, 0, 0), 0);
+    check_eq(green_loop_memory_stats(loop, &after), 0);
+    check_eq(after.categories[GREEN_MEMORY_STACKS].bytes, 0);
+    check_ge(after.categories[GREEN_MEMORY_STACKS].peak, 64 * 1024);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -0,0 +1,106 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include <unistd.h>
+
+static int started = 0;
+static int release = 0;
+
+// Block until the test lets us go.
+static int blocker(void * object)
+{
+    __atomic_store_n(&started, 1, __ATOMIC_SEQ_CST);
+    while (!__atomic_load_n(&release, __ATOMIC_SEQ_CST)) {
+        usleep(1000);
+    }
+    return 1;
+}
+
+static int square(void * object)
+{
+    int * value = object;
+    *value = *value * *value;
+    return 2;
+}
+
+// Run offloaded calls while other coroutines keep running.
+int offloader(green_loop_t loop, void * object)
+{
+    green_poller_t poller = green_poller_init(loop, 1);
+    check_ne(poller, NULL);
+    int value = 12;
+    green_future_t f = green_offload(loop, square, &value);
+    check_ne(f, NULL);
+    check_eq(green_poller_add(poller, f), 0);
+    check_eq(green_select(poller), f);
+    void * p = NULL;
+    int i = 0;
+    check_eq(green_future_result(f, &p, &i), 0);
+    check_eq(p, &value);
+    check_eq(i, 2);
+    check_eq(green_future_release(f), 0);
+    check_eq(green_poller_release(poller), 0);
+    return value;
+}
+
+int test(green_loop_t loop)
+{
+    // Arguments are required.
+    check_eq(green_offload(NULL, square, NULL), NULL);
+    check_eq(green_offload(loop, NULL, NULL), NULL);
+    check_eq(green_offload_configure(0, 1), GREEN_EINVAL);
+    check_eq(green_offload_configure(1, 0), GREEN_EINVAL);
+
+    // One thread with room for one queued call.
+    check_eq(green_offload_configure(1, 1), 0);
+
+    green_coroutine_t c = green_coroutine_init(loop, offloader, NULL, 0);
+    check_ne(c, NULL);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_result(c), 144);
+    check_eq(green_coroutine_release(c), 0);
+
+    // Pool can't be reconfigured once started.
+    check_eq(green_offload_configure(2, 2), GREEN_EBUSY);
+
+    // Calls that don't fit in the queue fail right away.
+    green_future_t a = green_offload(loop, blocker, NULL);
+    check_ne(a, NULL);
+    while (!__atomic_load_n(&started, __ATOMIC_SEQ_CST)) {
+        usleep(1000);
+    }
+    int value = 3;
+    green_future_t b = green_offload(loop, square, &value);
+    check_ne(b, NULL);
+    green_future_t f = green_offload(loop, square, &value);
+    check_ne(f, NULL);
+    check_eq(green_future_done(f), 1);
+    check_eq(green_future_canceled(f), 0);
+    check_eq(green_future_result(f, NULL, NULL), GREEN_EAGAIN);
+    check_eq(green_future_release(f), 0);
+    __atomic_store_n(&release, 1, __ATOMIC_SEQ_CST);
+    check_eq(green_loop_run(loop), 0);
+    int i = 0;
+    check_eq(green_future_result(a, NULL, &i), 0);
+    check_eq(i, 1);
+    check_eq(green_future_result(b, NULL, &i), 0);
+    check_eq(i, 2);
+    check_eq(value, 9);
+    check_eq(green_future_release(a), 0);
+    check_eq(green_future_release(b), 0);
+
+    // Failed futures hold an error code.
+    f = green_future_init(loop);
+    check_eq(green_future_set_error(f, GREEN_SUCCESS), GREEN_EINVAL);
+    check_eq(green_future_set_error(f, GREEN_ENOMEM), 0);
+    check_eq(green_future_set_error(f, GREEN_ENOMEM), GREEN_EBADFD);
+    check_eq(green_future_set_result(f, NULL, 0), GREEN_EBADFD);
+    check_eq(green_future_result(f, NULL, NULL), GREEN_ENOMEM);
+    check_eq(green_future_release(f), 0);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -58,14 +58,19 @@ int test(green_loop_t loop)
     // Can't remove a future that's not in the poller.
     check_eq(green_poller_rem(poller, f3), GREEN_ENOENT);
 
-    // Poller has a maximum size.
+    // Poller grows when full.
     check_eq(green_poller_add(poller, f1), 0);
     check_eq(green_poller_used(poller), 1);
     check_eq(green_poller_done(poller), 0);
     check_eq(green_poller_add(poller, f2), 0);
     check_eq(green_poller_used(poller), 2);
     check_eq(green_poller_done(poller), 0);
-    check_eq(green_poller_add(poller, f3), GREEN_ENFILE);
+    check_eq(green_poller_size(poller), 2);
+    check_eq(green_poller_add(poller, f3), 0);
+    check_eq(green_poller_size(poller), 4);
+    check_eq(green_poller_used(poller), 3);
+    check_eq(green_poller_done(poller), 0);
+    check_eq(green_poller_rem(poller, f3), 0);
     check_eq(green_poller_used(poller), 2);
     check_eq(green_poller_done(poller), 0);
 
@@ -123,6 +128,56 @@ int test(green_loop_t loop)
     check_eq(green_future_release(f4), 0); f4 = NULL;
     check_eq(green_loop_release(loop2), 0); loop2 = NULL;
 
+    // Batch methods check their arguments.
+    green_future_t batch[64];
+    check_eq(green_poller_add_many(NULL, &f1, 1), GREEN_EINVAL);
+    check_eq(green_poller_add_many(poller, NULL, 1), GREEN_EINVAL);
+    check_eq(green_poller_add_many(poller, NULL, 0), 0);
+    check_eq(green_poller_pop_many(NULL, batch, 64), 0);
+    check_eq(green_poller_pop_many(poller, NULL, 64), 0);
+    check_eq(green_poller_pop_many(poller, batch, 64), 0);
+
+    // Batch add is all or nothing.
+    batch[0] = f3;
+    batch[1] = f3;
+    check_eq(green_poller_add_many(poller, batch, 2), GREEN_EALREADY);
+    batch[1] = NULL;
+    check_eq(green_poller_add_many(poller, batch, 2), GREEN_EINVAL);
+    check_eq(green_poller_used(poller), 0);
+    check_eq(green_poller_rem(poller, f3), GREEN_ENOENT);
+
+    // Batch add grows the poller at once, batch pop drains completed futures.
+    for (int i = 0; i < 64; ++i) {
+        batch[i] = green_future_init(loop);
+        check_ne(batch[i], NULL);
+    }
+    check_eq(green_future_set_result(batch[7], NULL, 7), 0);
+    check_eq(green_poller_add_many(poller, batch, 64), 0);
+    check_eq(green_poller_size(poller), 64);
+    check_eq(green_poller_used(poller), 64);
+    check_eq(green_poller_done(poller), 1);
+    for (int i = 0; i < 64; i += 2) {
+        check_eq(green_future_set_result(batch[i], NULL, i), 0);
+    }
+    check_eq(green_poller_done(poller), 33);
+    green_future_t done[64];
+    check_eq(green_poller_pop_many(poller, done, 30), 30);
+    check_eq(green_poller_done(poller), 3);
+    check_eq(green_poller_pop_many(poller, done + 30, 64), 3);
+    check_eq(green_poller_used(poller), 31);
+    check_eq(green_poller_done(poller), 0);
+    int sum = 0;
+    for (int i = 0; i < 33; ++i) {
+        int result = -1;
+        check_eq(green_future_result(done[i], NULL, &result), 0);
+        sum += result;
+    }
+    check_eq(sum, 7 + 31 * 32);
+    check_eq(green_poller_pop(poller), NULL);
+    for (int i = 0; i < 64; ++i) {
+        check_eq(green_future_release(batch[i]), 0);
+    }
+
     // Future will be released even if the poller holds the last reference.
     //
     // NOTE: the real assert that proves the future refernce is released
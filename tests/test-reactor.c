@@ -0,0 +1,125 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+static int sockets[2];
+
+// Wait for data, then echo it back.
+int echo(green_loop_t loop, void * object)
+{
+    green_poller_t poller = green_poller_init(loop, 1);
+    check_ne(poller, NULL);
+
+    char data[16];
+    ssize_t n = -1;
+    while ((n = read(sockets[0], data, sizeof(data))) < 0) {
+        green_future_t f = green_fd_readable(loop, sockets[0]);
+        check_ne(f, NULL);
+        check_eq(green_poller_add(poller, f), 0);
+        check_eq(green_select(poller), f);
+        int events = 0;
+        check_eq(green_future_result(f, NULL, &events), 0);
+        check_ne(events & GREEN_FD_READABLE, 0);
+        check_eq(green_future_release(f), 0);
+    }
+
+    green_future_t f = green_fd_writable(loop, sockets[0]);
+    check_ne(f, NULL);
+    check_eq(green_poller_add(poller, f), 0);
+    check_eq(green_select(poller), f);
+    check_eq(green_future_release(f), 0);
+    check_eq(write(sockets[0], data, n), n);
+
+    check_eq(green_poller_release(poller), 0);
+    return (int)n;
+}
+
+int test(green_loop_t loop)
+{
+    // Arguments are required.
+    check_eq(green_fd_readable(NULL, 0), NULL);
+    check_eq(green_fd_writable(NULL, 0), NULL);
+    check_eq(green_fd_readable(loop, -1), NULL);
+    check_eq(green_fd_detach(NULL, 0), GREEN_EINVAL);
+    check_eq(green_fd_detach(loop, -1), GREEN_EINVAL);
+
+    // Descriptor must be registered.
+    check_eq(green_fd_detach(loop, 0), GREEN_ENOENT);
+
+    check_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, sockets), 0);
+    for (int i = 0; i < 2; ++i) {
+        check_eq(fcntl(sockets[i], F_SETFL, O_NONBLOCK), 0);
+    }
+
+    // Loop blocks until another process sends data.
+    green_coroutine_t coro = green_coroutine_init(loop, echo, NULL, 0);
+    check_ne(coro, NULL);
+    pid_t pid = fork();
+    check_ne(pid, -1);
+    if (pid == 0) {
+        usleep(10 * 1000);
+        _exit((write(sockets[1], "hello", 5) == 5)? 0 : 1);
+    }
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_result(coro), 5);
+    check_eq(green_coroutine_release(coro), 0); coro = NULL;
+    int status = -1;
+    check_eq(waitpid(pid, &status, 0), pid);
+    check(WIFEXITED(status) && (WEXITSTATUS(status) == 0));
+    char data[16];
+    check_eq(read(sockets[1], data, sizeof(data)), 5);
+    check_eq(memcmp(data, "hello", 5), 0);
+
+    // Only one pending request per direction.
+    green_future_t f1 = green_fd_readable(loop, sockets[0]);
+    check_ne(f1, NULL);
+    check_eq(green_future_done(f1), 0);
+    check_eq(green_fd_readable(loop, sockets[0]), NULL);
+
+    // Canceled requests can be replaced.
+    check_eq(green_future_cancel(f1), 0);
+    green_future_t f2 = green_fd_readable(loop, sockets[0]);
+    check_ne(f2, NULL);
+    check_eq(green_future_release(f1), 0); f1 = NULL;
+
+    check_eq(write(sockets[1], "x", 1), 1);
+    check_eq(green_loop_run_until(loop, f2), 0);
+    check_eq(green_future_release(f2), 0); f2 = NULL;
+
+    // Readiness is remembered until somebody asks for it.
+    f1 = green_fd_writable(loop, sockets[0]);
+    check_ne(f1, NULL);
+    check_ne(green_future_done(f1), 0);
+    check_eq(green_future_release(f1), 0); f1 = NULL;
+
+    // Detaching cancels pending requests.
+    check_eq(read(sockets[0], data, sizeof(data)), 1);
+    f1 = green_fd_readable(loop, sockets[0]);
+    check_ne(f1, NULL);
+    check_eq(green_fd_detach(loop, sockets[0]), 0);
+    check_ne(green_future_canceled(f1), 0);
+    check_eq(green_future_release(f1), 0); f1 = NULL;
+    check_eq(green_fd_detach(loop, sockets[0]), GREEN_ENOENT);
+    check_eq(green_fd_detach(loop, sockets[1]), GREEN_ENOENT);
+
+    // Canceled requests don't keep the loop alive.
+    f1 = green_fd_readable(loop, sockets[0]);
+    check_ne(f1, NULL);
+    check_eq(green_future_cancel(f1), 0);
+    check_eq(green_future_release(f1), 0); f1 = NULL;
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_fd_detach(loop, sockets[0]), 0);
+
+    close(sockets[0]);
+    close(sockets[1]);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
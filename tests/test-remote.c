@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include <pthread.h>
+#include <unistd.h>
+
+#define THREADS 4
+#define FUTURES 1000
+
+static green_future_t futures[THREADS][FUTURES];
+
+// Complete a batch of futures from another thread.
+static void * producer(void * object)
+{
+    green_future_t * batch = object;
+    for (int i = 0; i < FUTURES; ++i) {
+        check_eq(green_future_set_result_threadsafe(batch[i], NULL, i), 0);
+    }
+    return NULL;
+}
+
+// Complete a single future after the loop had time to block.
+static void * sleeper(void * object)
+{
+    usleep(20 * 1000);
+    check_eq(green_future_set_result_threadsafe(object, object, 7), 0);
+    return NULL;
+}
+
+int consumer(green_loop_t loop, void * object)
+{
+    green_poller_t poller = object;
+    int total = 0;
+    for (int i = 0; i < THREADS * FUTURES; ++i) {
+        green_future_t f = green_select(poller);
+        check_ne(f, NULL);
+        int j = -1;
+        check_eq(green_future_result(f, NULL, &j), 0);
+        total += j;
+    }
+    return total;
+}
+
+int test(green_loop_t loop)
+{
+    // Future is required.
+    check_eq(green_future_share(NULL), GREEN_EINVAL);
+    check_eq(green_future_set_result_threadsafe(NULL, NULL, 0), GREEN_EINVAL);
+
+    // Loop blocks until the result comes back.
+    green_future_t f = green_future_init(loop);
+    check_ne(f, NULL);
+    check_eq(green_future_share(f), 0);
+    pthread_t thread;
+    check_eq(pthread_create(&thread, NULL, sleeper, f), 0);
+    check_eq(green_loop_run_until(loop, f), 0);
+    check_eq(pthread_join(thread, NULL), 0);
+    void * p = NULL;
+    int i = 0;
+    check_eq(green_future_result(f, &p, &i), 0);
+    check_eq(p, f);
+    check_eq(i, 7);
+    check_eq(green_future_release(f), 0);
+
+    // Completions from several threads wake up a blocked coroutine.
+    green_poller_t poller = green_poller_init(loop, THREADS * FUTURES);
+    check_ne(poller, NULL);
+    for (int t = 0; t < THREADS; ++t) {
+        for (int j = 0; j < FUTURES; ++j) {
+            futures[t][j] = green_future_init(loop);
+            check_ne(futures[t][j], NULL);
+            check_eq(green_poller_add(poller, futures[t][j]), 0);
+            check_eq(green_future_share(futures[t][j]), 0);
+        }
+    }
+    green_coroutine_t c = green_coroutine_init(loop, consumer, poller, 0);
+    check_ne(c, NULL);
+    pthread_t threads[THREADS];
+    for (int t = 0; t < THREADS; ++t) {
+        check_eq(pthread_create(&threads[t], NULL, producer, futures[t]), 0);
+    }
+    check_eq(green_loop_run(loop), 0);
+    for (int t = 0; t < THREADS; ++t) {
+        check_eq(pthread_join(threads[t], NULL), 0);
+    }
+    check_eq(green_coroutine_result(c), THREADS * (FUTURES * (FUTURES-1) / 2));
+    check_eq(green_coroutine_release(c), 0);
+
+    // Results are delivered in order for each thread.
+    for (int t = 0; t < THREADS; ++t) {
+        for (int j = 0; j < FUTURES; ++j) {
+            check_eq(green_future_release(futures[t][j]), 0);
+        }
+    }
+
+    // Results for canceled futures are dropped.
+    f = green_future_init(loop);
+    check_ne(f, NULL);
+    check_eq(green_future_share(f), 0);
+    check_eq(green_future_cancel(f), 0);
+    check_eq(green_future_set_result_threadsafe(f, NULL, 1), 0);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_future_canceled(f), 1);
+    check_eq(green_future_release(f), 0);
+
+    // Futures must be shared first, once at a time, and take one result.
+    f = green_future_init(loop);
+    check_ne(f, NULL);
+    check_eq(green_future_set_result_threadsafe(f, NULL, 1), GREEN_EINVAL);
+    check_eq(green_future_share(f), 0);
+    check_eq(green_future_share(f), GREEN_EALREADY);
+    check_eq(green_future_set_result_threadsafe(f, NULL, 1), 0);
+    check_eq(green_future_set_result_threadsafe(f, NULL, 2), GREEN_EINVAL);
+    check_eq(green_future_share(f), GREEN_EALREADY);
+    check_eq(green_loop_run(loop), 0);
+    i = 0;
+    check_eq(green_future_result(f, NULL, &i), 0);
+    check_eq(i, 1);
+    check_eq(green_future_release(f), 0);
+
+    check_eq(green_poller_release(poller), 0);
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -0,0 +1,102 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+
+static char trace[64];
+static size_t traced = 0;
+
+int worker(green_loop_t loop, void * object)
+{
+    const char * name = object;
+    for (int i = 0; i < 3; ++i) {
+        trace[traced++] = name[0];
+        check_eq(green_yield(loop, NULL), 0);
+    }
+    return name[0];
+}
+
+int completer(green_loop_t loop, void * object)
+{
+    green_future_t future = object;
+    check_eq(green_yield(loop, NULL), 0);
+    check_eq(green_yield(loop, NULL), 0);
+    check_eq(green_future_set_result(future, NULL, 42), 0);
+    return 0;
+}
+
+int test(green_loop_t loop)
+{
+    // Arguments are required.
+    check_eq(green_loop_run(NULL), GREEN_EINVAL);
+    check_eq(green_loop_run_once(NULL), GREEN_EINVAL);
+    check_eq(green_loop_run_until(NULL, NULL), GREEN_EINVAL);
+    check_eq(green_loop_run_until(loop, NULL), GREEN_EINVAL);
+
+    // Nothing to do.
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_loop_run_once(loop), 0);
+
+    // Spawned coroutines are scheduled round-robin.
+    green_coroutine_t a = green_coroutine_init(loop, worker, "a", 0);
+    green_coroutine_t b = green_coroutine_init(loop, worker, "b", 0);
+    green_coroutine_t c = green_coroutine_init(loop, worker, "c", 0);
+    check_ne(a, NULL);
+    check_ne(b, NULL);
+    check_ne(c, NULL);
+
+    // Each tick runs one batch.
+    check_eq(green_loop_run_once(loop), 0);
+    trace[traced] = '\0';
+    check_str_eq(trace, "abc");
+
+    // Run until all coroutines are done.
+    check_eq(green_loop_run(loop), 0);
+    trace[traced] = '\0';
+    check_str_eq(trace, "abcabcabc");
+    check_eq(green_coroutine_result(a), 'a');
+    check_eq(green_coroutine_result(b), 'b');
+    check_eq(green_coroutine_result(c), 'c');
+    check_eq(green_coroutine_release(a), 0); a = NULL;
+    check_eq(green_coroutine_release(b), 0); b = NULL;
+    check_eq(green_coroutine_release(c), 0); c = NULL;
+
+    // Coroutines can be released before they run (fire and forget).
+    traced = 0;
+    a = green_coroutine_init(loop, worker, "x", 0);
+    check_ne(a, NULL);
+    check_eq(green_coroutine_release(a), 0); a = NULL;
+    check_eq(green_loop_run(loop), 0);
+    trace[traced] = '\0';
+    check_str_eq(trace, "xxx");
+
+    // Run until a future completes.
+    green_future_t f = green_future_init(loop);
+    check_ne(f, NULL);
+    a = green_coroutine_init(loop, completer, f, 0);
+    check_ne(a, NULL);
+    check_eq(green_loop_run_until(loop, f), 0);
+    check_ne(green_future_done(f), 0);
+    int i = 0;
+    check_eq(green_future_result(f, NULL, &i), 0);
+    check_eq(i, 42);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_release(a), 0); a = NULL;
+
+    // Future must belong to the loop.
+    green_loop_t loop2 = green_loop_init();
+    check_eq(green_loop_run_until(loop2, f), GREEN_EINVAL);
+    check_eq(green_loop_release(loop2), 0); loop2 = NULL;
+    check_eq(green_future_release(f), 0); f = NULL;
+
+    // Loop gives up if nothing can complete the future.
+    f = green_future_init(loop);
+    check_ne(f, NULL);
+    check_eq(green_loop_run_until(loop, f), GREEN_EBUSY);
+    check_eq(green_future_release(f), 0); f = NULL;
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+
+static green_future_t futures[3];
+
+// Complete futures in reverse order, one per tick.
+int producer(green_loop_t loop, void * object)
+{
+    for (int i = 2; i >= 0; --i) {
+        check_eq(green_yield(loop, NULL), 0);
+        check_eq(green_future_set_result(futures[i], NULL, i), 0);
+    }
+    return 0;
+}
+
+int consumer(green_loop_t loop, void * object)
+{
+    green_poller_t poller = object;
+    int order = 0;
+    for (int i = 2; i >= 0; --i) {
+        green_future_t f = green_select(poller);
+        check_eq(f, futures[i]);
+        int j = -1;
+        check_eq(green_future_result(f, NULL, &j), 0);
+        order = order * 10 + j;
+    }
+
+    // Nothing left to wait for.
+    check_eq(green_select(poller), NULL);
+    return order;
+}
+
+int selector(green_loop_t loop, void * object)
+{
+    return green_select(object) == futures[0];
+}
+
+int test(green_loop_t loop)
+{
+    // Poller is required.
+    check_eq(green_select(NULL), NULL);
+
+    green_poller_t poller = green_poller_init(loop, 3);
+    check_ne(poller, NULL);
+
+    // Empty poller never blocks.
+    check_eq(green_select(poller), NULL);
+
+    // Completed futures are returned right away.
+    futures[0] = green_future_init(loop);
+    check_ne(futures[0], NULL);
+    check_eq(green_future_set_result(futures[0], NULL, 0), 0);
+    check_eq(green_poller_add(poller, futures[0]), 0);
+    check_eq(green_select(poller), futures[0]);
+    check_eq(green_future_release(futures[0]), 0);
+
+    // Blocked coroutine wakes up when a future in its poller completes.
+    for (int i = 0; i < 3; ++i) {
+        futures[i] = green_future_init(loop);
+        check_ne(futures[i], NULL);
+        check_eq(green_poller_add(poller, futures[i]), 0);
+    }
+    green_coroutine_t c = green_coroutine_init(loop, consumer, poller, 0);
+    green_coroutine_t p = green_coroutine_init(loop, producer, NULL, 0);
+    check_ne(c, NULL);
+    check_ne(p, NULL);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_result(c), 210);
+    check_eq(green_coroutine_release(c), 0); c = NULL;
+    check_eq(green_coroutine_release(p), 0); p = NULL;
+    for (int i = 0; i < 3; ++i) {
+        check_eq(green_future_release(futures[i]), 0); futures[i] = NULL;
+    }
+
+    // Selecting from the loop itself runs coroutines until one completes.
+    for (int i = 0; i < 3; ++i) {
+        futures[i] = green_future_init(loop);
+        check_ne(futures[i], NULL);
+        check_eq(green_poller_add(poller, futures[i]), 0);
+    }
+    p = green_coroutine_init(loop, producer, NULL, 0);
+    check_ne(p, NULL);
+    check_eq(green_select(poller), futures[2]);
+    check_eq(green_select(poller), futures[1]);
+    check_eq(green_select(poller), futures[0]);
+    check_eq(green_coroutine_result(p), 0);
+    check_eq(green_coroutine_release(p), 0); p = NULL;
+
+    for (int i = 0; i < 3; ++i) {
+        check_eq(green_future_release(futures[i]), 0); futures[i] = NULL;
+    }
+
+    // Loop gives up when no coroutine can complete the future.
+    futures[0] = green_future_init(loop);
+    check_ne(futures[0], NULL);
+    check_eq(green_poller_add(poller, futures[0]), 0);
+    check_eq(green_select(poller), NULL);
+    check_eq(green_poller_used(poller), 1);
+    check_eq(green_future_release(futures[0]), 0); futures[0] = NULL;
+
+    // Only one coroutine waits on a poller, and an early resume doesn't
+    // wake it up for good.
+    futures[0] = green_future_init(loop);
+    check_ne(futures[0], NULL);
+    check_eq(green_poller_add(poller, futures[0]), 0);
+    c = green_coroutine_init(loop, selector, poller, 0);
+    p = green_coroutine_init(loop, selector, poller, 0);
+    check_eq(green_loop_run_once(loop), 0);
+    check_eq(green_coroutine_result(p), 0);
+    check_eq(green_yield(loop, c), 0);
+    check_eq(green_yield(loop, c), 0);
+    check_eq(green_future_set_result(futures[0], NULL, 0), 0);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_result(c), 1);
+    check_eq(green_coroutine_release(c), 0); c = NULL;
+    check_eq(green_coroutine_release(p), 0); p = NULL;
+    check_eq(green_future_release(futures[0]), 0); futures[0] = NULL;
+
+    check_eq(green_poller_release(poller), 0); poller = NULL;
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
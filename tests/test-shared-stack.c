@@ -0,0 +1,127 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include "configure.h"
+
+#define COROS 1000
+
+static green_sem_t sem = NULL;
+static green_channel_t channel = NULL;
+static int finished = 0;
+static int received = 0;
+
+// Keep some data on the stack across everything that blocks.
+int parker(green_loop_t loop, void * object)
+{
+    const int id = (int)(intptr_t)object;
+    volatile int frame[64];
+    for (int i = 0; i < 64; ++i) {
+        frame[i] = id + i;
+    }
+    check_eq(green_sem_wait(sem), 0);
+    check_eq(green_yield(loop, NULL), 0);
+    int value = 0;
+    check_eq(green_channel_recv(channel, NULL, &value), 0);
+    received += value;
+    for (int i = 0; i < 64; ++i) {
+        check_eq(frame[i], id + i);
+    }
+    ++finished;
+    return id;
+}
+
+// Use about `depth` KiB of stack, blocking at the bottom.
+static int recurse(green_loop_t loop, int depth)
+{
+    volatile char frame[1024];
+    frame[0] = 1;
+    if (depth == 0) {
+        check_eq(green_yield(loop, NULL), 0);
+        return 0;
+    }
+    return recurse(loop, depth - 1) + depth * frame[0];
+}
+
+int deep(green_loop_t loop, void * object)
+{
+    return recurse(loop, (int)(intptr_t)object);
+}
+
+#if GREEN_USE_ASMCONTEXT
+// Stack memory held by `loop`.
+static size_t stacks(green_loop_t loop)
+{
+    green_memory_stats_t stats;
+    check_eq(green_loop_memory_stats(loop, &stats), 0);
+    return stats.categories[GREEN_MEMORY_STACKS].bytes;
+}
+#endif
+
+int test(green_loop_t loop)
+{
+    static green_coroutine_t coros[COROS];
+
+    // Arguments are required.
+    check_eq(green_loop_set_shared_stack(NULL, 64 * 1024), GREEN_EINVAL);
+    check_eq(green_loop_set_shared_stack(loop, 0), GREEN_EINVAL);
+
+    sem = green_sem_init(loop, 0);
+    channel = green_channel_init(loop, 0);
+
+    // Lots of blocked coroutines share one stack, with a few coroutines that
+    // have their own stack in between.
+#if GREEN_USE_ASMCONTEXT
+    const size_t before = stacks(loop);
+#endif
+    for (int i = 0; i < COROS; ++i) {
+        const size_t size = (i % 100)? GREEN_STACK_SHARED : 0;
+        coros[i] = green_coroutine_init(loop, parker, (void*)(intptr_t)i,
+                                        size);
+        check_ne(coros[i], NULL);
+    }
+    check_eq(green_loop_run_once(loop), 0);
+#if GREEN_USE_ASMCONTEXT
+    check_lt(stacks(loop) - before, COROS * 4096);
+    check_eq(green_loop_set_shared_stack(loop, 64 * 1024), GREEN_EBUSY);
+#endif
+
+    // Everything is still there when they wake up, in any order.
+    for (int i = 0; i < COROS; ++i) {
+        check_eq(green_sem_post(sem), 0);
+    }
+    check_eq(green_loop_run_once(loop), 0);
+    for (int i = COROS - 1; i >= 0; --i) {
+        check_eq(green_channel_send(channel, NULL, i), 0);
+    }
+    check_eq(green_loop_run(loop), 0);
+    check_eq(finished, COROS);
+    check_eq(received, COROS * (COROS - 1) / 2);
+    for (int i = 0; i < COROS; ++i) {
+        check_eq(green_coroutine_result(coros[i]), i);
+        check_eq(green_coroutine_release(coros[i]), 0);
+    }
+
+    // Deep stacks are copied in and out as needed.
+    check_eq(green_loop_set_shared_stack(loop, 512 * 1024), 0);
+    const int depths[] = {100, 200, 3};
+    for (int i = 0; i < 3; ++i) {
+        coros[i] = green_coroutine_init(loop, deep,
+                                        (void*)(intptr_t)depths[i],
+                                        GREEN_STACK_SHARED);
+        check_ne(coros[i], NULL);
+    }
+    check_eq(green_loop_run(loop), 0);
+    for (int i = 0; i < 3; ++i) {
+        check_eq(green_coroutine_result(coros[i]),
+                 depths[i] * (depths[i] + 1) / 2);
+        check_eq(green_coroutine_release(coros[i]), 0);
+    }
+
+    check_eq(green_channel_release(channel), 0);
+    check_eq(green_sem_release(sem), 0);
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -0,0 +1,133 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include <unistd.h>
+
+#define KIB ((size_t)1024)
+
+// Use about `depth` KiB of stack.
+static int recurse(int depth)
+{
+    volatile char frame[1024];
+    frame[0] = 1;
+    if (depth == 0) {
+        return 0;
+    }
+    return recurse(depth - 1) + depth * frame[0];
+}
+
+int deepcoroutine(green_loop_t loop, void * object)
+{
+    return recurse((int)(intptr_t)object);
+}
+
+// Stack memory held by `loop`.
+static size_t stacks(green_loop_t loop)
+{
+    green_memory_stats_t stats;
+    check_eq(green_loop_memory_stats(loop, &stats), 0);
+    return stats.categories[GREEN_MEMORY_STACKS].bytes;
+}
+
+// Run a coroutine to completion, return the size of its stack mapping.
+static size_t run(green_loop_t loop, green_coroutine_t coro, size_t before)
+{
+    check_ne(coro, NULL);
+    const size_t size = stacks(loop) - before;
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_release(coro), 0);
+    return size;
+}
+
+// Each function is one call site.
+static size_t shallow(green_loop_t loop, size_t stack_size)
+{
+    const size_t before = stacks(loop);
+    return run(loop, green_coroutine_init(loop, deepcoroutine,
+                                          (void*)(intptr_t)2, stack_size),
+               before);
+}
+
+static size_t deep(green_loop_t loop)
+{
+    const size_t before = stacks(loop);
+    return run(loop, green_coroutine_init(loop, deepcoroutine,
+                                          (void*)(intptr_t)24, 0),
+               before);
+}
+
+// Find the call site that spawned `count` coroutines.
+static const green_stack_site_t * find(const green_stack_site_t * sites,
+                                       size_t size, size_t count)
+{
+    for (size_t i = 0; i < size; ++i) {
+        if (sites[i].count == count) {
+            return &sites[i];
+        }
+    }
+    return NULL;
+}
+
+int test(green_loop_t loop)
+{
+    green_stack_site_t sites[4];
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t initial = shallow(loop, 0);
+
+    // Arguments are required.
+    check_eq(green_loop_stack_profile(NULL, 0), GREEN_EINVAL);
+    check_eq(green_loop_stack_profile(loop, 4), GREEN_EINVAL);
+    check_eq(green_loop_stack_sites(NULL, sites, 4), 0);
+
+    // Nothing is measured by default.
+    check_eq(green_loop_stack_sites(loop, sites, 4), 0);
+
+    // Keep stacks out of the cache so the memory stats show their size.
+    check_eq(green_loop_set_cache_limits(loop, 0, 0), 0);
+
+    // Measuring alone doesn't change stack sizes.
+    check_eq(green_loop_stack_profile(loop, GREEN_STACK_MEASURE), 0);
+    for (int i = 0; i < 20; ++i) {
+        check_eq(shallow(loop, 0), initial);
+    }
+    for (int i = 0; i < 5; ++i) {
+        check_eq(deep(loop), initial);
+    }
+
+    // High-water marks are aggregated by call site.
+    check_eq(green_loop_stack_sites(loop, NULL, 0), 2);
+    check_eq(green_loop_stack_sites(loop, sites, 1), 2);
+    check_eq(green_loop_stack_sites(loop, sites, 4), 2);
+    const green_stack_site_t * site = find(sites, 2, 20);
+    check_ne(site, NULL);
+    check_ge(site->max, 2 * KIB);
+    check_lt(site->max, 16 * KIB);
+    check_gt(site->size, site->max);
+    check_lt(site->size, initial);
+    const size_t learned = site->size;
+    site = find(sites, 2, 5);
+    check_ne(site, NULL);
+    check_ge(site->max, 24 * KIB);
+    check_lt(site->max, 64 * KIB);
+    check_eq(site->size, 0);
+
+    // Adaptive sizing uses the learned size once there are enough samples.
+    check_eq(green_loop_stack_profile(loop, GREEN_STACK_ADAPT), 0);
+    check_eq(shallow(loop, 0), learned + page);
+    check_eq(deep(loop), initial);
+
+    // Explicit stack sizes are honored.
+    check_eq(shallow(loop, 256 * KIB), 256 * KIB + page);
+
+    // Disabling keeps what was learned.
+    check_eq(green_loop_stack_profile(loop, 0), 0);
+    check_eq(shallow(loop, 0), initial);
+    check_eq(green_loop_stack_sites(loop, sites, 4), 2);
+    check_ne(find(sites, 2, 22), NULL);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -0,0 +1,88 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Use about `depth` KiB of stack.
+static int recurse(int depth)
+{
+    volatile char frame[1024];
+    frame[0] = 1;
+    if (depth == 0) {
+        return 0;
+    }
+    return recurse(depth - 1) + depth * frame[0];
+}
+
+int deepcoroutine(green_loop_t loop, void * object)
+{
+    return recurse(*(int*)object);
+}
+
+int idlecoroutine(green_loop_t loop, void * object)
+{
+    check_eq(green_yield(loop, NULL), 0);
+    return 0;
+}
+
+int test(green_loop_t loop)
+{
+    green_coroutine_t coro = NULL;
+
+    // Explicit stack sizes are honored (256 KiB of 1 MiB).
+    int depth = 256;
+    coro = green_coroutine_init(loop, deepcoroutine, &depth, 1024 * 1024);
+    check_ne(coro, NULL);
+    check_eq(green_yield(loop, coro), 0);
+    check_eq(green_coroutine_result(coro), (depth * (depth + 1)) / 2);
+    check_eq(green_coroutine_release(coro), 0);
+    coro = NULL;
+
+    // Stack sizes that are not a multiple of the page size are fine.
+    depth = 4;
+    coro = green_coroutine_init(loop, deepcoroutine, &depth, 10000);
+    check_ne(coro, NULL);
+    check_eq(green_yield(loop, coro), 0);
+    check_eq(green_coroutine_result(coro), (depth * (depth + 1)) / 2);
+    check_eq(green_coroutine_release(coro), 0);
+    coro = NULL;
+
+    // Large stacks are only committed when used, so lots of mostly idle
+    // coroutines with large stacks are cheap.
+    green_coroutine_t coros[256];
+    for (int i = 0; i < 256; ++i) {
+        coros[i] = green_coroutine_init(loop, idlecoroutine, NULL,
+                                        8 * 1024 * 1024);
+        check_ne(coros[i], NULL);
+        check_eq(green_yield(loop, coros[i]), 0);
+    }
+    for (int i = 0; i < 256; ++i) {
+        check_eq(green_yield(loop, coros[i]), 0);
+        check_eq(green_coroutine_result(coros[i]), 0);
+        check_eq(green_coroutine_release(coros[i]), 0);
+        coros[i] = NULL;
+    }
+
+    // Stack overflow hits the guard page instead of corrupting memory.
+    pid_t pid = fork();
+    check_ne(pid, -1);
+    if (pid == 0) {
+        depth = 64;
+        coro = green_coroutine_init(loop, deepcoroutine, &depth, 16 * 1024);
+        green_yield(loop, coro);
+        _exit(EXIT_SUCCESS);
+    }
+    int status = 0;
+    check_eq(waitpid(pid, &status, 0), pid);
+    check(WIFSIGNALED(status));
+    check(WTERMSIG(status) == SIGSEGV || WTERMSIG(status) == SIGBUS);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
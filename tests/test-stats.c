@@ -0,0 +1,113 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+
+#define MILLISECOND ((int64_t)1000000)
+
+int yielder(green_loop_t loop, void * object)
+{
+    check_eq(green_yield(loop, NULL), 0);
+    check_eq(green_yield(loop, NULL), 0);
+    return 0;
+}
+
+int selector(green_loop_t loop, void * object)
+{
+    green_poller_t poller = green_poller_init(loop, 1);
+    check_eq(green_poller_add(poller, object), 0);
+    check_eq(green_select(poller), object);
+    check_eq(green_poller_release(poller), 0);
+    return 0;
+}
+
+int completer(green_loop_t loop, void * object)
+{
+    check_eq(green_sleep(loop, 5 * MILLISECOND), 0);
+    check_eq(green_future_set_result(object, NULL, 0), 0);
+    return 0;
+}
+
+int test(green_loop_t loop)
+{
+    green_loop_stats_t stats;
+    green_coroutine_t coros[3];
+
+    // Arguments are required.
+    check_eq(green_loop_stats(NULL, &stats), GREEN_EINVAL);
+    check_eq(green_loop_stats(loop, NULL), GREEN_EINVAL);
+
+    // Coroutines are counted as they start and finish.
+    check_eq(green_loop_stats(loop, &stats), 0);
+    check_eq(stats.spawned, 0);
+    check_eq(stats.switches, 0);
+    for (int i = 0; i < 3; ++i) {
+        coros[i] = green_coroutine_init(loop, yielder, NULL, 0);
+    }
+    check_eq(green_loop_run_once(loop), 0);
+    check_eq(green_loop_stats(loop, &stats), 0);
+    check_eq(stats.spawned, 3);
+    check_eq(stats.live, 3);
+    check_eq(stats.finished, 0);
+    check_eq(stats.switches, 3);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_loop_stats(loop, &stats), 0);
+    check_eq(stats.live, 0);
+    check_eq(stats.finished, 3);
+    check_eq(stats.switches, 9);
+    check_gt(stats.busy, 0);
+    for (int i = 0; i < 3; ++i) {
+        check_eq(green_coroutine_release(coros[i]), 0);
+    }
+
+    // Futures and pollers.
+    green_future_t f1 = green_future_init(loop);
+    green_future_t f2 = green_future_init(loop);
+    green_poller_t poller = green_poller_init(loop, 2);
+    check_eq(green_poller_add(poller, f1), 0);
+    check_eq(green_poller_add(poller, f2), 0);
+    check_eq(green_future_set_result(f1, NULL, 0), 0);
+    check_eq(green_future_set_error(f2, GREEN_EBADFD), 0);
+    check_eq(green_future_cancel(f2), GREEN_EBADFD);
+    green_future_t f3 = NULL;
+    check_ne(green_poller_pop(poller), NULL);
+    check_eq(green_poller_pop_many(poller, &f3, 1), 1);
+    check_ne(f3, NULL);
+    f3 = green_future_init(loop);
+    check_eq(green_future_cancel(f3), 0);
+    check_eq(green_loop_stats(loop, &stats), 0);
+    check_eq(stats.futures_created, 3);
+    check_eq(stats.futures_completed, 2);
+    check_eq(stats.futures_canceled, 1);
+    check_eq(stats.poller_adds, 2);
+    check_eq(stats.poller_pops, 2);
+    check_eq(green_future_release(f3), 0);
+    check_eq(green_future_release(f2), 0);
+    check_eq(green_future_release(f1), 0);
+    check_eq(green_poller_release(poller), 0);
+
+    // Time blocked in select goes in a histogram, the loop is idle meanwhile.
+    green_future_t future = green_future_init(loop);
+    coros[0] = green_coroutine_init(loop, selector, future, 0);
+    coros[1] = green_coroutine_init(loop, completer, future, 0);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_loop_stats(loop, &stats), 0);
+    check_ge(stats.idle, 4 * MILLISECOND);
+    uint64_t total = 0;
+    for (int i = 0; i < GREEN_STATS_BUCKETS; ++i) {
+        total += stats.blocked[i];
+        // At least 5 ms, i.e. 2^12 microseconds or more.
+        if (i < 13) {
+            check_eq(stats.blocked[i], 0);
+        }
+    }
+    check_eq(total, 1);
+    check_eq(green_coroutine_release(coros[1]), 0);
+    check_eq(green_coroutine_release(coros[0]), 0);
+    check_eq(green_future_release(future), 0);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -0,0 +1,227 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+
+#define WORKERS 5
+
+static green_mutex_t mutex = NULL;
+static green_cond_t cond = NULL;
+static green_sem_t sem = NULL;
+static green_waitgroup_t group = NULL;
+
+static int inside = 0;
+static int peak = 0;
+static int order[WORKERS];
+static int finished = 0;
+static int items = 0;
+
+// Hold the mutex across several yields.
+int locker(green_loop_t loop, void * object)
+{
+    check_eq(green_mutex_lock(mutex), 0);
+    check_eq(green_mutex_lock(mutex), GREEN_EALREADY);
+    order[finished++] = (int)(intptr_t)object;
+    check_eq(inside++, 0);
+    for (int i = 0; i < 3; ++i) {
+        check_eq(green_yield(loop, NULL), 0);
+    }
+    --inside;
+    check_eq(green_mutex_unlock(mutex), 0);
+    check_eq(green_waitgroup_done(group), 0);
+    return 0;
+}
+
+// Call an unlock without holding the mutex.
+int intruder(green_loop_t loop, void * object)
+{
+    check_eq(green_mutex_trylock(mutex), GREEN_EBUSY);
+    check_eq(green_mutex_unlock(mutex), GREEN_EBADFD);
+    return 0;
+}
+
+// Wait until an item is available, then take it.
+int consumer(green_loop_t loop, void * object)
+{
+    check_eq(green_mutex_lock(mutex), 0);
+    while (items == 0) {
+        check_eq(green_cond_wait(cond, mutex), 0);
+        // We're back with the mutex held.
+        check_eq(green_mutex_trylock(mutex), GREEN_EBUSY);
+    }
+    --items;
+    ++finished;
+    check_eq(green_mutex_unlock(mutex), 0);
+    check_eq(green_waitgroup_done(group), 0);
+    return 0;
+}
+
+int producer(green_loop_t loop, void * object)
+{
+    check_eq(green_mutex_lock(mutex), 0);
+    items += 2;
+    check_eq(green_cond_signal(cond), 0);
+    check_eq(green_cond_signal(cond), 0);
+    check_eq(green_mutex_unlock(mutex), 0);
+    check_eq(green_yield(loop, NULL), 0);
+    check_eq(green_mutex_lock(mutex), 0);
+    items += WORKERS - 2;
+    check_eq(green_cond_broadcast(cond), 0);
+    check_eq(green_mutex_unlock(mutex), 0);
+    return 0;
+}
+
+// Count how many workers get past the semaphore at the same time.
+int limited(green_loop_t loop, void * object)
+{
+    check_eq(green_sem_wait(sem), 0);
+    if (++inside > peak) {
+        peak = inside;
+    }
+    for (int i = 0; i < 3; ++i) {
+        check_eq(green_yield(loop, NULL), 0);
+    }
+    --inside;
+    check_eq(green_sem_post(sem), 0);
+    check_eq(green_waitgroup_done(group), 0);
+    return 0;
+}
+
+static void spawn(green_loop_t loop, int(*method)(green_loop_t,void*),
+                  int count, green_coroutine_t * coros)
+{
+    for (int i = 0; i < count; ++i) {
+        coros[i] = green_coroutine_init(loop, method, (void*)(intptr_t)i, 0);
+        check_ne(coros[i], NULL);
+    }
+}
+
+static void release(green_coroutine_t * coros, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        check_eq(green_coroutine_release(coros[i]), 0);
+    }
+}
+
+int test(green_loop_t loop)
+{
+    green_coroutine_t coros[WORKERS + 2];
+
+    // Arguments are required.
+    check_eq(green_mutex_init(NULL), NULL);
+    check_eq(green_cond_init(NULL), NULL);
+    check_eq(green_sem_init(NULL, 1), NULL);
+    check_eq(green_waitgroup_init(NULL), NULL);
+    check_eq(green_mutex_lock(NULL), GREEN_EINVAL);
+    check_eq(green_mutex_trylock(NULL), GREEN_EINVAL);
+    check_eq(green_mutex_unlock(NULL), GREEN_EINVAL);
+    check_eq(green_mutex_acquire(NULL), GREEN_EINVAL);
+    check_eq(green_mutex_release(NULL), GREEN_EINVAL);
+    check_eq(green_cond_wait(NULL, NULL), GREEN_EINVAL);
+    check_eq(green_cond_signal(NULL), GREEN_EINVAL);
+    check_eq(green_cond_broadcast(NULL), GREEN_EINVAL);
+    check_eq(green_cond_release(NULL), GREEN_EINVAL);
+    check_eq(green_sem_wait(NULL), GREEN_EINVAL);
+    check_eq(green_sem_trywait(NULL), GREEN_EINVAL);
+    check_eq(green_sem_post(NULL), GREEN_EINVAL);
+    check_eq(green_sem_value(NULL), 0);
+    check_eq(green_sem_release(NULL), GREEN_EINVAL);
+    check_eq(green_waitgroup_add(NULL, 1), GREEN_EINVAL);
+    check_eq(green_waitgroup_done(NULL), GREEN_EINVAL);
+    check_eq(green_waitgroup_wait(NULL), GREEN_EINVAL);
+    check_eq(green_waitgroup_count(NULL), 0);
+    check_eq(green_waitgroup_release(NULL), GREEN_EINVAL);
+
+    mutex = green_mutex_init(loop);
+    check_ne(mutex, NULL);
+    cond = green_cond_init(loop);
+    check_ne(cond, NULL);
+    sem = green_sem_init(loop, 2);
+    check_ne(sem, NULL);
+    group = green_waitgroup_init(loop);
+    check_ne(group, NULL);
+
+    // Objects are reference counted.
+    check_eq(green_mutex_acquire(mutex), 0);
+    check_eq(green_mutex_release(mutex), 0);
+    check_eq(green_cond_acquire(cond), 0);
+    check_eq(green_cond_release(cond), 0);
+    check_eq(green_sem_acquire(sem), 0);
+    check_eq(green_sem_release(sem), 0);
+    check_eq(green_waitgroup_acquire(group), 0);
+    check_eq(green_waitgroup_release(group), 0);
+
+    // Mutex must be held to unlock it or wait on a condition.
+    check_eq(green_mutex_unlock(mutex), GREEN_EBADFD);
+    check_eq(green_cond_wait(cond, mutex), GREEN_EBADFD);
+
+    // Empty wait group doesn't block.
+    check_eq(green_waitgroup_count(group), 0);
+    check_eq(green_waitgroup_done(group), GREEN_EBADFD);
+    check_eq(green_waitgroup_wait(group), 0);
+
+    // Mutex is handed to waiters in order; the loop waits for all of them.
+    finished = 0;
+    check_eq(green_waitgroup_add(group, WORKERS), 0);
+    check_eq(green_waitgroup_count(group), WORKERS);
+    spawn(loop, locker, WORKERS, coros);
+    spawn(loop, intruder, 1, coros + WORKERS);
+    check_eq(green_waitgroup_wait(group), 0);
+    check_eq(green_waitgroup_count(group), 0);
+    for (int i = 0; i < WORKERS; ++i) {
+        check_eq(order[i], i);
+    }
+    check_eq(green_loop_run(loop), 0);
+    release(coros, WORKERS + 1);
+
+    // Lock from the loop itself.
+    check_eq(green_mutex_lock(mutex), 0);
+    check_eq(green_mutex_trylock(mutex), GREEN_EBUSY);
+    check_eq(green_mutex_unlock(mutex), 0);
+    check_eq(green_mutex_trylock(mutex), 0);
+    check_eq(green_mutex_unlock(mutex), 0);
+
+    // Consumers wake up with the mutex held.
+    finished = 0;
+    check_eq(green_waitgroup_add(group, WORKERS), 0);
+    spawn(loop, consumer, WORKERS, coros);
+    spawn(loop, producer, 1, coros + WORKERS);
+    check_eq(green_waitgroup_wait(group), 0);
+    check_eq(finished, WORKERS);
+    check_eq(items, 0);
+    check_eq(green_loop_run(loop), 0);
+    release(coros, WORKERS + 1);
+
+    // Semaphore caps concurrency.
+    inside = 0;
+    peak = 0;
+    check_eq(green_waitgroup_add(group, WORKERS), 0);
+    spawn(loop, limited, WORKERS, coros);
+    check_eq(green_waitgroup_wait(group), 0);
+    check_eq(peak, 2);
+    check_eq(green_sem_value(sem), 2);
+    check_eq(green_loop_run(loop), 0);
+    release(coros, WORKERS);
+
+    // Blocking with nothing left to run doesn't hang.
+    check_eq(green_sem_trywait(sem), 0);
+    check_eq(green_sem_wait(sem), 0);
+    check_eq(green_sem_trywait(sem), GREEN_EBUSY);
+    check_eq(green_sem_wait(sem), GREEN_EBUSY);
+    check_eq(green_sem_post(sem), 0);
+    check_eq(green_sem_post(sem), 0);
+    check_eq(green_sem_value(sem), 2);
+    check_eq(green_waitgroup_add(group, 1), 0);
+    check_eq(green_waitgroup_wait(group), GREEN_EBUSY);
+    check_eq(green_waitgroup_done(group), 0);
+
+    check_eq(green_waitgroup_release(group), 0);
+    check_eq(green_sem_release(sem), 0);
+    check_eq(green_cond_release(cond), 0);
+    check_eq(green_mutex_release(mutex), 0);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
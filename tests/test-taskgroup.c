@@ -0,0 +1,260 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include <fcntl.h>
+#include <unistd.h>
+
+#define SECOND ((int64_t)1000000000)
+
+static green_channel_t channel = NULL;
+static green_sem_t sem = NULL;
+static green_mutex_t mutex = NULL;
+static green_cond_t cond = NULL;
+static int fds[2] = {-1, -1};
+static green_future_t pending = NULL;
+static int interrupted = 0;
+
+int sleeper(green_loop_t loop, void * object)
+{
+    check_eq(green_sleep(loop, 10 * SECOND), GREEN_ECANCELED);
+    // Canceled members don't block anymore.
+    check_eq(green_sleep(loop, 10 * SECOND), GREEN_ECANCELED);
+    ++interrupted;
+    return 0;
+}
+
+int selector(green_loop_t loop, void * object)
+{
+    green_poller_t poller = green_poller_init(loop, 1);
+    check_eq(green_poller_add(poller, pending), 0);
+    check_eq(green_select(poller), NULL);
+    check_eq(green_future_canceled(pending), 1);
+    check_eq(green_poller_used(poller), 0);
+    check_eq(green_poller_release(poller), 0);
+    ++interrupted;
+    return 0;
+}
+
+int receiver(green_loop_t loop, void * object)
+{
+    check_eq(green_channel_recv(channel, NULL, NULL), GREEN_ECANCELED);
+    check_eq(green_channel_recv(channel, NULL, NULL), GREEN_ECANCELED);
+    ++interrupted;
+    return 0;
+}
+
+int waiter(green_loop_t loop, void * object)
+{
+    check_eq(green_sem_wait(sem), GREEN_ECANCELED);
+    ++interrupted;
+    return 0;
+}
+
+int fd_selector(green_loop_t loop, void * object)
+{
+    green_future_t future = green_fd_readable(loop, fds[0]);
+    check_ne(future, NULL);
+    green_poller_t poller = green_poller_init(loop, 1);
+    check_eq(green_poller_add(poller, future), 0);
+    check_eq(green_select(poller), NULL);
+    check_eq(green_future_canceled(future), 1);
+    check_eq(green_poller_release(poller), 0);
+    check_eq(green_future_release(future), 0);
+    ++interrupted;
+    return 0;
+}
+
+int cond_waiter(green_loop_t loop, void * object)
+{
+    check_eq(green_mutex_lock(mutex), 0);
+    check_eq(green_cond_wait(cond, mutex), GREEN_ECANCELED);
+    // The mutex is held again, even if it takes a while.
+    check_eq(green_mutex_unlock(mutex), 0);
+    ++interrupted;
+    return 0;
+}
+
+int yielder(green_loop_t loop, void * object)
+{
+    check_eq(green_taskgroup_current(loop), object);
+    check_eq(green_taskgroup_join(object), GREEN_EINVAL);
+    check_eq(green_yield(loop, NULL), 0);
+    return 0;
+}
+
+int canceler(green_loop_t loop, void * object)
+{
+    check_eq(green_yield(loop, NULL), 0);
+    check_eq(green_taskgroup_cancel(object), 0);
+    check_eq(green_taskgroup_cancel(object), GREEN_EALREADY);
+    return 0;
+}
+
+// Spawn one of each kind of blocked member.
+static int spawn_blocked(green_taskgroup_t group, green_coroutine_t * coros)
+{
+    int (*methods[])(green_loop_t,void*) = {
+        sleeper, selector, receiver, waiter,
+    };
+    for (int i = 0; i < 4; ++i) {
+        coros[i] = green_taskgroup_spawn(group, methods[i], NULL, 0);
+        check_ne(coros[i], NULL);
+    }
+    return 4;
+}
+
+static void release(green_coroutine_t * coros, int count)
+{
+    for (int i = 0; i < count; ++i) {
+        check_eq(green_coroutine_release(coros[i]), 0);
+    }
+}
+
+int test(green_loop_t loop)
+{
+    green_coroutine_t coros[8];
+    int n = 0;
+
+    // Arguments are required.
+    check_eq(green_taskgroup_init(NULL, NULL), NULL);
+    check_eq(green_taskgroup_acquire(NULL), GREEN_EINVAL);
+    check_eq(green_taskgroup_release(NULL), GREEN_EINVAL);
+    check_eq(green_taskgroup_size(NULL), 0);
+    check_eq(green_taskgroup_current(NULL), NULL);
+    check_eq(green_taskgroup_current(loop), NULL);
+    check_eq(green_taskgroup_spawn(NULL, yielder, NULL, 0), NULL);
+    check_eq(green_taskgroup_join(NULL), GREEN_EINVAL);
+    check_eq(green_taskgroup_cancel(NULL), GREEN_EINVAL);
+    check_eq(green_taskgroup_canceled(NULL), GREEN_EINVAL);
+    check_eq(green_taskgroup_set_deadline(NULL, 0), GREEN_EINVAL);
+
+    channel = green_channel_init(loop, 1);
+    sem = green_sem_init(loop, 0);
+
+    // Members are joined together.
+    green_taskgroup_t group = green_taskgroup_init(loop, NULL);
+    check_ne(group, NULL);
+    check_eq(green_taskgroup_acquire(group), 0);
+    check_eq(green_taskgroup_release(group), 0);
+    check_eq(green_taskgroup_join(group), 0);
+    for (n = 0; n < 3; ++n) {
+        coros[n] = green_taskgroup_spawn(group, yielder, group, 0);
+        check_ne(coros[n], NULL);
+    }
+    check_eq(green_taskgroup_size(group), 3);
+    check_eq(green_taskgroup_join(group), 0);
+    check_eq(green_taskgroup_size(group), 0);
+    check_eq(green_taskgroup_canceled(group), 0);
+    release(coros, n);
+
+    // A deadline only runs while members do, so it doesn't hold up the loop.
+    check_eq(green_taskgroup_set_deadline(group, green_now() + 10 * SECOND), 0);
+    int64_t start = green_now();
+    check_eq(green_loop_run(loop), 0);
+    coros[0] = green_taskgroup_spawn(group, yielder, group, 0);
+    check_eq(green_loop_run(loop), 0);
+    check_lt(green_now() - start, SECOND);
+    release(coros, 1);
+
+    // Canceling wakes up blocked members.
+    interrupted = 0;
+    pending = green_future_init(loop);
+    n = spawn_blocked(group, coros);
+    coros[n++] = green_coroutine_init(loop, canceler, group, 0);
+    check_eq(green_taskgroup_join(group), GREEN_ECANCELED);
+    check_eq(interrupted, 4);
+    check_eq(green_taskgroup_canceled(group), 1);
+    check_eq(green_sem_value(sem), 0);
+    check_eq(green_loop_run(loop), 0);
+    release(coros, n);
+    check_eq(green_future_release(pending), 0);
+
+    // Canceled condition waits take the mutex back before returning.
+    interrupted = 0;
+    mutex = green_mutex_init(loop);
+    cond = green_cond_init(loop);
+    check_eq(green_taskgroup_release(group), 0);
+    group = green_taskgroup_init(loop, NULL);
+    coros[0] = green_taskgroup_spawn(group, cond_waiter, NULL, 0);
+    check_eq(green_loop_run_once(loop), 0);
+    check_eq(green_mutex_trylock(mutex), 0);
+    check_eq(green_taskgroup_cancel(group), 0);
+    check_eq(green_loop_run_once(loop), 0);
+    check_eq(green_taskgroup_size(group), 1);
+    check_eq(interrupted, 0);
+    check_eq(green_mutex_unlock(mutex), 0);
+    check_eq(green_taskgroup_join(group), GREEN_ECANCELED);
+    check_eq(interrupted, 1);
+    check_eq(green_mutex_trylock(mutex), 0);
+    check_eq(green_mutex_unlock(mutex), 0);
+    release(coros, 1);
+    check_eq(green_cond_release(cond), 0);
+    check_eq(green_mutex_release(mutex), 0);
+
+    // Canceled fd requests don't keep the loop alive.
+    interrupted = 0;
+    check_eq(pipe(fds), 0);
+    check_eq(fcntl(fds[0], F_SETFL, O_NONBLOCK), 0);
+    check_eq(green_taskgroup_release(group), 0);
+    group = green_taskgroup_init(loop, NULL);
+    coros[0] = green_taskgroup_spawn(group, fd_selector, NULL, 0);
+    check_eq(green_loop_run_once(loop), 0);
+    check_eq(green_taskgroup_cancel(group), 0);
+    check_eq(green_taskgroup_join(group), GREEN_ECANCELED);
+    check_eq(interrupted, 1);
+    check_eq(green_loop_run(loop), 0);
+    release(coros, 1);
+    check_eq(green_fd_detach(loop, fds[0]), 0);
+    close(fds[0]);
+    close(fds[1]);
+
+    // Canceled groups don't take new members.
+    check_eq(green_taskgroup_spawn(group, yielder, group, 0), NULL);
+    check_eq(green_taskgroup_release(group), 0);
+
+    // Cancellation reaches nested groups.
+    interrupted = 0;
+    pending = green_future_init(loop);
+    green_taskgroup_t parent = green_taskgroup_init(loop, NULL);
+    group = green_taskgroup_init(loop, parent);
+    check_ne(group, NULL);
+    n = spawn_blocked(group, coros);
+    check_eq(green_loop_run_once(loop), 0);
+    check_eq(green_taskgroup_size(group), 4);
+    check_eq(green_taskgroup_cancel(parent), 0);
+    check_eq(green_taskgroup_canceled(group), 1);
+    check_eq(green_taskgroup_join(group), GREEN_ECANCELED);
+    check_eq(interrupted, 4);
+    release(coros, n);
+    check_eq(green_future_release(pending), 0);
+    check_eq(green_taskgroup_release(group), 0);
+
+    // Groups nested in a canceled group start out canceled.
+    group = green_taskgroup_init(loop, parent);
+    check_eq(green_taskgroup_canceled(group), 1);
+    check_eq(green_taskgroup_release(group), 0);
+    check_eq(green_taskgroup_release(parent), 0);
+
+    // Deadline cancels the group.
+    interrupted = 0;
+    pending = green_future_init(loop);
+    group = green_taskgroup_init(loop, NULL);
+    check_eq(green_taskgroup_set_deadline(group, green_now() + SECOND/50), 0);
+    n = spawn_blocked(group, coros);
+    start = green_now();
+    check_eq(green_taskgroup_join(group), GREEN_ECANCELED);
+    check_ge(green_now() - start, SECOND/50);
+    check_lt(green_now() - start, SECOND);
+    check_eq(interrupted, 4);
+    release(coros, n);
+    check_eq(green_future_release(pending), 0);
+    check_eq(green_taskgroup_release(group), 0);
+
+    check_eq(green_sem_release(sem), 0);
+    check_eq(green_channel_release(channel), 0);
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -0,0 +1,116 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+
+static const int64_t MS = 1000000;
+
+static int order = 0;
+
+// Sleep for the given number of milliseconds, then record the wake-up order.
+int sleeper(green_loop_t loop, void * object)
+{
+    const int delay = (int)(intptr_t)object;
+    const int64_t start = green_now();
+    check_eq(green_sleep(loop, delay * MS), 0);
+    check_ge(green_now() - start, delay * MS);
+    order = order * 10 + (delay / 10);
+    return 0;
+}
+
+// Wait for a future with a timeout.
+int waiter(green_loop_t loop, void * object)
+{
+    green_poller_t poller = object;
+    const int64_t start = green_now();
+    check_eq(green_select_ex(poller, 20 * MS), NULL);
+    check_ge(green_now() - start, 20 * MS);
+    return 1 + (green_select_ex(poller, 1000 * MS) != NULL);
+}
+
+int test(green_loop_t loop)
+{
+    // Arguments are required.
+    check_eq(green_timer_future(NULL, 0), NULL);
+    check_eq(green_sleep(NULL, 0), GREEN_EINVAL);
+    check_eq(green_select_ex(NULL, 0), NULL);
+
+    // Clock is monotonic.
+    const int64_t start = green_now();
+    check_gt(start, 0);
+    check_ge(green_now(), start);
+
+    // Timers never fire early, even when sleeping from the loop itself.
+    check_eq(green_sleep(loop, 5 * MS), 0);
+    check_ge(green_now() - start, 5 * MS);
+    green_future_t f = green_timer_future(loop, green_now() + 10 * MS);
+    check_ne(f, NULL);
+    check_eq(green_future_done(f), 0);
+    const int64_t deadline = green_now() + 5 * MS;
+    check_eq(green_loop_run_until(loop, f), 0);
+    check_ge(green_now(), deadline);
+    check_eq(green_future_release(f), 0);
+
+    // Expired deadlines fire right away.
+    f = green_timer_future(loop, 0);
+    check_eq(green_loop_run_until(loop, f), 0);
+    check_eq(green_future_release(f), 0);
+
+    // Sleeping coroutines wake up by deadline, including timers that move
+    // down the wheel.
+    green_coroutine_t coros[4];
+    const int delays[4] = {150, 10, 70, 30};
+    for (int i = 0; i < 4; ++i) {
+        coros[i] = green_coroutine_init(loop, sleeper,
+                                        (void*)(intptr_t)delays[i], 0);
+        check_ne(coros[i], NULL);
+    }
+    check_eq(green_loop_run(loop), 0);
+    check_eq(order, 1385);
+    for (int i = 0; i < 4; ++i) {
+        check_eq(green_coroutine_release(coros[i]), 0);
+    }
+
+    // Canceled timers go away right away, so the loop has nothing to do.
+    green_memory_stats_t stats;
+    green_future_t futures[1000];
+    for (int i = 0; i < 1000; ++i) {
+        futures[i] = green_timer_future(loop, green_now() + (i + 1) * 1000 * MS);
+        check_ne(futures[i], NULL);
+    }
+    check_eq(green_loop_memory_stats(loop, &stats), 0);
+    check_eq(stats.categories[GREEN_MEMORY_TIMERS].objects, 1000);
+    for (int i = 0; i < 1000; ++i) {
+        check_eq(green_future_cancel(futures[i]), 0);
+        check_eq(green_future_release(futures[i]), 0);
+    }
+    check_eq(green_loop_memory_stats(loop, &stats), 0);
+    check_eq(stats.categories[GREEN_MEMORY_TIMERS].objects, 0);
+    check_eq(green_loop_run_once(loop), 0);
+
+    // Select times out from the loop itself.
+    green_poller_t poller = green_poller_init(loop, 1);
+    check_ne(poller, NULL);
+    f = green_future_init(loop);
+    check_ne(f, NULL);
+    check_eq(green_poller_add(poller, f), 0);
+    check_eq(green_select_ex(poller, 0), NULL);
+    check_eq(green_select_ex(poller, 5 * MS), NULL);
+
+    // Select times out in a coroutine, or returns the future that completes
+    // before the timeout.
+    green_coroutine_t c = green_coroutine_init(loop, waiter, poller, 0);
+    check_ne(c, NULL);
+    check_eq(green_sleep(loop, 30 * MS), 0);
+    check_eq(green_future_set_result(f, NULL, 0), 0);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_result(c), 2);
+    check_eq(green_coroutine_release(c), 0);
+    check_eq(green_future_release(f), 0);
+    check_eq(green_poller_release(poller), 0);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
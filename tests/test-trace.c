@@ -0,0 +1,97 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include <unistd.h>
+#include "configure.h"
+
+int worker(green_loop_t loop, void * object)
+{
+    check_eq(green_yield(loop, NULL), 0);
+    return 0;
+}
+
+int test(green_loop_t loop)
+{
+    green_trace_event_t events[256];
+
+    // Arguments are required.
+    check_eq(green_loop_trace(NULL, GREEN_TRACE_ALL, 0), GREEN_EINVAL);
+    check_eq(green_loop_trace(loop, 8, 0), GREEN_EINVAL);
+    check_eq(green_loop_trace_read(NULL, events, 256), 0);
+    check_eq(green_loop_trace_dump(loop, -1), GREEN_EINVAL);
+
+#if GREEN_USE_TRACE
+    // Nothing is recorded until enabled.
+    check_eq(green_loop_trace_read(loop, events, 256), 0);
+    check_eq(green_loop_trace(loop, GREEN_TRACE_SCHEDULER, 100), 0);
+
+    green_coroutine_t coro = green_coroutine_init(loop, worker, NULL, 0);
+    check_ne(coro, NULL);
+    green_future_t f = green_future_init(loop);
+    check_eq(green_future_set_result(f, NULL, 0), 0);
+    check_eq(green_future_release(f), 0);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_release(coro), 0);
+
+    // Spawn, resume, suspend (yield), resume, stop.  Futures are off.
+    const uint32_t types[] = {
+        GREEN_TRACE_SPAWN, GREEN_TRACE_RESUME, GREEN_TRACE_SUSPEND,
+        GREEN_TRACE_RESUME, GREEN_TRACE_STOP,
+    };
+    size_t n = green_loop_trace_read(loop, events, 256);
+    check_eq(n, 5);
+    for (size_t i = 0; i < n; ++i) {
+        check_eq(events[i].type, types[i]);
+        check_ne(events[i].source, 0);
+        if (i > 0) {
+            check_ge(events[i].time, events[i-1].time);
+            check_eq(events[i].coro, events[1].coro);
+        }
+    }
+    check_eq(events[0].coro, 0);
+    check_eq(events[0].arg, events[1].coro);
+
+    // Ring keeps the most recent events.
+    check_eq(green_loop_trace(loop, GREEN_TRACE_ALL, 100), 0);
+    for (int i = 0; i < 200; ++i) {
+        f = green_future_init(loop);
+        check_eq(green_future_set_result(f, NULL, 0), 0);
+        check_eq(green_future_release(f), 0);
+    }
+    n = green_loop_trace_read(loop, events, 256);
+    check_eq(n, 128);
+    for (size_t i = 0; i < n; ++i) {
+        check_eq(events[i].type, GREEN_TRACE_COMPLETE);
+    }
+    check_eq(green_loop_trace_read(loop, events, 10), 10);
+
+    // Dump holds a header, the events and the source strings.
+    FILE * file = tmpfile();
+    check_ne(file, NULL);
+    check_eq(green_loop_trace_dump(loop, fileno(file)), 0);
+    rewind(file);
+    green_trace_header_t header;
+    check_eq(fread(&header, sizeof(header), 1, file), 1);
+    check_eq(memcmp(header.magic, GREEN_TRACE_MAGIC, 8), 0);
+    check_eq(header.format, GREEN_TRACE_FORMAT);
+    check_eq(header.events, 128);
+    check_eq(header.strings, 0);
+    check_eq(fclose(file), 0);
+
+    // Disabled categories stop recording.
+    check_eq(green_loop_trace(loop, 0, 0), 0);
+    f = green_future_init(loop);
+    check_eq(green_future_set_result(f, NULL, 0), 0);
+    check_eq(green_future_release(f), 0);
+    check_eq(green_loop_trace_read(loop, events, 256), 128);
+#else
+    // Tracing is compiled out.
+    check_eq(green_loop_trace(loop, GREEN_TRACE_ALL, 0), GREEN_EINVAL);
+#endif
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
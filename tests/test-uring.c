@@ -0,0 +1,159 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+// Wait for an operation to complete and get its result.
+static int complete(green_loop_t loop, green_future_t future)
+{
+    check_ne(future, NULL);
+    check_eq(green_loop_run_until(loop, future), 0);
+    int result = -1;
+    check_eq(green_future_result(future, NULL, &result), 0);
+    check_eq(green_future_release(future), 0);
+    return result;
+}
+
+static int listener;
+
+// Accept one connection and echo one message back.
+int server(green_loop_t loop, void * object)
+{
+    green_poller_t poller = green_poller_init(loop, 1);
+    check_ne(poller, NULL);
+
+    green_future_t f = green_accept(loop, listener, NULL, NULL);
+    check_ne(f, NULL);
+    check_eq(green_poller_add(poller, f), 0);
+    check_eq(green_select(poller), f);
+    int peer = -1;
+    check_eq(green_future_result(f, NULL, &peer), 0);
+    check_eq(green_future_release(f), 0);
+    check_ge(peer, 0);
+
+    char data[16];
+    f = green_recv(loop, peer, data, sizeof(data), 0);
+    check_eq(green_poller_add(poller, f), 0);
+    check_eq(green_select(poller), f);
+    int n = -1;
+    check_eq(green_future_result(f, NULL, &n), 0);
+    check_eq(green_future_release(f), 0);
+    check_gt(n, 0);
+
+    f = green_send(loop, peer, data, n, 0);
+    check_eq(green_poller_add(poller, f), 0);
+    check_eq(green_select(poller), f);
+    check_eq(green_future_result(f, NULL, &n), 0);
+    check_eq(green_future_release(f), 0);
+
+    check_eq(close(peer), 0);
+    check_eq(green_poller_release(poller), 0);
+    return n;
+}
+
+int test(green_loop_t loop)
+{
+    // Arguments are required.
+    char data[16];
+    check_eq(green_read(NULL, 0, data, sizeof(data), -1), NULL);
+    check_eq(green_read(loop, -1, data, sizeof(data), -1), NULL);
+    check_eq(green_write(loop, 0, NULL, 1, -1), NULL);
+    check_eq(green_recv(loop, -1, data, sizeof(data), 0), NULL);
+    check_eq(green_send(NULL, 0, data, sizeof(data), 0), NULL);
+    check_eq(green_accept(NULL, 0, NULL, NULL), NULL);
+    check_eq(green_connect(loop, 0, NULL, 0), NULL);
+
+    // Pipe.
+    int pipes[2];
+    check_eq(pipe(pipes), 0);
+    green_future_t w = green_write(loop, pipes[1], "hello", 5, -1);
+    green_future_t r = green_read(loop, pipes[0], data, sizeof(data), -1);
+    check_eq(complete(loop, w), 5);
+    check_eq(complete(loop, r), 5);
+    check_eq(memcmp(data, "hello", 5), 0);
+    check_eq(close(pipes[0]), 0);
+    check_eq(close(pipes[1]), 0);
+
+    // Canceling a read in flight stops it before the buffer is reused.
+    check_eq(pipe(pipes), 0);
+    r = green_read(loop, pipes[0], data, sizeof(data), -1);
+    check_ne(r, NULL);
+    green_future_t t = green_timer_future(loop, green_now() + 1000000);
+    check_eq(green_loop_run_until(loop, t), 0);
+    check_eq(green_future_release(t), 0);
+    check_eq(green_future_done(r), 0);
+    check_eq(green_future_cancel(r), 0);
+    check_eq(green_future_release(r), 0);
+    memset(data, 'x', sizeof(data));
+    check_eq(write(pipes[1], "hello", 5), 5);
+    char copy[16];
+    check_eq(read(pipes[0], copy, sizeof(copy)), 5);
+    check_eq(memcmp(copy, "hello", 5), 0);
+    for (size_t i = 0; i < sizeof(data); ++i) {
+        check_eq(data[i], 'x');
+    }
+    check_eq(green_loop_run(loop), 0);
+    check_eq(close(pipes[0]), 0);
+    check_eq(close(pipes[1]), 0);
+
+    // File, at given offsets.  Operations are batched.
+    FILE * file = tmpfile();
+    check_ne(file, NULL);
+    int fd = fileno(file);
+    green_future_t fs[4];
+    for (int i = 0; i < 4; ++i) {
+        fs[i] = green_write(loop, fd, "abcd" + i, 1, i);
+    }
+    for (int i = 0; i < 4; ++i) {
+        check_eq(complete(loop, fs[i]), 1);
+    }
+    memset(data, 0, sizeof(data));
+    check_eq(complete(loop, green_read(loop, fd, data, 2, 2)), 2);
+    check_eq(memcmp(data, "cd", 2), 0);
+    check_eq(complete(loop, green_read(loop, fd, data, 2, 8)), 0);
+
+    // Errors are reported as negated error codes.
+    check_eq(complete(loop, green_read(loop, 1000, data, 2, 0)), -EBADF);
+    check_eq(fclose(file), 0);
+
+    // Sockets.
+    struct sockaddr_in addr;
+    socklen_t size = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    check_ge(listener, 0);
+    check_eq(bind(listener, (struct sockaddr*)&addr, size), 0);
+    check_eq(getsockname(listener, (struct sockaddr*)&addr, &size), 0);
+    check_eq(listen(listener, 1), 0);
+    green_coroutine_t coro = green_coroutine_init(loop, server, NULL, 0);
+    check_ne(coro, NULL);
+
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    check_ge(client, 0);
+    check_eq(complete(loop, green_connect(loop, client,
+                                          (struct sockaddr*)&addr, size)), 0);
+    check_eq(complete(loop, green_send(loop, client, "ping", 4, 0)), 4);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_result(coro), 4);
+    check_eq(green_coroutine_release(coro), 0);
+
+    // Server echoed the message and closed the connection.
+    memset(data, 0, sizeof(data));
+    check_eq(complete(loop, green_recv(loop, client, data, 8, 0)), 4);
+    check_eq(memcmp(data, "ping", 4), 0);
+    check_eq(complete(loop, green_recv(loop, client, data, 8, 0)), 0);
+    check_eq(close(client), 0);
+    check_eq(close(listener), 0);
+
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
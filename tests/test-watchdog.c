@@ -0,0 +1,92 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+#include "loop-fixture.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include "configure.h"
+
+#define MILLISECOND ((int64_t)1000000)
+
+// Hold the loop without yielding.
+int hog(green_loop_t loop, void * object)
+{
+    const int64_t start = green_now();
+    while (green_now() - start < 100 * MILLISECOND) {
+    }
+    return 0;
+}
+
+int polite(green_loop_t loop, void * object)
+{
+    for (int i = 0; i < 10; ++i) {
+        check_eq(green_yield(loop, NULL), 0);
+    }
+    return 0;
+}
+
+// Run one coroutine, return what the watchdog wrote.
+static size_t run(green_loop_t loop, int(*method)(green_loop_t,void*),
+                  int fd, char * data, size_t size)
+{
+    green_coroutine_t coro = green_coroutine_init(loop, method, NULL, 0);
+    check_ne(coro, NULL);
+    check_eq(green_loop_run(loop), 0);
+    check_eq(green_coroutine_release(coro), 0);
+    ssize_t n = read(fd, data, size - 1);
+    if (n < 0) {
+        n = 0;
+    }
+    data[n] = '\0';
+    return (size_t)n;
+}
+
+int test(green_loop_t loop)
+{
+    static char data[65536];
+    int fds[2];
+    check_eq(pipe(fds), 0);
+    check_eq(fcntl(fds[0], F_SETFL, O_NONBLOCK), 0);
+
+    // Arguments are required.
+    check_eq(green_loop_watchdog(NULL, 10 * MILLISECOND, fds[1], 0),
+             GREEN_EINVAL);
+    check_eq(green_loop_watchdog(loop, 10 * MILLISECOND, -1, 0),
+             GREEN_EINVAL);
+    check_eq(green_loop_watchdog(loop, 0, -1, 0), 0);
+
+    // Coroutines that yield are left alone, hogs are reported once.
+    check_eq(green_loop_watchdog(loop, 20 * MILLISECOND, fds[1], 0), 0);
+    check_eq(run(loop, polite, fds[0], data, sizeof(data)), 0);
+    check_gt(run(loop, hog, fds[0], data, sizeof(data)), 0);
+    check_ne(strstr(data, "green: coroutine 2 has held the loop"), NULL);
+    check_ne(strstr(data, "test-watchdog.c"), NULL);
+    check_eq(strchr(data, '\n'), data + strlen(data) - 1);
+
+#if GREEN_USE_BACKTRACE
+    // The loop's thread can print its stack too.
+    check_eq(green_loop_watchdog(loop, 20 * MILLISECOND, fds[1], SIGUSR1), 0);
+    check_gt(run(loop, hog, fds[0], data, sizeof(data)), 0);
+    check_ne(strstr(data, "green: coroutine 3 has held the loop"), NULL);
+    check_lt(strchr(data, '\n'), data + strlen(data) - 1);
+#else
+    check_eq(green_loop_watchdog(loop, 20 * MILLISECOND, fds[1], SIGUSR1),
+             GREEN_EINVAL);
+#endif
+
+    // Disabled watchdog doesn't report anything.
+    check_eq(green_loop_watchdog(loop, 0, -1, 0), 0);
+    check_eq(run(loop, hog, fds[0], data, sizeof(data)), 0);
+
+    // Leave it enabled for teardown.
+    check_eq(green_loop_watchdog(loop, 20 * MILLISECOND, fds[1], 0), 0);
+
+    close(fds[1]);
+    close(fds[0]);
+    return EXIT_SUCCESS;
+}
+
+#include "loop-fixture.c"
@@ -0,0 +1,156 @@
+////////////////////////////////////////////////////////////////////////
+// Copyright(c) libgreen contributors.  See LICENSE file for details. //
+////////////////////////////////////////////////////////////////////////
+
+// Convert a trace dump (see `green_loop_trace_dump()`) to the Chrome trace
+// event format, which can be loaded in `chrome://tracing` or Perfetto.
+//
+//   green-trace <dump> [<output>]
+//
+// Each coroutine gets its own track, with a slice for each time it runs.
+
+#include <green.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct source {
+    uint64_t address;
+    char * string;
+} source_t;
+
+static source_t * sources = NULL;
+static uint32_t source_count = 0;
+
+static const char * lookup(uint64_t address)
+{
+    for (uint32_t i = 0; i < source_count; ++i) {
+        if (sources[i].address == address) {
+            return sources[i].string;
+        }
+    }
+    return NULL;
+}
+
+static void print_string(FILE * output, const char * string)
+{
+    fputc('"', output);
+    for (; *string; ++string) {
+        if ((*string == '"') || (*string == '\\')) {
+            fputc('\\', output);
+        }
+        if ((unsigned char)*string >= 0x20) {
+            fputc(*string, output);
+        }
+    }
+    fputc('"', output);
+}
+
+static const char * names[] = {
+    NULL,
+    "spawn",
+    "resume",
+    "suspend",
+    "stop",
+    "complete",
+    "cancel",
+    "poller add",
+    "poller rem",
+    "poller pop",
+};
+
+int main(int argc, char ** argv)
+{
+    if ((argc < 2) || (argc > 3)) {
+        fprintf(stderr, "usage: green-trace <dump> [<output>]\n");
+        return EXIT_FAILURE;
+    }
+    FILE * input = fopen(argv[1], "rb");
+    if (input == NULL) {
+        perror(argv[1]);
+        return EXIT_FAILURE;
+    }
+    FILE * output = (argc == 3)? fopen(argv[2], "w") : stdout;
+    if (output == NULL) {
+        perror(argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    green_trace_header_t header;
+    if ((fread(&header, sizeof(header), 1, input) != 1) ||
+        (memcmp(header.magic, GREEN_TRACE_MAGIC, sizeof(header.magic)) != 0) ||
+        (header.format != GREEN_TRACE_FORMAT)) {
+        fprintf(stderr, "%s: not a trace dump.\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    green_trace_event_t * events = calloc(header.events + 1, sizeof(*events));
+    sources = calloc(header.strings + 1, sizeof(*sources));
+    if ((events == NULL) || (sources == NULL) ||
+        (fread(events, sizeof(*events), header.events, input) != header.events)) {
+        fprintf(stderr, "%s: truncated dump.\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    for (source_count = 0; source_count < header.strings; ++source_count) {
+        source_t * source = &sources[source_count];
+        uint32_t length[2];
+        if ((fread(&source->address, sizeof(source->address), 1, input) != 1) ||
+            (fread(length, sizeof(length), 1, input) != 1) ||
+            ((source->string = calloc(length[0] + 1, 1)) == NULL) ||
+            (fread(source->string, 1, length[0], input) != length[0])) {
+            fprintf(stderr, "%s: truncated dump.\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Timestamps are in microseconds, relative to the first event.
+    const int64_t origin = (header.events > 0)? events[0].time : 0;
+    fprintf(output, "{\"traceEvents\":[\n");
+    fprintf(output, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                    "\"tid\":0,\"args\":{\"name\":\"loop\"}}");
+    for (uint32_t i = 0; i < header.events; ++i) {
+        const green_trace_event_t * event = &events[i];
+        if ((event->type == 0) ||
+            (event->type >= sizeof(names)/sizeof(names[0]))) {
+            continue;
+        }
+        const double ts = (double)(event->time - origin) / 1000.0;
+        const char * source = lookup(event->source);
+        fprintf(output, ",\n");
+        switch (event->type) {
+        case GREEN_TRACE_RESUME:
+            fprintf(output, "{\"name\":\"coroutine %u\",\"ph\":\"B\","
+                            "\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+                    event->coro, event->coro, ts);
+            break;
+        case GREEN_TRACE_SUSPEND:
+        case GREEN_TRACE_STOP:
+            fprintf(output, "{\"ph\":\"E\",\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+                    event->coro, ts);
+            break;
+        default:
+            fprintf(output, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+                            "\"pid\":1,\"tid\":%u,\"ts\":%.3f",
+                    names[event->type], event->coro, ts);
+            break;
+        }
+        fprintf(output, ",\"args\":{\"arg\":\"0x%llx\"",
+                (unsigned long long)event->arg);
+        if (source) {
+            fprintf(output, ",\"source\":");
+            print_string(output, source);
+        }
+        fprintf(output, "}}");
+    }
+    fprintf(output, "\n]}\n");
+
+    for (uint32_t i = 0; i < source_count; ++i) {
+        free(sources[i].string);
+    }
+    free(sources);
+    free(events);
+    fclose(input);
+    if (output != stdout) {
+        fclose(output);
+    }
+    return EXIT_SUCCESS;
+}